@@ -333,6 +333,78 @@ void test(uint64_t size, uint64_t steps, uint64_t seed) {
     }
 }
 
+template <class allocator>
+using alloc_bv = bv::bit_vector<
+    bv::leaf<16, 16384>, bv::node<bv::leaf<16, 16384>, uint64_t, 16384, 64, true>,
+    allocator, 16384, 64, uint64_t, true>;
+
+template <class bit_vector>
+void test_queries(const char* name, uint64_t size, uint64_t seed) {
+    bit_vector bv;
+
+    std::mt19937 mt(seed);
+    std::uniform_int_distribution<unsigned long long> gen(
+        std::numeric_limits<std::uint64_t>::min(),
+        std::numeric_limits<std::uint64_t>::max());
+
+    using std::chrono::duration_cast;
+    using std::chrono::high_resolution_clock;
+    using std::chrono::microseconds;
+
+    uint64_t ops = 1000000;
+    uint64_t checksum = 0;
+    std::vector<uint64_t> loc;
+
+    // Random insertions scatter leaves across the address space.
+    for (uint64_t i = 0; i < size; i++) {
+        bv.insert(gen(mt) % (i + 1), gen(mt) % 2);
+    }
+
+    std::cout << name << "\t" << seed << "\t" << size << "\t";
+
+    for (size_t i = 0; i < ops; i++) {
+        loc.push_back(gen(mt) % size);
+    }
+    auto t1 = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        checksum += bv.at(loc[i]);
+    }
+    auto t2 = high_resolution_clock::now();
+    std::cout << (double)duration_cast<microseconds>(t2 - t1).count() / ops
+              << "\t";
+
+    t1 = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        checksum += bv.rank(loc[i]);
+    }
+    t2 = high_resolution_clock::now();
+    std::cout << (double)duration_cast<microseconds>(t2 - t1).count() / ops
+              << "\t";
+
+    uint64_t limit = bv.rank(size);
+    loc.clear();
+    for (size_t i = 0; i < ops; i++) {
+        loc.push_back(gen(mt) % limit + 1);
+    }
+    t1 = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        checksum += bv.select(loc[i]);
+    }
+    t2 = high_resolution_clock::now();
+    std::cout << (double)duration_cast<microseconds>(t2 - t1).count() / ops
+              << "\t";
+
+    std::cout << bv.bit_size() << "\t" << checksum << std::endl;
+}
+
+void test_huge_pages(uint64_t size, uint64_t seed) {
+    std::cout << "allocator\tseed\tsize\taccess\trank\tselect\tsize(bits)\t"
+              << "checksum" << std::endl;
+    test_queries<alloc_bv<bv::malloc_alloc>>("malloc", size, seed);
+    test_queries<alloc_bv<bv::arena_alloc>>("arena", size, seed);
+    test_queries<alloc_bv<bv::huge_page_alloc>>("huge_page", size, seed);
+}
+
 void help() {
     std::cout << "Benchmark some dynamic bit vectors.\n"
               << "Type and seed is required.\n"
@@ -345,7 +417,9 @@ void help() {
               << "            3 for new implementation with no buffer\n"
               << "            4 for sdsl bit_vector\n"
               << "            5 for tree with hybrid rlz leaves\n"
-              << "            6 for implementation with unsorted buffers\n";
+              << "            6 for implementation with unsorted buffers\n"
+              << "            7 for random queries with and without huge "
+                 "pages\n";
     std::cout << "   <seed>   seed to use for running the test\n";
     std::cout << "   <size>   number of bits in the bitvector\n";
     std::cout << "   <steps>  How many data points to generate in the "
@@ -406,6 +480,10 @@ int main(int argc, char const* argv[]) {
         std::cerr << "unsorted, 64, 512, 16384" << std::endl;
         test<bv::simple_bv<128, 16384, 64, true, true, false, false>, 1, 128, 64,
              16384, false>(size, steps, seed);
+    } else if (type == 7) {
+        std::cerr << "malloc vs. arena vs. huge pages, 64, 16, 16384"
+                  << std::endl;
+        test_huge_pages(size, seed);
     }
     return 0;
 }
@@ -3,9 +3,13 @@
 
 #include "internal/allocator.hpp"
 #include "internal/bit_vector.hpp"
+#include "internal/concurrent_bit_vector.hpp"
 #include "internal/leaf.hpp"
 #include "internal/node.hpp"
 #include "internal/gap_leaf.hpp"
+#include "internal/mapped_bit_vector.hpp"
+#include "internal/query_support.hpp"
+#include "internal/sharded_bit_vector.hpp"
 
 namespace bv {
 
@@ -1,18 +1,119 @@
 #ifndef BV_ALLOCATOR_HPP
 #define BV_ALLOCATOR_HPP
 
+#include <malloc.h>
 #include <signal.h>
+#include <sys/mman.h>
 
+#include <algorithm>
+#include <cassert>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <iterator>
+#include <map>
 #include <new>
+#include <set>
+#include <utility>
+#include <vector>
 
 #include "uncopyable.hpp"
 
+#ifndef CACHE_LINE
+// Apparently the most common cache line size is 64.
+#define CACHE_LINE 64
+#endif
+
 namespace bv {
 
+/**
+ * @brief Memory usage statistics of an allocator.
+ *
+ * Updated with a handful of additions on every allocator operation, so
+ * statistics are always collected.
+ */
+struct alloc_stats {
+    /** @brief Number of bins in the leaf capacity histogram. */
+    static const constexpr uint16_t CAPACITY_BINS = 24;
+
+    uint64_t requested_bytes = 0;      ///< Bytes requested by live objects.
+    uint64_t reserved_bytes = 0;       ///< Bytes reserved from the system.
+    uint64_t peak_reserved_bytes = 0;  ///< Maximum of `reserved_bytes`.
+    uint64_t reallocations = 0;        ///< Number of leaf reallocations.
+    uint64_t copied_bytes = 0;         ///< Bytes moved by reallocations.
+    /**
+     * @brief Leaf capacity histogram.
+     *
+     * Bin `i` contains the number of live leaves with capacity in the
+     * \f$[2^i, 2^{i + 1})\f$ word range.
+     */
+    uint64_t leaf_capacities[CAPACITY_BINS] = {};
+
+    /** @brief Histogram bin for leaves with `cap` words of capacity. */
+    static uint16_t capacity_bin(uint64_t cap) {
+        uint16_t bin = cap > 1 ? 63 - __builtin_clzll(cap) : 0;
+        return bin < CAPACITY_BINS ? bin : CAPACITY_BINS - 1;
+    }
+
+    void reserve(uint64_t bytes) {
+        reserved_bytes += bytes;
+        if (reserved_bytes > peak_reserved_bytes) {
+            peak_reserved_bytes = reserved_bytes;
+        }
+    }
+
+    void release(uint64_t bytes) { reserved_bytes -= bytes; }
+
+    void add_leaf(uint64_t cap) { leaf_capacities[capacity_bin(cap)]++; }
+
+    void remove_leaf(uint64_t cap) { leaf_capacities[capacity_bin(cap)]--; }
+
+    /**
+     * @brief Fraction of reserved memory not requested by live objects.
+     */
+    double fragmentation() const {
+        if (reserved_bytes == 0) return 0;
+        return 1 - double(requested_bytes) / reserved_bytes;
+    }
+
+    /**
+     * @brief Add the counts of `other` to these statistics.
+     *
+     * The peak of the sum is not known, so the peak is approximated by the
+     * sum of peaks.
+     */
+    alloc_stats& operator+=(const alloc_stats& other) {
+        requested_bytes += other.requested_bytes;
+        reserved_bytes += other.reserved_bytes;
+        peak_reserved_bytes += other.peak_reserved_bytes;
+        reallocations += other.reallocations;
+        copied_bytes += other.copied_bytes;
+        for (uint16_t i = 0; i < CAPACITY_BINS; i++) {
+            leaf_capacities[i] += other.leaf_capacities[i];
+        }
+        return *this;
+    }
+
+    /** @brief Write a human readable summary to `out`. */
+    void print(std::ostream& out = std::cout) const {
+        out << "requested bytes: " << requested_bytes << "\n"
+            << "reserved bytes: " << reserved_bytes << "\n"
+            << "peak reserved bytes: " << peak_reserved_bytes << "\n"
+            << "fragmentation: " << fragmentation() << "\n"
+            << "reallocations: " << reallocations << "\n"
+            << "copied bytes: " << copied_bytes << "\n"
+            << "leaf capacities (words: count):\n";
+        for (uint16_t i = 0; i < CAPACITY_BINS; i++) {
+            if (leaf_capacities[i] > 0) {
+                out << "  " << (uint64_t(1) << i) << ": " << leaf_capacities[i]
+                    << "\n";
+            }
+        }
+        out << std::flush;
+    }
+};
+
 /**
  * @brief Simple malloc based allocation for internal nodes and leaves.
  *
@@ -20,13 +121,17 @@ namespace bv {
  *
  * For leaves, a block is (re)allocated for housing both the leaf "struct" and
  * the associated data.
+ *
+ * Reserved bytes in the statistics are the usable sizes of the blocks as
+ * reported by `malloc_usable_size`.
  */
 class malloc_alloc : uncopyable {
    private:
     uint64_t allocations_;  ///< Number of objects currently allocated.
+    alloc_stats stats_;     ///< Memory usage statistics.
 
    public:
-    malloc_alloc() { allocations_ = 0; }
+    malloc_alloc() : stats_() { allocations_ = 0; }
 
     /**
      * @brief Allocate new internal node.
@@ -39,6 +144,8 @@ class malloc_alloc : uncopyable {
     node_type* allocate_node() {
         allocations_++;
         void* nd = malloc(sizeof(node_type));
+        stats_.requested_bytes += sizeof(node_type);
+        stats_.reserve(malloc_usable_size(nd));
         return new (nd) node_type();
     }
 
@@ -54,6 +161,8 @@ class malloc_alloc : uncopyable {
     template <class node_type>
     void deallocate_node(node_type* node) {
         allocations_--;
+        stats_.requested_bytes -= sizeof(node_type);
+        stats_.release(malloc_usable_size(node));
         free(node);
     }
 
@@ -76,6 +185,9 @@ class malloc_alloc : uncopyable {
         if (leaf == NULL) {
             [[unlikely]] raise(SIGSEGV);
         }
+        stats_.requested_bytes += leaf_bytes + size * sizeof(uint64_t);
+        stats_.reserve(malloc_usable_size(leaf));
+        stats_.add_leaf(size);
         uint8_t* data_ptr = reinterpret_cast<uint8_t*>(leaf) + leaf_bytes;
         memset(data_ptr, 0, size * sizeof(uint64_t));
         return new (leaf)
@@ -97,6 +209,10 @@ class malloc_alloc : uncopyable {
     template <class leaf_type>
     void deallocate_leaf(leaf_type* leaf) {
         allocations_--;
+        constexpr size_t leaf_bytes = sizeof(leaf_type) + sizeof(leaf_type) % 8;
+        stats_.requested_bytes -= leaf_bytes + leaf->capacity() * sizeof(uint64_t);
+        stats_.release(malloc_usable_size(leaf));
+        stats_.remove_leaf(leaf->capacity());
         free(leaf);
     }
 
@@ -115,12 +231,24 @@ class malloc_alloc : uncopyable {
     leaf_type* reallocate_leaf(leaf_type* leaf, uint64_t old_size,
                                uint64_t new_size) {
         constexpr size_t leaf_bytes = sizeof(leaf_type) + sizeof(leaf_type) % 8;
+        uintptr_t old_addr = reinterpret_cast<uintptr_t>(leaf);
+        stats_.release(malloc_usable_size(leaf));
 #pragma GCC diagnostic ignored "-Wclass-memaccess"
 
         leaf_type* n_leaf = reinterpret_cast<leaf_type*>(
             realloc(leaf, leaf_bytes + new_size * sizeof(uint64_t)));
 #pragma GCC diagnostic pop
         if (n_leaf == NULL) [[unlikely]] raise(SIGSEGV);
+        stats_.reserve(malloc_usable_size(n_leaf));
+        stats_.requested_bytes += new_size * sizeof(uint64_t);
+        stats_.requested_bytes -= old_size * sizeof(uint64_t);
+        stats_.remove_leaf(old_size);
+        stats_.add_leaf(new_size);
+        stats_.reallocations++;
+        if (reinterpret_cast<uintptr_t>(n_leaf) != old_addr) {
+            uint64_t words = old_size < new_size ? old_size : new_size;
+            stats_.copied_bytes += leaf_bytes + words * sizeof(uint64_t);
+        }
         uint8_t* data_ptr = reinterpret_cast<uint8_t*>(n_leaf) + leaf_bytes;
         if (old_size < new_size) {
             memset(data_ptr + sizeof(uint64_t) * old_size, 0,
@@ -138,6 +266,1011 @@ class malloc_alloc : uncopyable {
      * @return Number of blocks currently allocated by this allocator instance.
      */
     uint64_t live_allocations() const { return allocations_; }
+
+    /**
+     * @brief Start allocating leaves for `bit_vector::compact`.
+     *
+     * Does nothing, since leaf placement is left to `malloc`.
+     */
+    void begin_compaction() {}
+
+    /** @brief Stop allocating leaves for `bit_vector::compact`. */
+    void end_compaction(bool) {}
+
+    /** @brief Memory usage statistics of this allocator instance. */
+    const alloc_stats& stats() const { return stats_; }
+};
+
+/**
+ * @brief Memory source for allocators that reserve memory in large blocks.
+ *
+ * Blocks are simply allocated with `aligned_alloc` and released with `free`.
+ */
+class heap_memory : uncopyable {
+   public:
+    /**
+     * @brief Allocate `bytes` bytes aligned to `align` bytes.
+     *
+     * `bytes` needs to be a multiple of `align`.
+     */
+    void* allocate(uint64_t bytes, uint64_t align) {
+        void* mem = aligned_alloc(align, bytes);
+        if (mem == NULL) [[unlikely]] raise(SIGSEGV);
+        return mem;
+    }
+
+    /** @brief Release a block returned by `allocate`. */
+    void deallocate(void* mem, uint64_t) { free(mem); }
+};
+
+/**
+ * @brief Memory source backed by huge pages.
+ *
+ * Reserves 64 MiB regions with `mmap` and hands out blocks from them. Each
+ * region is first requested with `MAP_HUGETLB`, using explicit 2 MiB pages
+ * if the system has them available. Otherwise a 2 MiB aligned region of
+ * normal pages is mapped and `madvise(MADV_HUGEPAGE)` is applied so that
+ * transparent huge pages back the region.
+ *
+ * Released blocks, alignment gaps and the unused ends of earlier regions are
+ * kept for reuse by later requests, since parts of huge pages can't be
+ * unmapped individually. This lets requests with different alignments, such
+ * as arena chunks and node slabs, share regions without wasting the padding
+ * between them. Adjacent unused ranges are merged, and requests are served
+ * from the smallest unused range that fits, so fragmentation doesn't build
+ * up. Regions are unmapped when the source is destroyed.
+ */
+class huge_page_memory : uncopyable {
+   private:
+    static const constexpr uint64_t HUGE_PAGE = uint64_t(1) << 21;
+    static const constexpr uint64_t REGION_BYTES = uint64_t(1) << 26;
+
+    struct region {
+        uint8_t* start;
+        uint64_t bytes;
+    };
+
+    std::vector<region> regions_;  ///< All regions mapped so far.
+    /** @brief Sizes of unused ranges by start address. */
+    std::map<uint8_t*, uint64_t> free_;
+    /** @brief Unused ranges ordered by size for best fit reuse. */
+    std::set<std::pair<uint64_t, uint8_t*>> free_sizes_;
+    uint8_t* next_;                ///< Start of unused space in last region.
+    uint8_t* end_;                 ///< End of the last region.
+    uint64_t explicit_bytes_;      ///< Bytes mapped with explicit huge pages.
+
+    /** @brief Map a new huge page aligned region of `bytes` bytes. */
+    uint8_t* map(uint64_t bytes) {
+#ifdef MAP_HUGETLB
+        void* mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            explicit_bytes_ += bytes;
+            regions_.push_back({reinterpret_cast<uint8_t*>(mem), bytes});
+            return regions_.back().start;
+        }
+#endif
+        void* raw = mmap(nullptr, bytes + HUGE_PAGE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (raw == MAP_FAILED) [[unlikely]] raise(SIGSEGV);
+        uint8_t* start = reinterpret_cast<uint8_t*>(
+            (reinterpret_cast<uintptr_t>(raw) + HUGE_PAGE - 1) &
+            ~(HUGE_PAGE - 1));
+        uint64_t head = start - reinterpret_cast<uint8_t*>(raw);
+        if (head > 0) munmap(raw, head);
+        munmap(start + bytes, HUGE_PAGE - head);
+#ifdef MADV_HUGEPAGE
+        madvise(start, bytes, MADV_HUGEPAGE);
+#endif
+        regions_.push_back({start, bytes});
+        return start;
+    }
+
+    /**
+     * @brief Keep \f$[\mathrm{begin}, \mathrm{end})\f$ for reuse, merged
+     * with adjacent unused ranges.
+     */
+    void keep(uint8_t* begin, uint8_t* end) {
+        if (begin >= end) {
+            return;
+        }
+        auto next = free_.lower_bound(begin);
+        if (next != free_.end() && next->first == end) {
+            end += next->second;
+            free_sizes_.erase({next->second, next->first});
+            next = free_.erase(next);
+        }
+        if (next != free_.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == begin) {
+                begin = prev->first;
+                free_sizes_.erase({prev->second, prev->first});
+                free_.erase(prev);
+            }
+        }
+        free_.emplace_hint(next, begin, uint64_t(end - begin));
+        free_sizes_.insert({uint64_t(end - begin), begin});
+    }
+
+    static uint8_t* align_up(uint8_t* p, uint64_t align) {
+        return reinterpret_cast<uint8_t*>(
+            (reinterpret_cast<uintptr_t>(p) + align - 1) & ~(align - 1));
+    }
+
+    /**
+     * @brief Take an aligned block from the smallest unused range that fits
+     * it, keeping the parts before and after it.
+     *
+     * Only ranges smaller than `bytes + align - 1` may fail to fit after
+     * alignment, so few ranges are inspected.
+     *
+     * @return Null if no unused space fits the block.
+     */
+    uint8_t* reuse(uint64_t bytes, uint64_t align) {
+        auto it = free_sizes_.lower_bound({bytes, nullptr});
+        for (; it != free_sizes_.end(); ++it) {
+            uint8_t* start = it->second;
+            uint8_t* end = start + it->first;
+            uint8_t* mem = align_up(start, align);
+            if (mem < end && uint64_t(end - mem) >= bytes) {
+                free_sizes_.erase(it);
+                free_.erase(start);
+                keep(start, mem);
+                keep(mem + bytes, end);
+                return mem;
+            }
+        }
+        return nullptr;
+    }
+
+   public:
+    huge_page_memory()
+        : regions_(),
+          free_(),
+          free_sizes_(),
+          next_(nullptr),
+          end_(nullptr),
+          explicit_bytes_(0) {}
+
+    ~huge_page_memory() {
+        for (auto r : regions_) {
+            munmap(r.start, r.bytes);
+        }
+    }
+
+    /**
+     * @brief Allocate `bytes` bytes aligned to `align` bytes.
+     *
+     * `align` needs to be a power of two no larger than 2 MiB.
+     */
+    void* allocate(uint64_t bytes, uint64_t align) {
+        uint8_t* mem = reuse(bytes, align);
+        if (mem != nullptr) {
+            return mem;
+        }
+        mem = align_up(next_, align);
+        if (next_ == nullptr || mem + bytes > end_) [[unlikely]] {
+            keep(next_, end_);
+            uint64_t r_bytes = (bytes + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+            r_bytes = r_bytes > REGION_BYTES ? r_bytes : REGION_BYTES;
+            mem = map(r_bytes);
+            end_ = mem + r_bytes;
+        } else {
+            keep(next_, mem);
+        }
+        next_ = mem + bytes;
+        return mem;
+    }
+
+    /**
+     * @brief Release a block returned by `allocate` for reuse.
+     *
+     * Memory is returned to the system when the memory source is destroyed.
+     */
+    void deallocate(void* mem, uint64_t bytes) {
+        uint8_t* start = reinterpret_cast<uint8_t*>(mem);
+        keep(start, start + bytes);
+    }
+
+    /** @brief Number of bytes mapped. */
+    uint64_t mapped_bytes() const {
+        uint64_t ret = 0;
+        for (auto r : regions_) {
+            ret += r.bytes;
+        }
+        return ret;
+    }
+
+    /** @brief Number of bytes mapped with explicit huge pages. */
+    uint64_t explicit_bytes() const { return explicit_bytes_; }
+};
+
+/**
+ * @brief Slab based allocation for internal nodes.
+ *
+ * Internal nodes of a bit vector are all the same size, so they are carved
+ * out of large slabs of cache line aligned slots instead of being allocated
+ * individually. Deallocated nodes are pushed to an intrusive free list and
+ * reused by subsequent allocations. Slab memory is only returned to the
+ * memory source when the allocator is destroyed. The memory source is owned
+ * by the allocator unless one is passed to the constructor.
+ *
+ * Leaves are allocated exactly as by bv::malloc_alloc.
+ *
+ * All nodes allocated by an instance need to be of the same type.
+ *
+ * @tparam memory Source of slab memory. bv::heap_memory or
+ *                bv::huge_page_memory.
+ */
+template <class memory = heap_memory>
+class basic_pool_alloc : uncopyable {
+   private:
+    /** @brief Number of node slots in each slab. */
+    static const constexpr uint64_t SLAB_NODES = 64;
+
+    /** @brief Free list entry stored in the first bytes of a free slot. */
+    struct free_slot {
+        free_slot* next;
+    };
+
+    memory own_memory_;          ///< Memory source unless one is given.
+    memory* memory_;             ///< Source of slab memory.
+    malloc_alloc leaves_;        ///< Allocator used for leaves.
+    std::vector<void*> slabs_;   ///< All slabs allocated so far.
+    free_slot* free_list_;       ///< Previously deallocated slots.
+    uint8_t* next_slot_;         ///< Next never used slot in the last slab.
+    uint8_t* slab_end_;          ///< End of the last slab.
+    uint64_t slot_bytes_;        ///< Size of a slot. 0 before first use.
+    uint64_t nodes_;             ///< Number of nodes currently allocated.
+    alloc_stats stats_;          ///< Statistics for nodes.
+    uint64_t peak_;              ///< Peak bytes reserved for nodes and leaves.
+
+    void update_peak() {
+        uint64_t reserved = reserved_bytes();
+        peak_ = reserved > peak_ ? reserved : peak_;
+    }
+
+    /**
+     * @brief Get an unused slot, allocating a new slab if necessary.
+     */
+    void* take_slot() {
+        if (free_list_ != nullptr) {
+            free_slot* slot = free_list_;
+            free_list_ = slot->next;
+            return slot;
+        }
+        if (next_slot_ == slab_end_) [[unlikely]] {
+            void* slab = memory_->allocate(SLAB_NODES * slot_bytes_, CACHE_LINE);
+            slabs_.push_back(slab);
+            stats_.reserve(SLAB_NODES * slot_bytes_);
+            update_peak();
+            next_slot_ = reinterpret_cast<uint8_t*>(slab);
+            slab_end_ = next_slot_ + SLAB_NODES * slot_bytes_;
+        }
+        void* slot = next_slot_;
+        next_slot_ += slot_bytes_;
+        return slot;
+    }
+
+   public:
+    basic_pool_alloc() : basic_pool_alloc(nullptr) {}
+
+    /**
+     * @brief Create a pool taking slabs from `source`.
+     *
+     * `source` needs to outlive the pool. If null, the pool uses its own
+     * memory source.
+     */
+    explicit basic_pool_alloc(memory* source)
+        : own_memory_(),
+          memory_(source != nullptr ? source : &own_memory_),
+          leaves_(),
+          slabs_(),
+          free_list_(nullptr),
+          next_slot_(nullptr),
+          slab_end_(nullptr),
+          slot_bytes_(0),
+          nodes_(0),
+          stats_(),
+          peak_(0) {}
+
+    ~basic_pool_alloc() {
+        for (void* slab : slabs_) {
+            memory_->deallocate(slab, SLAB_NODES * slot_bytes_);
+        }
+    }
+
+    /**
+     * @brief Allocate new internal node.
+     *
+     * Pops a slot from the free list, or takes the next unused slot of the
+     * current slab. Slots are `sizeof(node_type)` rounded up to a multiple
+     * of the cache line size.
+     *
+     * @tparam node_type Internal node type. Typically some kind of bv::node.
+     */
+    template <class node_type>
+    node_type* allocate_node() {
+        static_assert(alignof(node_type) <= CACHE_LINE);
+        constexpr uint64_t bytes =
+            (sizeof(node_type) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+        if (slot_bytes_ == 0) {
+            [[unlikely]] slot_bytes_ = bytes;
+        }
+        assert(slot_bytes_ == bytes);
+        nodes_++;
+        stats_.requested_bytes += sizeof(node_type);
+        return new (take_slot()) node_type();
+    }
+
+    /**
+     * @brief Deallocate internal node.
+     *
+     * Pushes the slot of the node to the free list for reuse.
+     *
+     * @tparam node_type Internal node type. Typically some kind of bv::node.
+     *
+     * @param node Internal node to deallocate.
+     */
+    template <class node_type>
+    void deallocate_node(node_type* node) {
+        nodes_--;
+        stats_.requested_bytes -= sizeof(node_type);
+        free_slot* slot = reinterpret_cast<free_slot*>(node);
+        slot->next = free_list_;
+        free_list_ = slot;
+    }
+
+    /**
+     * @brief Allocates a new leaf with space for storing `size * 64` bits.
+     *
+     * See bv::malloc_alloc::allocate_leaf.
+     */
+    template <class leaf_type>
+    leaf_type* allocate_leaf(uint64_t size, uint32_t elems = 0, bool val = false) {
+        leaf_type* leaf =
+            leaves_.template allocate_leaf<leaf_type>(size, elems, val);
+        update_peak();
+        return leaf;
+    }
+
+    template <class leaf_type>
+    leaf_type* allocate_leaf() {
+        return allocate_leaf<leaf_type>(leaf_type::init_capacity());
+    }
+
+    /** @brief Deallocates leaf node. See bv::malloc_alloc::deallocate_leaf. */
+    template <class leaf_type>
+    void deallocate_leaf(leaf_type* leaf) {
+        leaves_.deallocate_leaf(leaf);
+    }
+
+    /**
+     * @brief Reallocator for leaf nodes.
+     *
+     * See bv::malloc_alloc::reallocate_leaf.
+     */
+    template <class leaf_type>
+    leaf_type* reallocate_leaf(leaf_type* leaf, uint64_t old_size,
+                               uint64_t new_size) {
+        leaf = leaves_.reallocate_leaf(leaf, old_size, new_size);
+        update_peak();
+        return leaf;
+    }
+
+    /**
+     * @brief Get the number of blocks currenty allocated by this allocator
+     * instance.
+     *
+     * @return Number of nodes and leaves currently allocated.
+     */
+    uint64_t live_allocations() const {
+        return nodes_ + leaves_.live_allocations();
+    }
+
+    /**
+     * @brief Start allocating leaves for `bit_vector::compact`.
+     *
+     * See bv::malloc_alloc::begin_compaction.
+     */
+    void begin_compaction() { leaves_.begin_compaction(); }
+
+    /**
+     * @brief Stop allocating leaves for `bit_vector::compact`.
+     *
+     * See bv::malloc_alloc::end_compaction.
+     */
+    void end_compaction(bool finished) { leaves_.end_compaction(finished); }
+
+    /** @brief Number of bytes reserved for node slabs. */
+    uint64_t slab_bytes() const {
+        return slabs_.size() * SLAB_NODES * slot_bytes_;
+    }
+
+    /** @brief Number of bytes currently reserved for nodes and leaves. */
+    uint64_t reserved_bytes() const {
+        return stats_.reserved_bytes + leaves_.stats().reserved_bytes;
+    }
+
+    /**
+     * @brief Memory usage statistics of this allocator instance.
+     *
+     * Combines slab usage for nodes with malloc usage for leaves.
+     */
+    alloc_stats stats() const {
+        alloc_stats ret = leaves_.stats();
+        ret += stats_;
+        ret.peak_reserved_bytes = peak_;
+        return ret;
+    }
+};
+
+/** @brief Node pool allocator using `aligned_alloc` for slabs. */
+typedef basic_pool_alloc<heap_memory> pool_alloc;
+
+/**
+ * @brief Arena based allocation with in-place growth for leaves.
+ *
+ * Leaf blocks are carved out of 1 MiB chunks using power-of-two size classes
+ * (a binary buddy system). The smallest class is a single cache line. A block
+ * of class \f$2^k\f$ bytes can grow in place to class \f$2^{k+1}\f$ if its
+ * buddy is free, and shrinking always happens in place by returning the upper
+ * halves of the block to the free lists. Growth within a size class only
+ * clears the new words, so most capacity increases of `leaf::desired_capacity`
+ * size steps never copy leaf data.
+ *
+ * During `bit_vector::compact`, leaf blocks are instead bump allocated in
+ * address order from fresh chunks, and chunks left without leaves are
+ * returned to the memory source. Otherwise chunks are only returned when the
+ * allocator is destroyed, at which point all memory is released in bulk.
+ * Leaves too large for a chunk are allocated with `malloc`/`realloc` as by
+ * bv::malloc_alloc.
+ *
+ * Internal nodes are allocated with bv::basic_pool_alloc, which takes its
+ * slabs from the memory source of the arena, so chunks and slabs share one
+ * set of regions with bv::huge_page_memory.
+ *
+ * @tparam memory Source of chunk and slab memory. bv::heap_memory or
+ *                bv::huge_page_memory.
+ */
+template <class memory = heap_memory>
+class basic_arena_alloc : uncopyable {
+   private:
+    /** @brief log<sub>2</sub> of the chunk size. */
+    static const constexpr uint16_t CHUNK_ORDER = 20;
+    /** @brief log<sub>2</sub> of the smallest block size. */
+    static const constexpr uint16_t MIN_ORDER = 6;
+    /** @brief log<sub>2</sub> of the largest block allocated from chunks. */
+    static const constexpr uint16_t MAX_ORDER = CHUNK_ORDER - 1;
+    static const constexpr uint64_t CHUNK_BYTES = uint64_t(1) << CHUNK_ORDER;
+    /**
+     * @brief log<sub>2</sub> of the bytes at the start of each chunk reserved
+     * for the free block index of the chunk.
+     */
+    static const constexpr uint16_t META_ORDER = CHUNK_ORDER - MIN_ORDER;
+
+    /** @brief Free list entry stored in the first bytes of a free block. */
+    struct free_block {
+        free_block* prev;
+        free_block* next;
+    };
+
+    memory memory_;                         ///< Chunk and slab memory.
+    basic_pool_alloc<memory> nodes_;        ///< Allocator used for nodes.
+    std::vector<void*> chunks_;             ///< All chunks allocated so far.
+    free_block* free_[CHUNK_ORDER];         ///< Free lists by block order.
+    uint64_t leaves_;                       ///< Number of leaves allocated.
+    alloc_stats stats_;                     ///< Statistics for leaves.
+    uint64_t peak_;  ///< Peak bytes reserved for nodes and leaves.
+    uint8_t* bump_;      ///< Next unused byte of the compaction chunk.
+    uint8_t* bump_end_;  ///< End of the compaction chunk.
+    bool compacting_;    ///< True between begin and end of compaction.
+
+    void update_peak() {
+        uint64_t reserved = stats_.reserved_bytes + nodes_.reserved_bytes();
+        peak_ = reserved > peak_ ? reserved : peak_;
+    }
+
+    /**
+     * @brief Size class of a leaf with `size` words of data.
+     */
+    template <class leaf_type>
+    static uint16_t order(uint64_t size) {
+        uint64_t bytes = leaf_bytes<leaf_type>() + size * sizeof(uint64_t);
+        uint16_t ord = MIN_ORDER;
+        while ((uint64_t(1) << ord) < bytes) {
+            ord++;
+        }
+        return ord;
+    }
+
+    template <class leaf_type>
+    static constexpr size_t leaf_bytes() {
+        return sizeof(leaf_type) + sizeof(leaf_type) % 8;
+    }
+
+    /**
+     * @brief Free block index entry for the block starting at `block`.
+     *
+     * Contains `order + 1` if a free block of size \f$2^{order}\f$ starts at
+     * `block`, 0 otherwise.
+     */
+    static uint8_t& free_order(uint8_t* block) {
+        uint64_t addr = reinterpret_cast<uintptr_t>(block);
+        uint8_t* chunk = reinterpret_cast<uint8_t*>(addr & ~(CHUNK_BYTES - 1));
+        return chunk[(addr & (CHUNK_BYTES - 1)) >> MIN_ORDER];
+    }
+
+    static uint8_t* chunk_of(uint8_t* block) {
+        return reinterpret_cast<uint8_t*>(reinterpret_cast<uintptr_t>(block) &
+                                          ~(CHUNK_BYTES - 1));
+    }
+
+    /**
+     * @brief Number of leaves in the chunk containing `block`.
+     *
+     * Stored in the free block index entries of the index itself, which
+     * never describe a block. Only the first entry is read, as the buddy of
+     * the lowest block of the chunk.
+     */
+    static uint64_t& chunk_leaves(uint8_t* block) {
+        return reinterpret_cast<uint64_t*>(chunk_of(block))[1];
+    }
+
+    static uint8_t* buddy(uint8_t* block, uint16_t ord) {
+        return reinterpret_cast<uint8_t*>(reinterpret_cast<uintptr_t>(block) ^
+                                          (uintptr_t(1) << ord));
+    }
+
+    void push_free(uint8_t* block, uint16_t ord) {
+        free_block* b = reinterpret_cast<free_block*>(block);
+        b->prev = nullptr;
+        b->next = free_[ord];
+        if (free_[ord] != nullptr) free_[ord]->prev = b;
+        free_[ord] = b;
+        free_order(block) = ord + 1;
+    }
+
+    void remove_free(uint8_t* block, uint16_t ord) {
+        free_block* b = reinterpret_cast<free_block*>(block);
+        if (b->prev != nullptr) {
+            b->prev->next = b->next;
+        } else {
+            free_[ord] = b->next;
+        }
+        if (b->next != nullptr) b->next->prev = b->prev;
+        free_order(block) = 0;
+    }
+
+    /**
+     * @brief Allocate a new chunk and add its blocks to the free lists.
+     *
+     * The first \f$2^{META\_ORDER}\f$ bytes hold the free block index and
+     * are never handed out, so the rest of the chunk is split into one free
+     * block of each order from META_ORDER to MAX_ORDER.
+     */
+    void add_chunk() {
+        uint8_t* chunk = new_chunk();
+        for (uint16_t ord = META_ORDER; ord <= MAX_ORDER; ord++) {
+            push_free(chunk + (uint64_t(1) << ord), ord);
+        }
+    }
+
+    /** @brief Allocate a chunk with an empty free block index. */
+    uint8_t* new_chunk() {
+        void* mem = memory_.allocate(CHUNK_BYTES, CHUNK_BYTES);
+        chunks_.push_back(mem);
+        stats_.reserve(CHUNK_BYTES);
+        uint8_t* chunk = reinterpret_cast<uint8_t*>(mem);
+        memset(chunk, 0, uint64_t(1) << META_ORDER);
+        return chunk;
+    }
+
+    /**
+     * @brief Return a chunk without leaves to the memory source.
+     *
+     * The blocks of a chunk without leaves have been merged back to the free
+     * blocks created by `add_chunk`, which are removed from the free lists.
+     */
+    void release_chunk(uint8_t* chunk) {
+        for (uint16_t ord = META_ORDER; ord <= MAX_ORDER; ord++) {
+            assert(free_order(chunk + (uint64_t(1) << ord)) == ord + 1);
+            remove_free(chunk + (uint64_t(1) << ord), ord);
+        }
+        chunks_.erase(std::find(chunks_.begin(), chunks_.end(), chunk));
+        memory_.deallocate(chunk, CHUNK_BYTES);
+        stats_.release(CHUNK_BYTES);
+    }
+
+    /**
+     * @brief Account for a leaf leaving the chunk containing `block`.
+     *
+     * During compaction, the chunk is released if it has no leaves left and
+     * is not the compaction chunk.
+     */
+    void drop_leaf(uint8_t* block) {
+        uint8_t* chunk = chunk_of(block);
+        if (--chunk_leaves(chunk) == 0 && compacting_ &&
+            (bump_ == nullptr || chunk != bump_end_ - CHUNK_BYTES)) {
+            release_chunk(chunk);
+        }
+    }
+
+    /**
+     * @brief Return \f$[\mathrm{begin}, \mathrm{end})\f$ of a chunk to the
+     * free lists as aligned blocks.
+     */
+    void release_range(uint8_t* begin, uint8_t* end) {
+        while (begin < end) {
+            uint16_t ord = MIN_ORDER;
+            uintptr_t addr = reinterpret_cast<uintptr_t>(begin);
+            while (ord < MAX_ORDER && (addr & ((uintptr_t(2) << ord) - 1)) == 0 &&
+                   begin + (uint64_t(2) << ord) <= end) {
+                ord++;
+            }
+            release_block(begin, ord);
+            begin += uint64_t(1) << ord;
+        }
+    }
+
+    /**
+     * @brief Get a block of size \f$2^{ord}\f$ bytes from the compaction
+     * chunk.
+     *
+     * Blocks are handed out in increasing address order, skipping over free
+     * blocks released during compaction. Alignment gaps are returned to the
+     * free lists, and a new chunk is started when the block does not fit.
+     */
+    uint8_t* take_bump(uint16_t ord) {
+        uint64_t bytes = uint64_t(1) << ord;
+        uint8_t* block = reinterpret_cast<uint8_t*>(
+            (reinterpret_cast<uintptr_t>(bump_) + bytes - 1) & ~(bytes - 1));
+        if (bump_ == nullptr || block + bytes > bump_end_) [[unlikely]] {
+            retire_bump();
+            uint8_t* chunk = new_chunk();
+            bump_ = chunk + (uint64_t(1) << META_ORDER);
+            bump_end_ = chunk + CHUNK_BYTES;
+            block = reinterpret_cast<uint8_t*>(
+                (reinterpret_cast<uintptr_t>(bump_) + bytes - 1) &
+                ~(bytes - 1));
+        }
+        release_range(bump_, block);
+        bump_ = block + bytes;
+        return block;
+    }
+
+    /**
+     * @brief Return the unused end of the compaction chunk to the free lists.
+     */
+    void retire_bump() {
+        if (bump_ == nullptr) {
+            return;
+        }
+        uint8_t* chunk = bump_end_ - CHUNK_BYTES;
+        release_range(bump_, bump_end_);
+        bump_ = nullptr;
+        bump_end_ = nullptr;
+        if (chunk_leaves(chunk) == 0) {
+            release_chunk(chunk);
+        }
+    }
+
+    /** @brief Get a block of size \f$2^{ord}\f$ bytes. */
+    uint8_t* take_block(uint16_t ord) {
+        if (compacting_) {
+            [[unlikely]] return take_bump(ord);
+        }
+        uint16_t avail = ord;
+        while (avail <= MAX_ORDER && free_[avail] == nullptr) {
+            avail++;
+        }
+        if (avail > MAX_ORDER) [[unlikely]] {
+            add_chunk();
+            avail = ord > META_ORDER ? ord : META_ORDER;
+        }
+        uint8_t* block = reinterpret_cast<uint8_t*>(free_[avail]);
+        remove_free(block, avail);
+        while (avail > ord) {
+            avail--;
+            push_free(block + (uint64_t(1) << avail), avail);
+        }
+        return block;
+    }
+
+    /** @brief Return a block to the free lists, merging with free buddies. */
+    void release_block(uint8_t* block, uint16_t ord) {
+        while (ord < MAX_ORDER) {
+            uint8_t* b = buddy(block, ord);
+            if (free_order(b) != ord + 1) break;
+            remove_free(b, ord);
+            block = b < block ? b : block;
+            ord++;
+        }
+        push_free(block, ord);
+    }
+
+    /**
+     * @brief Try to grow a block from order `ord` to `n_ord` without moving.
+     *
+     * Succeeds if the block is the lower buddy at every order from `ord` to
+     * `n_ord - 1` and all the corresponding upper buddies are free.
+     */
+    bool grow_block(uint8_t* block, uint16_t ord, uint16_t n_ord) {
+        for (uint16_t o = ord; o < n_ord; o++) {
+            uint8_t* b = block + (uint64_t(1) << o);
+            if (buddy(block, o) != b || free_order(b) != o + 1) {
+                return false;
+            }
+        }
+        for (uint16_t o = ord; o < n_ord; o++) {
+            remove_free(block + (uint64_t(1) << o), o);
+        }
+        return true;
+    }
+
+   public:
+    basic_arena_alloc()
+        : memory_(),
+          nodes_(&memory_),
+          chunks_(),
+          free_(),
+          leaves_(0),
+          stats_(),
+          peak_(0),
+          bump_(nullptr),
+          bump_end_(nullptr),
+          compacting_(false) {}
+
+    ~basic_arena_alloc() {
+        for (void* chunk : chunks_) {
+            memory_.deallocate(chunk, CHUNK_BYTES);
+        }
+    }
+
+    /**
+     * @brief Allocate new internal node.
+     *
+     * See bv::basic_pool_alloc::allocate_node.
+     */
+    template <class node_type>
+    node_type* allocate_node() {
+        node_type* node = nodes_.template allocate_node<node_type>();
+        update_peak();
+        return node;
+    }
+
+    /**
+     * @brief Deallocate internal node.
+     *
+     * See bv::basic_pool_alloc::deallocate_node.
+     */
+    template <class node_type>
+    void deallocate_node(node_type* node) {
+        nodes_.deallocate_node(node);
+    }
+
+    /**
+     * @brief Allocates a new leaf with space for storing `size * 64` bits.
+     *
+     * The leaf and its data are placed in the smallest block that fits
+     * `sizeof(leaf_type) + 8 * size` bytes.
+     *
+     * @tparam leaf_type Bit vector leaf type. Typically some kind of bv::leaf.
+     *
+     * @param size Number of 64-bit words to reserve for data storage.
+     */
+    template <class leaf_type>
+    leaf_type* allocate_leaf(uint64_t size, uint32_t elems = 0, bool val = false) {
+        leaves_++;
+        uint64_t bytes = leaf_bytes<leaf_type>() + size * sizeof(uint64_t);
+        uint16_t ord = order<leaf_type>(size);
+        void* leaf;
+        if (ord > MAX_ORDER) {
+            [[unlikely]] leaf = malloc(bytes);
+            if (leaf == NULL) [[unlikely]] raise(SIGSEGV);
+            stats_.reserve(bytes);
+        } else {
+            leaf = take_block(ord);
+            chunk_leaves(reinterpret_cast<uint8_t*>(leaf))++;
+        }
+        stats_.requested_bytes += bytes;
+        stats_.add_leaf(size);
+        update_peak();
+        uint8_t* data_ptr = reinterpret_cast<uint8_t*>(leaf) + leaf_bytes<leaf_type>();
+        memset(data_ptr, 0, size * sizeof(uint64_t));
+        return new (leaf)
+            leaf_type(size, reinterpret_cast<uint64_t*>(data_ptr), elems, val);
+    }
+
+    template <class leaf_type>
+    leaf_type* allocate_leaf() {
+        return allocate_leaf<leaf_type>(leaf_type::init_capacity());
+    }
+
+    /**
+     * @brief Deallocates leaf node.
+     *
+     * The size class of the block is determined from `leaf->capacity()`.
+     *
+     * @tparam leaf_type Bit vector leaf type. Typically some kind of bv::leaf.
+     */
+    template <class leaf_type>
+    void deallocate_leaf(leaf_type* leaf) {
+        leaves_--;
+        uint64_t cap = leaf->capacity();
+        uint64_t bytes = leaf_bytes<leaf_type>() + cap * sizeof(uint64_t);
+        uint16_t ord = order<leaf_type>(cap);
+        stats_.requested_bytes -= bytes;
+        stats_.remove_leaf(cap);
+        if (ord > MAX_ORDER) {
+            stats_.release(bytes);
+            [[unlikely]] free(leaf);
+        } else {
+            release_block(reinterpret_cast<uint8_t*>(leaf), ord);
+            drop_leaf(reinterpret_cast<uint8_t*>(leaf));
+        }
+    }
+
+    /**
+     * @brief Reallocator for leaf nodes.
+     *
+     * Resizes in place if the new size has the same size class, when
+     * shrinking, or when growing and the following buddy blocks are free.
+     * Otherwise the leaf is copied to a new block.
+     *
+     * @tparam leaf_type Bit vector leaf type. Typically some kind of bv::leaf.
+     *
+     * @param leaf     Pointer to leaf_type to reallocate.
+     * @param old_size Size of leaf data block. (in 64 bit words.)
+     * @param new_size New size for leaf data block. (in 64 bit words.)
+     */
+    template <class leaf_type>
+    leaf_type* reallocate_leaf(leaf_type* leaf, uint64_t old_size,
+                               uint64_t new_size) {
+        uint16_t ord = order<leaf_type>(old_size);
+        uint16_t n_ord = order<leaf_type>(new_size);
+        uint64_t bytes = leaf_bytes<leaf_type>() + old_size * sizeof(uint64_t);
+        uint64_t n_bytes = leaf_bytes<leaf_type>() + new_size * sizeof(uint64_t);
+        uint64_t kept = bytes < n_bytes ? bytes : n_bytes;
+        uint8_t* block = reinterpret_cast<uint8_t*>(leaf);
+        stats_.reallocations++;
+        stats_.requested_bytes += n_bytes;
+        stats_.requested_bytes -= bytes;
+        stats_.remove_leaf(old_size);
+        stats_.add_leaf(new_size);
+        if (ord > MAX_ORDER && n_ord > MAX_ORDER) {
+            uintptr_t old_addr = reinterpret_cast<uintptr_t>(block);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wclass-memaccess"
+            [[unlikely]] block =
+                reinterpret_cast<uint8_t*>(realloc(leaf, n_bytes));
+#pragma GCC diagnostic pop
+            if (block == NULL) [[unlikely]] raise(SIGSEGV);
+            stats_.release(bytes);
+            stats_.reserve(n_bytes);
+            if (reinterpret_cast<uintptr_t>(block) != old_addr) {
+                stats_.copied_bytes += kept;
+            }
+        } else if (n_ord < ord && ord <= MAX_ORDER) {
+            while (ord > n_ord) {
+                ord--;
+                release_block(block + (uint64_t(1) << ord), ord);
+            }
+        } else if (n_ord > ord &&
+                   (n_ord > MAX_ORDER || !grow_block(block, ord, n_ord))) {
+            uint8_t* n_block;
+            if (n_ord > MAX_ORDER) {
+                n_block = reinterpret_cast<uint8_t*>(malloc(n_bytes));
+                if (n_block == NULL) [[unlikely]] raise(SIGSEGV);
+                stats_.reserve(n_bytes);
+            } else {
+                n_block = take_block(n_ord);
+                chunk_leaves(n_block)++;
+            }
+            memcpy(n_block, block, kept);
+            stats_.copied_bytes += kept;
+            if (ord > MAX_ORDER) {
+                free(block);
+                stats_.release(bytes);
+            } else {
+                release_block(block, ord);
+                drop_leaf(block);
+            }
+            block = n_block;
+        } else if (n_ord < ord) {
+            // Large leaf shrinking into a chunk.
+            uint8_t* n_block = take_block(n_ord);
+            chunk_leaves(n_block)++;
+            memcpy(n_block, block, kept);
+            stats_.copied_bytes += kept;
+            free(block);
+            stats_.release(bytes);
+            block = n_block;
+        }
+        update_peak();
+        leaf_type* n_leaf = reinterpret_cast<leaf_type*>(block);
+        uint8_t* data_ptr = block + leaf_bytes<leaf_type>();
+        if (old_size < new_size) {
+            memset(data_ptr + sizeof(uint64_t) * old_size, 0,
+                   sizeof(uint64_t) * (new_size - old_size));
+        }
+        n_leaf->set_data_ptr(reinterpret_cast<uint64_t*>(data_ptr));
+        n_leaf->capacity(new_size);
+        return n_leaf;
+    }
+
+    /**
+     * @brief Get the number of blocks currenty allocated by this allocator
+     * instance.
+     *
+     * @return Number of nodes and leaves currently allocated.
+     */
+    uint64_t live_allocations() const {
+        return leaves_ + nodes_.live_allocations();
+    }
+
+    /**
+     * @brief Start allocating leaves for `bit_vector::compact`.
+     *
+     * Until `end_compaction`, chunk blocks are bump allocated in increasing
+     * address order from a compaction chunk that held no other leaves when
+     * it was started, so leaves allocated in logical order are contiguous.
+     * Blocks freed in the meantime, such as those of the leaves being
+     * replaced, are not reused, and chunks left without leaves are returned
+     * to the memory source.
+     */
+    void begin_compaction() { compacting_ = true; }
+
+    /**
+     * @brief Stop allocating leaves for `bit_vector::compact`.
+     *
+     * The compaction chunk is kept for the next call, unless `finished`. In
+     * that case its unused end is returned to the free lists and all chunks
+     * without leaves are returned to the memory source.
+     *
+     * @param finished True if a compaction pass was completed.
+     */
+    void end_compaction(bool finished) {
+        if (finished) {
+            retire_bump();
+            for (uint64_t i = chunks_.size(); i > 0; i--) {
+                uint8_t* chunk = reinterpret_cast<uint8_t*>(chunks_[i - 1]);
+                if (chunk_leaves(chunk) == 0) {
+                    release_chunk(chunk);
+                }
+            }
+        }
+        compacting_ = false;
+    }
+
+    /** @brief Number of bytes reserved for leaf chunks. */
+    uint64_t chunk_bytes() const { return chunks_.size() * CHUNK_BYTES; }
+
+    /** @brief Memory source used for leaf chunks and node slabs. */
+    const memory& chunk_memory() const { return memory_; }
+
+    /**
+     * @brief Memory usage statistics of this allocator instance.
+     *
+     * Reserved bytes include entire chunks and node slabs. Leaves too large
+     * for chunks count their requested size as reserved.
+     */
+    alloc_stats stats() const {
+        alloc_stats ret = nodes_.stats();
+        ret += stats_;
+        ret.peak_reserved_bytes = peak_;
+        return ret;
+    }
 };
+
+/** @brief Leaf arena allocator using `aligned_alloc` for chunks. */
+typedef basic_arena_alloc<heap_memory> arena_alloc;
+
+/**
+ * @brief Leaf arena allocator with chunks and node slabs on huge pages.
+ *
+ * Reduces TLB misses for random access to large bit vectors.
+ */
+typedef basic_arena_alloc<huge_page_memory> huge_page_alloc;
 }  // namespace bv
 #endif
\ No newline at end of file
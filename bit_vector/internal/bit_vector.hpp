@@ -1,10 +1,21 @@
 #ifndef BV_BIT_VECTOR_HPP
 #define BV_BIT_VECTOR_HPP
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <thread>
 #include <utility>
+#include <vector>
 
+#include "mapped_bit_vector.hpp"
+#include "query_support.hpp"
 #include "uncopyable.hpp"
 
 namespace bv {
@@ -23,6 +34,10 @@ namespace bv {
  *
  * Practical performance depends on node and leaf implementations.
  *
+ * Scratch space used by leaves and buffers is thread local, so distinct
+ * instances can be modified concurrently from different threads. A single
+ * instance is not thread safe.
+ *
  * @tparam leaf               Type for leaves. Some kind of bv::leaf.
  * @tparam node               Type for internal nodes. Some kind of bv::node.
  * @tparam allocator          Allocator type. For example bv::malloc_alloc.
@@ -49,9 +64,111 @@ class bit_vector : uncopyable {
     allocator* allocator_;  ///< Pointer to allocator used for allocating
                             ///< internal nodes and leaves.
 
+    /**
+     * @brief State shared between a bit vector and its snapshots.
+     *
+     * Nodes and leaves referenced by more than one parent (or root pointer)
+     * count the extra references themselves. Objects with no extra
+     * references can be modified in place.
+     */
+    struct shared_state {
+        std::atomic<uint64_t> users;  ///< Bit vectors using this state.
+        bool owns_allocator;          ///< Whether to delete the allocator
+                                      ///< along with the state.
+    };
+
+    shared_state* shared_ = nullptr;  ///< Snapshot bookkeeping if
+                                      ///< `snapshot` has been called.
+    dtype compact_pos_ = 0;  ///< Position where `compact` will continue.
+
     /** @brief Number of bits in a computer word. */
     static const constexpr uint64_t WORD_BITS = 64;
 
+    /**
+     * @brief Bounded buffer for `dump_chunks`.
+     *
+     * Leaves are decoded at most `leaf_size` bits at a time and merged to the
+     * end of the buffer. Complete chunks are emitted and the remaining bits
+     * moved to the start of the buffer.
+     *
+     * @tparam callback Callable as `emit(const uint64_t* words, uint64_t n)`.
+     */
+    template <class callback>
+    class chunk_writer : uncopyable {
+       private:
+        callback& emit_;                 ///< Receiver of chunks.
+        uint64_t chunk_words_;           ///< Number of words per chunk.
+        std::vector<uint64_t> data_;     ///< Chunk buffer.
+        std::vector<uint64_t> scratch_;  ///< Space for decoding leaves.
+        uint64_t offset_;                ///< Number of bits in the buffer.
+
+       public:
+        chunk_writer(callback& emit, uint64_t chunk_words)
+            : emit_(emit),
+              chunk_words_(chunk_words),
+              data_(chunk_words + leaf_size / WORD_BITS + 1, 0),
+              scratch_(leaf_size / WORD_BITS),
+              offset_(0) {}
+
+        /**
+         * @brief Decode `l` to the buffer, emitting complete chunks.
+         */
+        void append(const leaf* l) {
+            for (uint32_t begin = 0; begin < l->size(); begin += leaf_size) {
+                uint32_t len = l->size() - begin < leaf_size
+                                   ? l->size() - begin
+                                   : leaf_size;
+                l->decode(scratch_.data(), begin, len);
+                uint64_t word = offset_ / WORD_BITS;
+                uint16_t shift = offset_ % WORD_BITS;
+                for (uint32_t i = 0; i * WORD_BITS < len; i++) {
+                    data_[word + i] |= scratch_[i] << shift;
+                    if (shift) {
+                        data_[word + i + 1] |=
+                            scratch_[i] >> (WORD_BITS - shift);
+                    }
+                }
+                offset_ += len;
+                emit_full();
+            }
+        }
+
+        /**
+         * @brief Emit the remaining bits as a final partial chunk.
+         */
+        void finish() {
+            if (offset_ > 0) {
+                emit_(static_cast<const uint64_t*>(data_.data()),
+                      (offset_ + WORD_BITS - 1) / WORD_BITS);
+            }
+            offset_ = 0;
+        }
+
+       private:
+        /**
+         * @brief Emit complete chunks and move the remainder to the start.
+         */
+        void emit_full() {
+            uint64_t chunk_bits = chunk_words_ * WORD_BITS;
+            while (offset_ >= chunk_bits) {
+                emit_(static_cast<const uint64_t*>(data_.data()),
+                      chunk_words_);
+                offset_ -= chunk_bits;
+                uint64_t rest = (offset_ + WORD_BITS - 1) / WORD_BITS;
+                uint64_t i = 0;
+                for (; i < rest; i++) {
+                    data_[i] = data_[chunk_words_ + i];
+                }
+                std::fill(data_.begin() + i, data_.end(), 0);
+            }
+        }
+    };
+
+   public:
+    /** @brief Read-only view type for data written with `write_mapped`. */
+    typedef mapped_bit_vector<leaf, node, dtype> mapped_type;
+
+   private:
     /**
      * @brief Increases the height of the tree by one level.
      *
@@ -113,7 +230,616 @@ class bit_vector : uncopyable {
         root_is_leaf_ = false;
     }
 
+    /**
+     * @brief Deallocates all nodes and leaves of the tree.
+     *
+     * Leaves `n_root_` and `l_root_` dangling. A new root needs to be set
+     * before the bit vector is used again.
+     */
+    void deallocate_tree() {
+        if (shared_ != nullptr) {
+            if (root_is_leaf_) {
+                release(l_root_);
+            } else {
+                release(n_root_);
+            }
+            [[unlikely]] return;
+        }
+        if (root_is_leaf_) {
+            allocator_->deallocate_leaf(l_root_);
+        } else {
+            n_root_->deallocate(allocator_);
+            allocator_->deallocate_node(n_root_);
+        }
+    }
+
+    /** @brief Number of 32-bit words in the serialization header. */
+    static const constexpr uint16_t SERIAL_HEADER_WORDS = 7;
+
+    /**
+     * @brief Write the serialization header for this bit vector type.
+     *
+     * The header consists of a magic number followed by type parameters that
+     * affect the binary layout of nodes and leaves.
+     *
+     * @param header Array of `SERIAL_HEADER_WORDS` words.
+     */
+    static void serial_header(uint32_t* header) {
+        header[0] = 0x43455642;  // "BVEC"
+        header[1] = sizeof(dtype);
+        header[2] = leaf_size;
+        header[3] = branches;
+        header[4] = compressed;
+        header[5] = sizeof(leaf);
+        header[6] = sizeof(node);
+    }
+
+    /**
+     * @brief Number of 64-bit words to allocate for a leaf with `elems`
+     * elements.
+     *
+     * Matches the capacity selection used when merging and rebalancing leaves.
+     *
+     * @param elems Number of elements to be stored in the leaf.
+     */
+    static dtype leaf_capacity(dtype elems) {
+        dtype cap = 2 + elems / WORD_BITS;
+        cap += cap % 2;
+        return cap * WORD_BITS <= leaf_size ? cap : leaf_size / WORD_BITS;
+    }
+
+    /**
+     * @brief Shrink a compressed leaf to its desired capacity.
+     *
+     * @param l   Leaf filled from packed data.
+     * @param cap Current capacity of `l`.
+     */
+    leaf* shrink_leaf(leaf* l, dtype cap) {
+        if constexpr (compressed) {
+            if (l->is_compressed()) {
+                dtype n_cap = l->desired_capacity();
+                if (n_cap < cap) {
+                    l = allocator_->reallocate_leaf(l, cap, n_cap);
+                }
+            }
+        }
+        return l;
+    }
+
+    /**
+     * @brief Allocate and fill a single leaf from packed data.
+     *
+     * @param words  Source data.
+     * @param offset Index of the first bit to copy.
+     * @param elems  Number of bits to copy.
+     */
+    leaf* build_leaf(const uint64_t* words, uint64_t offset, dtype elems) {
+        dtype cap = leaf_capacity(elems);
+        leaf* l = allocator_->template allocate_leaf<leaf>(cap);
+        l->assign(words, offset, elems);
+        return shrink_leaf(l, cap);
+    }
+
+    /**
+     * @brief Build the tree bottom-up from packed data.
+     *
+     * Assumes that there is no existing tree. Leaves are filled to
+     * approximately `fill * leaf_size` elements and internal nodes to
+     * approximately `fill * branches` children. Elements are distributed
+     * evenly so that no leaf or node ends up below the thresholds used when
+     * rebalancing.
+     *
+     * With `threads > 1`, leaves are allocated on the calling thread, since
+     * the allocator is not thread safe. The leaves are then filled, which
+     * includes selecting the encoding of hybrid leaves, by `threads` threads
+     * each handling a contiguous range of leaves. Compressed leaves are
+     * shrunk and internal nodes built on the calling thread.
+     *
+     * @param words   Source data.
+     * @param n_bits  Number of bits to read from `words`.
+     * @param fill    Target fill rate in the [0.5, 1] range.
+     * @param threads Number of threads to use for filling leaves.
+     */
+    void build(const uint64_t* words, dtype n_bits, double fill,
+               uint16_t threads) {
+        fill = fill < 0.5 ? 0.5 : (fill > 1 ? 1 : fill);
+        if (n_bits <= leaf_size) {
+            l_root_ = build_leaf(words, 0, n_bits);
+            root_is_leaf_ = true;
+            return;
+        }
+        dtype target = fill * leaf_size;
+        dtype count = n_bits / target + (n_bits % target ? 1 : 0);
+        dtype elems = n_bits / count;
+        dtype extra = n_bits % count;
+        std::vector<void*> level(count);
+        if (threads <= 1) {
+            uint64_t offset = 0;
+            for (dtype i = 0; i < count; i++) {
+                dtype l_elems = elems + (i < extra ? 1 : 0);
+                level[i] = build_leaf(words, offset, l_elems);
+                offset += l_elems;
+            }
+        } else {
+            for (dtype i = 0; i < count; i++) {
+                dtype l_elems = elems + (i < extra ? 1 : 0);
+                level[i] = allocator_->template allocate_leaf<leaf>(
+                    leaf_capacity(l_elems));
+            }
+            auto fill_range = [&](dtype begin, dtype end) {
+                // Leaves before `extra` have one more element.
+                uint64_t offset = uint64_t(begin) * elems +
+                                  (begin < extra ? begin : extra);
+                for (dtype i = begin; i < end; i++) {
+                    dtype l_elems = elems + (i < extra ? 1 : 0);
+                    reinterpret_cast<leaf*>(level[i])->assign(words, offset,
+                                                              l_elems);
+                    offset += l_elems;
+                }
+            };
+            if (threads > count) threads = count;
+            std::vector<std::thread> workers;
+            workers.reserve(threads - 1);
+            dtype per_thread = count / threads;
+            dtype t_extra = count % threads;
+            dtype begin = 0;
+            for (uint16_t t = 0; t < threads; t++) {
+                dtype end = begin + per_thread + (t < t_extra ? 1 : 0);
+                if (t + 1 < threads) {
+                    workers.emplace_back(fill_range, begin, end);
+                } else {
+                    fill_range(begin, end);
+                }
+                begin = end;
+            }
+            for (auto& w : workers) {
+                w.join();
+            }
+            if constexpr (compressed) {
+                for (dtype i = 0; i < count; i++) {
+                    leaf* l = reinterpret_cast<leaf*>(level[i]);
+                    level[i] = shrink_leaf(l, l->capacity());
+                }
+            }
+        }
+        target = fill * branches;
+        bool leaves = true;
+        while (level.size() > 1) {
+            count = level.size() <= branches
+                        ? 1
+                        : level.size() / target +
+                              (level.size() % target ? 1 : 0);
+            dtype children = level.size() / count;
+            extra = level.size() % count;
+            std::vector<void*> parents(count);
+            dtype c_idx = 0;
+            for (dtype i = 0; i < count; i++) {
+                node* n = allocator_->template allocate_node<node>();
+                n->has_leaves(leaves);
+                dtype lim = c_idx + children + (i < extra ? 1 : 0);
+                for (; c_idx < lim; c_idx++) {
+                    if (leaves) {
+                        n->append_child(reinterpret_cast<leaf*>(level[c_idx]));
+                    } else {
+                        n->append_child(reinterpret_cast<node*>(level[c_idx]));
+                    }
+                }
+                parents[i] = n;
+            }
+            level.swap(parents);
+            leaves = false;
+        }
+        n_root_ = reinterpret_cast<node*>(level[0]);
+        root_is_leaf_ = false;
+    }
+
+    /**
+     * @brief Replace a root node that has a single child with the child.
+     */
+    void collapse_root() {
+        if (n_root_->has_leaves()) {
+            l_root_ = reinterpret_cast<leaf*>(n_root_->child(0));
+            root_is_leaf_ = true;
+            allocator_->deallocate_node(n_root_);
+        } else {
+            node* new_root = reinterpret_cast<node*>(n_root_->child(0));
+            allocator_->deallocate_node(n_root_);
+            n_root_ = new_root;
+        }
+    }
+
+    /**
+     * @brief Create a snapshot sharing the tree of `source`.
+     *
+     * Requires `source->shared_` to be set up by `snapshot`.
+     */
+    explicit bit_vector(const bit_vector* source)
+        : root_is_leaf_(source->root_is_leaf_),
+          owned_allocator_(false),
+          n_root_(source->n_root_),
+          l_root_(source->l_root_),
+          allocator_(source->allocator_),
+          shared_(source->shared_) {}
+
+    /**
+     * @brief Drop a reference to a leaf, deallocating it if unreferenced.
+     */
+    void release(leaf* l) {
+        if (l->drop_ref()) {
+            allocator_->deallocate_leaf(l);
+        }
+    }
+
+    /**
+     * @brief Drop a reference to a subtree, deallocating unreferenced parts.
+     */
+    void release(node* n) {
+        if (!n->drop_ref()) {
+            return;
+        }
+        for (uint16_t i = 0; i < n->child_count(); i++) {
+            if (n->has_leaves()) {
+                release(reinterpret_cast<leaf*>(n->child(i)));
+            } else {
+                release(reinterpret_cast<node*>(n->child(i)));
+            }
+        }
+        allocator_->deallocate_node(n);
+    }
+
+    /**
+     * @brief Check whether the tree may be shared with snapshots.
+     */
+    bool is_shared() const {
+        return shared_ != nullptr && shared_->users.load() > 1;
+    }
+
+    /**
+     * @brief Unshare the root and the path to the `depth` level object
+     * containing `pos`.
+     *
+     * Requires that the root is a node.
+     *
+     * @param pos   Position in \f$[0, \mathrm{size})\f$.
+     * @param depth Number of levels below the root to unshare.
+     */
+    void unshare_path(dtype pos, uint16_t depth) {
+        n_root_ = node::unshare(n_root_, allocator_);
+        node* nd = n_root_;
+        dtype start = 0;
+        for (uint16_t d = 0; d < depth; d++) {
+            uint16_t idx = nd->child_sizes()->find(pos - start + 1);
+            if (idx != 0) {
+                start += nd->child_sizes()->get(idx - 1);
+            }
+            void** children = nd->children();
+            if (nd->has_leaves()) {
+                children[idx] = node::unshare(
+                    reinterpret_cast<leaf*>(children[idx]), allocator_);
+                return;
+            }
+            nd = node::unshare(reinterpret_cast<node*>(children[idx]),
+                               allocator_);
+            children[idx] = nd;
+        }
+    }
+
+    /**
+     * @brief Make the root unique before an update.
+     *
+     * Nodes copy shared children right before modifying them, so an update
+     * copies only the path it descends and the siblings it rebalances with.
+     */
+    void unshare_root() {
+        if (root_is_leaf_) {
+            l_root_ = node::unshare(l_root_, allocator_);
+        } else {
+            n_root_ = node::unshare(n_root_, allocator_);
+        }
+    }
+
+    /**
+     * @brief Make the subtree of `n` unique.
+     */
+    void unshare_subtree(node* n) {
+        void** children = n->children();
+        for (uint16_t i = 0; i < n->child_count(); i++) {
+            if (n->has_leaves()) {
+                children[i] = node::unshare(
+                    reinterpret_cast<leaf*>(children[i]), allocator_);
+            } else {
+                children[i] = node::unshare(
+                    reinterpret_cast<node*>(children[i]), allocator_);
+                unshare_subtree(reinterpret_cast<node*>(children[i]));
+            }
+        }
+    }
+
+    /**
+     * @brief Deallocate a leaf removed from the tree, respecting snapshots.
+     */
+    void discard(leaf* l) {
+        if (shared_ != nullptr) {
+            release(l);
+        } else {
+            allocator_->deallocate_leaf(l);
+        }
+    }
+
+    /**
+     * @brief Deallocate a subtree removed from the tree, respecting
+     * snapshots.
+     */
+    void discard(node* n) {
+        if (shared_ != nullptr) {
+            release(n);
+        } else {
+            n->deallocate(allocator_);
+            allocator_->deallocate_node(n);
+        }
+    }
+
+    /**
+     * @brief Append the logical content of `l` at bit `offset` of `data`.
+     *
+     * `data` needs to be zeroed from `offset` on. Does not modify `l`.
+     *
+     * @param tmp Scratch space for at least `leaf_size / 64 + 1` words.
+     */
+    static void append_bits(const leaf* l, uint64_t* data, uint64_t offset,
+                            uint64_t* tmp) {
+        uint32_t len = l->decode(tmp);
+        uint64_t word = offset / WORD_BITS;
+        uint16_t shift = offset % WORD_BITS;
+        for (uint32_t i = 0; i * WORD_BITS < len; i++) {
+            data[word + i] |= tmp[i] << shift;
+            if (shift) {
+                data[word + i + 1] |= tmp[i] >> (WORD_BITS - shift);
+            }
+        }
+    }
+
+    /**
+     * @brief Relocate and repack the leaves of bottom level node `nd`.
+     *
+     * New leaves are allocated left to right before the old ones are
+     * released. For uncompressed leaves the content is redistributed evenly
+     * over as few leaves as the target size `target` allows, but never fewer
+     * than `branches / 3 + 1` (or the current count if smaller), so node
+     * invariants are kept. Compressed leaves are relocated as is.
+     *
+     * Requires that `nd` is not shared.
+     */
+    void compact_leaves(node* nd, dtype target) {
+        uint16_t count = nd->child_count();
+        std::vector<leaf*> old(count);
+        for (uint16_t i = 0; i < count; i++) {
+            old[i] = reinterpret_cast<leaf*>(nd->child(i));
+        }
+        nd->clear_last(count);
+        if constexpr (compressed) {
+            for (uint16_t i = 0; i < count; i++) {
+                nd->append_child(old[i]->clone(allocator_));
+            }
+        } else {
+            dtype total = 0;
+            for (uint16_t i = 0; i < count; i++) {
+                total += old[i]->size();
+            }
+            uint16_t min_count = count < branches / 3 + 1 ? count
+                                                          : branches / 3 + 1;
+            dtype n_count = total / target + (total % target ? 1 : 0);
+            n_count = n_count < min_count ? min_count : n_count;
+            n_count = n_count > count ? count : n_count;
+            std::vector<uint64_t> data(total / WORD_BITS + 2, 0);
+            std::vector<uint64_t> tmp(leaf_size / WORD_BITS + 1);
+            uint64_t offset = 0;
+            for (uint16_t i = 0; i < count; i++) {
+                append_bits(old[i], data.data(), offset, tmp.data());
+                offset += old[i]->size();
+            }
+            dtype elems = total / n_count;
+            dtype extra = total % n_count;
+            offset = 0;
+            for (dtype i = 0; i < n_count; i++) {
+                dtype l_elems = elems + (i < extra ? 1 : 0);
+                nd->append_child(build_leaf(data.data(), offset, l_elems));
+                offset += l_elems;
+            }
+        }
+        for (uint16_t i = 0; i < count; i++) {
+            discard(old[i]);
+        }
+    }
+
+    /**
+     * @brief Make the entire tree unique, for operations on many leaves.
+     */
+    void unshare_all() {
+        if (!is_shared()) {
+            [[likely]] return;
+        }
+        unshare_root();
+        if (!root_is_leaf_) {
+            unshare_subtree(n_root_);
+        }
+    }
+
    public:
+    /**
+     * @brief Read-only forward iterator over the bits of a bit_vector.
+     *
+     * Holds the path from the root to the current leaf, and decodes the
+     * current leaf (merging buffered operations and run-length encoded data)
+     * into a local word array once when the leaf is entered. Stepping to the
+     * next bit or reading the next word is then amortized constant time.
+     * While a leaf is being consumed, the next leaf is prefetched.
+     *
+     * The iterator is invalidated by any modification of the bit vector.
+     */
+    class const_iterator {
+       public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef bool value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef void pointer;
+        typedef bool reference;
+
+       private:
+        const bit_vector* bv_;  ///< Bit vector being iterated.
+        dtype index_;           ///< Current logical position.
+        dtype size_;            ///< Size of the bit vector.
+        dtype leaf_start_;      ///< Logical position of the current leaf.
+        dtype leaf_size_;       ///< Number of bits in the current leaf.
+        /** @brief Nodes and child indexes from the root to the current leaf. */
+        std::vector<std::pair<const node*, uint16_t>> path_;
+        std::vector<uint64_t> words_;  ///< Decoded current leaf.
+
+        /**
+         * @brief Decode `l` into `words_` and prefetch the following leaf.
+         */
+        void enter(const leaf* l) {
+            leaf_size_ = l->size();
+            words_.resize(leaf_size_ / WORD_BITS + 1);
+            l->decode(words_.data());
+            if (path_.size() > 0) {
+                const node* nd = path_.back().first;
+                uint16_t idx = path_.back().second + 1;
+                if (idx < nd->child_count()) {
+                    __builtin_prefetch(nd->child(idx));
+                }
+            }
+        }
+
+        /**
+         * @brief Descend to the leaf containing `index_`.
+         */
+        void seek() {
+            path_.clear();
+            leaf_start_ = 0;
+            leaf_size_ = 0;
+            if (index_ >= size_) {
+                [[unlikely]] return;
+            }
+            if (bv_->root_is_leaf_) {
+                [[unlikely]] return enter(bv_->l_root_);
+            }
+            const node* nd = bv_->n_root_;
+            while (true) {
+                uint16_t idx =
+                    nd->child_sizes()->find(index_ - leaf_start_ + 1);
+                if (idx != 0) {
+                    leaf_start_ += nd->child_sizes()->get(idx - 1);
+                }
+                path_.push_back({nd, idx});
+                if (nd->has_leaves()) {
+                    return enter(reinterpret_cast<const leaf*>(nd->child(idx)));
+                }
+                nd = reinterpret_cast<const node*>(nd->child(idx));
+            }
+        }
+
+        /**
+         * @brief Move to the leaf following the current one.
+         */
+        void next_leaf() {
+            leaf_start_ += leaf_size_;
+            leaf_size_ = 0;
+            while (path_.size() > 0 &&
+                   path_.back().second + 1 >= path_.back().first->child_count()) {
+                path_.pop_back();
+            }
+            if (path_.size() == 0) {
+                [[unlikely]] return;
+            }
+            path_.back().second++;
+            const node* nd = path_.back().first;
+            while (!nd->has_leaves()) {
+                nd = reinterpret_cast<const node*>(
+                    nd->child(path_.back().second));
+                path_.push_back({nd, 0});
+            }
+            enter(reinterpret_cast<const leaf*>(nd->child(path_.back().second)));
+        }
+
+       public:
+        /**
+         * @brief Create an iterator pointing to the index<sup>th</sup> bit.
+         *
+         * @param bv    Bit vector to iterate.
+         * @param index Starting position. `bv->size()` for an end iterator.
+         */
+        const_iterator(const bit_vector* bv, dtype index)
+            : bv_(bv), index_(index), size_(bv->size()), path_(), words_() {
+            seek();
+        }
+
+        /**
+         * @brief Logical position of the iterator.
+         */
+        dtype index() const { return index_; }
+
+        bool operator*() const {
+            dtype i = index_ - leaf_start_;
+            return (words_[i / WORD_BITS] >> (i % WORD_BITS)) & 1;
+        }
+
+        const_iterator& operator++() {
+            if (++index_ - leaf_start_ >= leaf_size_ && index_ < size_) {
+                [[unlikely]] next_leaf();
+            }
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator ret = *this;
+            ++(*this);
+            return ret;
+        }
+
+        /**
+         * @brief Read the next `bits` bits and advance past them.
+         *
+         * The bit at the current position is the least significant bit of the
+         * result. Reading past the end of the bit vector is undefined
+         * behaviour.
+         *
+         * @param bits Number of bits to read. In \f$[1, 64]\f$.
+         *
+         * @return Next `bits` bits packed into a word.
+         */
+        uint64_t read(uint16_t bits = WORD_BITS) {
+            assert(bits > 0 && bits <= WORD_BITS);
+            assert(index_ + bits <= size_);
+            uint64_t ret = 0;
+            uint16_t done = 0;
+            while (done < bits) {
+                dtype i = index_ - leaf_start_;
+                uint16_t offset = i % WORD_BITS;
+                uint64_t w = words_[i / WORD_BITS] >> offset;
+                uint16_t len = WORD_BITS - offset;
+                len = len < bits - done ? len : bits - done;
+                len = len < leaf_size_ - i ? len : leaf_size_ - i;
+                w &= len < WORD_BITS ? (uint64_t(1) << len) - 1 : ~uint64_t(0);
+                ret |= w << done;
+                done += len;
+                index_ += len;
+                if (index_ - leaf_start_ >= leaf_size_ && index_ < size_) {
+                    [[unlikely]] next_leaf();
+                }
+            }
+            return ret;
+        }
+
+        bool operator==(const const_iterator& rhs) const {
+            return index_ == rhs.index_ && bv_ == rhs.bv_;
+        }
+
+        bool operator!=(const const_iterator& rhs) const {
+            return !(*this == rhs);
+        }
+    };
+
     /**
      * @brief Bit vector constructor with existing allocator
      *
@@ -127,7 +853,7 @@ class bit_vector : uncopyable {
     bit_vector(allocator* alloc, dtype size = 0, bool value = false) {
         allocator_ = alloc;
         if constexpr (compressed) {
-            l_root_->template allocate_leaf<leaf>(2, size, value);
+            l_root_ = allocator_->template allocate_leaf<leaf>(2, size, value);
             return;
         }
         if (size > 0 || value == true) {
@@ -161,6 +887,24 @@ class bit_vector : uncopyable {
         l_root_ = allocator_->template allocate_leaf<leaf>(2);
     }
 
+    /**
+     * @brief Construct a bit vector from a packed word array.
+     *
+     * Creates an owned allocator and bulk loads `n_bits` bits from `words`.
+     * See `assign` for details.
+     *
+     * @param words  Packed source data.
+     * @param n_bits Number of bits to read from `words`.
+     * @param fill    Target fill rate for leaves and internal nodes.
+     * @param threads Number of threads to use for filling leaves.
+     */
+    bit_vector(const uint64_t* words, dtype n_bits, double fill = 0.75,
+               uint16_t threads = 1) {
+        allocator_ = new allocator();
+        owned_allocator_ = true;
+        build(words, n_bits, fill, threads);
+    }
+
     /**
      * @brief Deconstructor that deallocates the entire data structure.
      *
@@ -170,15 +914,89 @@ class bit_vector : uncopyable {
      * dallocated as well.
      */
     ~bit_vector() {
-        if (root_is_leaf_) {
-            allocator_->deallocate_leaf(l_root_);
-        } else {
-            n_root_->deallocate(allocator_);
-            allocator_->deallocate_node(n_root_);
-        }
+        deallocate_tree();
         if (owned_allocator_) {
             delete (allocator_);
         }
+        if (shared_ != nullptr && --shared_->users == 0) {
+            if (shared_->owns_allocator) {
+                delete (allocator_);
+            }
+            delete shared_;
+        }
+    }
+
+    /**
+     * @brief Create a snapshot of the current state in constant time.
+     *
+     * The snapshot shares all nodes and leaves with this bit vector. Shared
+     * objects count their references, and the first update of either bit
+     * vector modifying a shared object copies it, along with the path from
+     * the root. Siblings are only copied when rebalancing moves elements to
+     * or from them. Older versions thus only cost the memory of their
+     * differences to newer versions. The snapshot can itself be updated and
+     * snapshotted.
+     *
+     * Snapshots share the allocator, which is deallocated with the last of
+     * them if owned. A snapshot may be queried from another thread while
+     * this bit vector is updated, since queries don't touch reference
+     * counts. Creating, updating and destroying bit vectors that share state
+     * need to be synchronized, since the allocator and reference counts are
+     * shared.
+     *
+     * `flush` makes the entire tree unique. `insert_batch` copies the paths
+     * to the touched leaves and `remove_range` the paths to the ends of the
+     * range, releasing covered subtrees as a whole. `dump` does not modify
+     * the tree.
+     *
+     * The returned bit vector is owned by the caller.
+     *
+     * @return Pointer to a new bit vector with the same content.
+     */
+    bit_vector* snapshot() {
+        if (shared_ == nullptr) {
+            shared_ = new shared_state();
+            shared_->users = 1;
+            shared_->owns_allocator = owned_allocator_;
+            owned_allocator_ = false;
+        }
+        shared_->users++;
+        if (root_is_leaf_) {
+            l_root_->add_ref();
+        } else {
+            n_root_->add_ref();
+        }
+        return new bit_vector(this);
+    }
+
+    /**
+     * @brief Replace the contents of the bit vector with packed data.
+     *
+     * The existing tree is deallocated and leaves are allocated and filled
+     * directly from `words`, after which the internal nodes are built
+     * bottom-up. This avoids a root-to-leaf descent and possible rebalancing
+     * for each bit, making loading linear in the number of words.
+     *
+     * Bit `i` of the bit vector will be `(words[i / 64] >> (i % 64)) & 1`.
+     *
+     * Leaves are filled to approximately `fill * leaf_size` elements. A lower
+     * fill rate leaves more room for subsequent insertions before leaves need
+     * to be rebalanced.
+     *
+     * Filling leaves from `words` can be split across `threads` threads. The
+     * data is partitioned into contiguous ranges of leaves, so the resulting
+     * tree is identical regardless of the number of threads.
+     *
+     * @param words   Packed source data.
+     * @param n_bits  Number of bits to read from `words`.
+     * @param fill    Target fill rate in the [0.5, 1] range.
+     * @param threads Number of threads to use for filling leaves.
+     */
+    void assign(const uint64_t* words, dtype n_bits, double fill = 0.75,
+                uint16_t threads = 1) {
+        deallocate_tree();
+        compact_pos_ = 0;
+        build(words, n_bits, fill, threads);
     }
 
     /**
@@ -205,6 +1023,7 @@ class bit_vector : uncopyable {
             assert(index <= size());
         }
 #endif
+        unshare_root();
         if (root_is_leaf_) {
             if (l_root_->need_realloc()) {
                 dtype cap = l_root_->capacity();
@@ -250,6 +1069,88 @@ class bit_vector : uncopyable {
         }
     }
 
+    /**
+     * @brief Insert `value` at `index` and return the rank of `index`.
+     *
+     * Equivalent to `insert(index, value)` followed by `rank(index)`. The
+     * rank is accumulated from the cumulative sums on the way down during the
+     * insertion, so only one descent is required when the root is a node.
+     *
+     * @param index Location for insertion.
+     * @param value Value to insert.
+     *
+     * @return \f$\sum_{i = 0}^{\mathrm{index - 1}} \mathrm{bv}[i]\f$.
+     */
+    dtype insert_and_rank(dtype index, bool value) {
+        if (root_is_leaf_) {
+            insert(index, value);
+            [[unlikely]] return rank(index);
+        }
+        unshare_root();
+        if (n_root_->child_count() == branches) {
+            [[unlikely]] split_root();
+        }
+        dtype res = 0;
+        n_root_->template insert<true>(index, value, allocator_, &res);
+        return res;
+    }
+
+    /**
+     * @brief Insert a batch of elements.
+     *
+     * Positions refer to the bit vector as it was before the batch. The bit
+     * `values[i]` will be inserted before the element that was at
+     * `positions[i]`, or at the end if `positions[i] == size()`. Elements with
+     * equal positions are inserted in input order.
+     *
+     * Positions are sorted and adjusted, after which the root is descended
+     * once per group of insertions targeting the same leaf. Cumulative sizes
+     * and sums in internal nodes are updated once per group instead of once
+     * per element.
+     *
+     * @param positions Insertion positions.
+     * @param values    Values to insert.
+     * @param n         Number of elements to insert.
+     */
+    void insert_batch(const dtype* positions, const bool* values, dtype n) {
+#ifdef DEBUG
+        for (dtype i = 0; i < n; i++) {
+            if (positions[i] > size()) {
+                std::cerr << "Invalid batch insertion to index "
+                          << positions[i] << " for " << size()
+                          << " element bit vector." << std::endl;
+                assert(positions[i] <= size());
+            }
+        }
+#endif
+        std::vector<dtype> order(n);
+        for (dtype i = 0; i < n; i++) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](dtype a, dtype b) {
+            return positions[a] < positions[b];
+        });
+        unshare_root();
+        // Shift positions to account for preceding insertions.
+        std::vector<dtype> indexes(n);
+        std::unique_ptr<bool[]> vals(new bool[n]);
+        for (dtype i = 0; i < n; i++) {
+            indexes[i] = positions[order[i]] + i;
+            vals[i] = values[order[i]];
+        }
+        dtype i = 0;
+        for (; i < n && root_is_leaf_; i++) {
+            insert(indexes[i], vals[i]);
+        }
+        while (i < n) {
+            if (n_root_->child_count() == branches) {
+                [[unlikely]] split_root();
+            }
+            i += n_root_->insert_batch(indexes.data() + i, vals.get() + i,
+                                       n - i, 0, allocator_);
+        }
+    }
+
     /**
      * @brief Remove element at "index".
      *
@@ -273,26 +1174,98 @@ class bit_vector : uncopyable {
      * @return Value of the removed bit.
      */
     bool remove(dtype index) {
+        unshare_root();
         if (root_is_leaf_) {
             [[unlikely]] return l_root_->remove(index);
         } else {
             bool v = n_root_->remove(index, allocator_);
             if (n_root_->child_count() == 1) {
-                if (n_root_->has_leaves()) {
-                    l_root_ = reinterpret_cast<leaf*>(n_root_->child(0));
-                    root_is_leaf_ = true;
-                    allocator_->deallocate_node(n_root_);
-                } else {
-                    node* new_root = reinterpret_cast<node*>(n_root_->child(0));
-                    allocator_->deallocate_node(n_root_);
-                    n_root_ = new_root;
-                }
-                [[unlikely]] (void(0));
+                [[unlikely]] collapse_root();
             }
             return v;
         }
     }
 
+    /**
+     * @brief Remove the index<sup>th</sup> element and return it with the rank
+     * of `index`.
+     *
+     * Equivalent to `rank(index)` followed by `remove(index)`, in a single
+     * descent when the root is a node.
+     *
+     * @param index Location for removal.
+     *
+     * @return Pair of the removed value and
+     * \f$\sum_{i = 0}^{\mathrm{index - 1}} \mathrm{bv}[i]\f$.
+     */
+    std::pair<bool, dtype> remove_and_rank(dtype index) {
+        unshare_root();
+        if (root_is_leaf_) {
+            dtype res = l_root_->rank(index);
+            [[unlikely]] return {l_root_->remove(index), res};
+        }
+        dtype res = 0;
+        bool v = n_root_->template remove<true>(index, allocator_, &res);
+        if (n_root_->child_count() == 1) {
+            [[unlikely]] collapse_root();
+        }
+        return {v, res};
+    }
+
+    /**
+     * @brief Remove elements in the \f$[\mathrm{begin}, \mathrm{end})\f$
+     * range.
+     *
+     * Leaves and subtrees fully covered by the range are deallocated without
+     * visiting their contents, and the leaves bordering the range are trimmed.
+     * The tree is then repaired by merging or balancing underfull nodes and
+     * leaves along the borders of the range, and tree height is decreased as
+     * appropriate.
+     *
+     * For hybrid compressed leaves elements are removed one at a time.
+     *
+     * @param begin Index of the first element to remove.
+     * @param end   Index following the last element to remove.
+     */
+    void remove_range(dtype begin, dtype end) {
+#ifdef DEBUG
+        if (begin > end || end > size()) {
+            std::cerr << "Invalid range removal [" << begin << ", " << end
+                      << ") for " << size() << " element bit vector."
+                      << std::endl;
+            assert(begin <= end && end <= size());
+        }
+#endif
+        if (begin >= end) {
+            return;
+        }
+        if (begin == 0 && end == size()) {
+            deallocate_tree();
+            l_root_ = allocator_->template allocate_leaf<leaf>(2);
+            root_is_leaf_ = true;
+            compact_pos_ = 0;
+            [[unlikely]] return;
+        }
+        if constexpr (compressed) {
+            for (dtype i = begin; i < end; i++) {
+                remove(begin);
+            }
+            return;
+        }
+        // Only the paths to the range ends are trimmed. Covered subtrees are
+        // released as a whole.
+        unshare_root();
+        if (root_is_leaf_) {
+            l_root_->remove_range(begin, end);
+            [[unlikely]] return;
+        }
+        n_root_->remove_range(begin, end, allocator_,
+                              [this](auto* child) { discard(child); });
+        while (!root_is_leaf_ && n_root_->child_count() == 1) {
+            collapse_root();
+        }
+    }
+
     /**
      * @brief Number of 1-bits in the data structure.
      *
@@ -318,6 +1291,28 @@ class bit_vector : uncopyable {
         return !root_is_leaf_ ? n_root_->size() : l_root_->size();
     }
 
+    /**
+     * @brief Iterator pointing to the first bit of the data structure.
+     *
+     * Sequential reading with the iterator avoids the root-to-leaf descent
+     * required by `at` for each bit.
+     */
+    const_iterator begin() const { return const_iterator(this, 0); }
+
+    /**
+     * @brief Iterator pointing past the last bit of the data structure.
+     */
+    const_iterator end() const { return const_iterator(this, size()); }
+
+    /**
+     * @brief Iterator pointing to the index<sup>th</sup> bit.
+     *
+     * @param index Starting position in \f$[0, \mathrm{size}]\f$.
+     */
+    const_iterator iterator_at(dtype index) const {
+        return const_iterator(this, index);
+    }
+
     /**
      * @brief Retrieves the value of the index<sup>th</sup> element in the data
      * structure.
@@ -340,6 +1335,55 @@ class bit_vector : uncopyable {
         return !root_is_leaf_ ? n_root_->at(index) : l_root_->at(index);
     }
 
+    /**
+     * @brief Retrieves the value of the index<sup>th</sup> element and its
+     * rank.
+     *
+     * Equivalent to `v = at(index)` followed by `rank(v, index)`, but done in
+     * a single descent, scanning the leaf buffer once. This is the inner loop
+     * of LF-mapping in wavelet tree and FM-index style structures.
+     *
+     * @param index Index to access.
+     *
+     * @return Pair of the value `v` of the index<sup>th</sup> element and the
+     * number of elements with value `v` before `index`.
+     */
+    std::pair<bool, dtype> access_rank(dtype index) const {
+        dtype rank = 0;
+        bool v;
+        if (root_is_leaf_) {
+            uint32_t l_rank;
+            v = l_root_->access_rank(index, l_rank);
+            [[unlikely]] rank = l_rank;
+        } else {
+            v = n_root_->access_rank(index, rank);
+        }
+        return {v, v ? rank : index - rank};
+    }
+
+    /**
+     * @brief Retrieves `width` consecutive bits starting at the
+     * index<sup>th</sup> element.
+     *
+     * Equivalent to packing `at(index + i) << i` for \f$i \in [0,
+     * \mathrm{width})\f$, but descends the tree only once and extracts whole
+     * words from the leaf data. Ranges spanning a leaf boundary are read from
+     * both leaves.
+     *
+     * @param index Position of the first bit.
+     * @param width Number of bits to read. In \f$[1, 64]\f$ and `index + width
+     *              <= size()`.
+     *
+     * @return The requested bits packed into a word, with the
+     * index<sup>th</sup> element as the least significant bit.
+     */
+    uint64_t get_bits(dtype index, uint16_t width) const {
+        assert(width > 0 && width <= WORD_BITS);
+        assert(index + width <= size());
+        return !root_is_leaf_ ? n_root_->get_bits(index, width)
+                              : l_root_->get_bits(index, width);
+    }
+
     /**
      * @brief Number of 1-bits up to position index.
      *
@@ -357,6 +1401,37 @@ class bit_vector : uncopyable {
     dtype rank(dtype index) const {
         return !root_is_leaf_ ? n_root_->rank(index) : l_root_->rank(index);
     }
+
+    /**
+     * @brief Number of 1-bits up to each of a sorted sequence of positions.
+     *
+     * Equivalent to `out[i] = rank(positions[i])` for each query. Queries
+     * targeting the same subtree are grouped so that each node and leaf is
+     * visited at most once, and ranks within a leaf are computed
+     * incrementally. For large batches this approaches the cost of a
+     * sequential scan instead of `n` independent descents.
+     *
+     * @param positions Non-decreasing query positions.
+     * @param n         Number of queries.
+     * @param out       Output array for `n` results.
+     */
+    void rank_batch(const dtype* positions, dtype n, dtype* out) const {
+#ifdef DEBUG
+        for (dtype i = 1; i < n; i++) {
+            assert(positions[i - 1] <= positions[i]);
+        }
+#endif
+        if (n == 0) {
+            [[unlikely]] return;
+        }
+        if (root_is_leaf_) {
+            [[unlikely]] l_root_->rank_batch(positions, n, out, dtype(0),
+                                             dtype(0));
+        } else {
+            n_root_->rank_batch(positions, n, out, 0, 0);
+        }
+    }
+
     dtype rank0(dtype index) const {
         if (index == 0) {
             [[unlikely]] return 0;
@@ -386,22 +1461,54 @@ class bit_vector : uncopyable {
         return !root_is_leaf_ ? n_root_->select(count) : l_root_->select(count);
     }
 
-    dtype select0(dtype count) const {
-        dtype a = 0;
-        dtype b = size();
-        while (a < b) {
-            dtype m = (a + b) / 2;
-            dtype r_m = rank0(m);
-            if (r_m < count) {
-                a = m + 1;
-            } else if (r_m > count) {
-                b = m - 1;
-            } else {
-                b = m;
-            }
+    /**
+     * @brief Index of the count<sup>th</sup> 1-bit for each of a sorted
+     * sequence of selection targets.
+     *
+     * Equivalent to `out[i] = select(counts[i])` for each target. Targets
+     * resolving to the same subtree are grouped so that each node and leaf is
+     * visited at most once, and each leaf is scanned once, continuing from the
+     * previous answer.
+     *
+     * @param counts Non-decreasing selection targets in \f$[1, \mathrm{sum}]\f$.
+     * @param n      Number of targets.
+     * @param out    Output array for `n` results.
+     */
+    void select_batch(const dtype* counts, dtype n, dtype* out) const {
+#ifdef DEBUG
+        for (dtype i = 0; i < n; i++) {
+            assert(counts[i] > 0);
+            assert(counts[i] <= sum());
+            assert(i == 0 || counts[i - 1] <= counts[i]);
         }
-        return a - 1;
+#endif
+        if (n == 0) {
+            [[unlikely]] return;
+        }
+        if (root_is_leaf_) {
+            [[unlikely]] l_root_->select_batch(counts, n, out, dtype(0),
+                                               dtype(0));
+        } else {
+            n_root_->select_batch(counts, n, out, 0, 0);
+        }
+    }
+
+    /**
+     * @brief Index of the count<sup>th</sup> 0-bit in the data structure
+     *
+     * Uses the difference of cumulative sizes and sums in internal nodes to
+     * locate the target leaf in a single descent, as for `select`.
+     *
+     * @param count Selection target.
+     *
+     * @return \f$\underset{i \in [0..n)}{\mathrm{arg min}}\left(\sum_{j = 0}^i
+     * (1 - \mathrm{bv}[j])\right) =  \f$ count.
+     */
+    dtype select0(dtype count) const {
+        return !root_is_leaf_ ? n_root_->select0(count)
+                              : l_root_->select0(count);
     }
+
     dtype select(bool v, dtype count) const {
         return v ? select(count) : select0(count);
     }
@@ -420,6 +1527,7 @@ class bit_vector : uncopyable {
      * @param value value to set the index<sup>th</sup> bit to.
      */
     void set(dtype index, bool value) {
+        unshare_root();
         if (root_is_leaf_) {
             if constexpr (compressed) {
                 if (l_root_->is_compressed() && l_root_->need_realloc()) {
@@ -451,14 +1559,48 @@ class bit_vector : uncopyable {
         }
     }
 
+    /**
+     * @brief Set the bit at `index` to `value` and return the rank of `index`.
+     *
+     * Equivalent to `set(index, value)` followed by `rank(index)`, in a single
+     * descent when the root is a node.
+     *
+     * @param index Index to set.
+     * @param value Value to set the index<sup>th</sup> bit to.
+     *
+     * @return \f$\sum_{i = 0}^{\mathrm{index - 1}} \mathrm{bv}[i]\f$.
+     */
+    dtype set_and_rank(dtype index, bool value) {
+        if (root_is_leaf_) {
+            set(index, value);
+            [[unlikely]] return rank(index);
+        }
+        unshare_root();
+        if constexpr (compressed) {
+            if (n_root_->child_count() == branches) {
+                [[unlikely]] split_root();
+            }
+        }
+        dtype res = 0;
+        n_root_->template set<true>(index, value, allocator_, &res);
+        return res;
+    }
+
     /**
      * @brief Recursively flushes all buffers in the data structure.
      *
      * If execution transitions to a phase where no insertions or removals are
      * expected, flushing all buffers should improve query time at the cost of a
      * fairly expensive flushing operations.
+     *
+     * Subtrees are flushed in parallel using up to `threads` threads.
+     *
+     * @param threads Number of threads to use.
      */
-    void flush() { root_is_leaf_ ? l_root_->flush() : n_root_->flush(); }
+    void flush(uint16_t threads = 1) {
+        unshare_all();
+        root_is_leaf_ ? l_root_->flush() : n_root_->flush(threads);
+    }
 
     /**
      * @brief Write raw bit data to the area provided.
@@ -466,16 +1608,187 @@ class bit_vector : uncopyable {
      * The are provided should have at least bv.size() allocated and zeroed
      * out bits.
      *
-     * @param data Pointer to where raw data should be dumped.
+     * Subtrees are written in parallel using up to `threads` threads. The
+     * output does not depend on the number of threads.
+     *
+     * @param data    Pointer to where raw data should be dumped.
+     * @param threads Number of threads to use.
+     */
+    void dump(uint64_t* data, uint16_t threads = 1) const {
+        if (root_is_leaf_) {
+            node::dump_leaf(l_root_, data, 0, nullptr);
+        } else {
+            n_root_->dump(data, 0, threads);
+        }
+    }
+
+    /**
+     * @brief Write raw bit data to `emit` in fixed size chunks.
+     *
+     * Streaming alternative to `dump(uint64_t*)`. Leaves are decoded in order
+     * to a buffer of `chunk_words + leaf_size / 64 + 1` words, and every time
+     * the buffer holds at least `chunk_words` complete words, the first
+     * `chunk_words` words are passed to `emit`. The final chunk may be
+     * shorter, with unused high bits of the last word set to 0. Peak memory
+     * use is thus independent of the size of the bit vector.
+     *
+     * Leaves are decoded without committing buffers, so the bit vector is not
+     * modified.
+     *
+     * The pointer passed to `emit` is only valid for the duration of the
+     * call.
+     *
+     * @tparam callback Callable as `emit(const uint64_t* words, uint64_t n)`.
+     *
+     * @param emit        Receiver of chunks.
+     * @param chunk_words Number of 64-bit words per chunk.
+     */
+    template <class callback>
+    void dump_chunks(callback emit, uint64_t chunk_words = 1 << 16) const {
+        assert(chunk_words > 0);
+        chunk_writer<callback> writer(emit, chunk_words);
+        for_each_leaf([&](const leaf* l) { writer.append(l); });
+        writer.finish();
+    }
+
+    /**
+     * @brief Write the data structure to `out` in binary form.
+     *
+     * Writes a header describing the configuration of the bit vector type
+     * followed by the tree in pre-order. Leaf contents, including hybrid RLE
+     * leaves in compressed form and pending buffer elements, are written as
+     * is, so that `load` does not need to re-encode or re-insert anything.
+     *
+     * The format uses native byte order and is only intended to be read by a
+     * bit vector of the same type.
+     *
+     * @param out Stream to write to.
      */
-    void dump(uint64_t* data) {
+    void serialize(std::ostream& out) const {
+        uint32_t header[SERIAL_HEADER_WORDS];
+        serial_header(header);
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        uint8_t is_leaf = root_is_leaf_;
+        out.write(reinterpret_cast<const char*>(&is_leaf), sizeof(is_leaf));
         if (root_is_leaf_) {
-            l_root_->dump(data, 0);
+            l_root_->serialize(out);
         } else {
-            n_root_->dump(data, 0);
+            n_root_->serialize(out);
         }
     }
 
+    /**
+     * @brief Write the data structure to `out` in the memory-mapped format.
+     *
+     * The output can be mapped read-only and queried with `mapped_type`
+     * without deserialization. Leaves are written as is, so buffers need not
+     * be flushed first.
+     *
+     * @param out Stream to write to.
+     */
+    void write_mapped(std::ostream& out) const {
+        static const char zeros[mapped_type::PAGE_BYTES] = {};
+        uint64_t offset = mapped_type::PAGE_BYTES;
+        uint64_t root = offset;
+        if (root_is_leaf_) {
+            offset += l_root_->mapped_bytes();
+        } else {
+            offset += n_root_->subtree_mapped_bytes();
+            root = offset - node::mapped_bytes();
+        }
+        uint64_t bytes = (offset + mapped_type::PAGE_BYTES - 1) /
+                         mapped_type::PAGE_BYTES * mapped_type::PAGE_BYTES;
+        mapped_type::write_header(out, root_is_leaf_, root, size(), sum(),
+                                  bytes);
+        offset = mapped_type::PAGE_BYTES;
+        if (root_is_leaf_) {
+            l_root_->write_mapped(out);
+            offset += l_root_->mapped_bytes();
+        } else {
+            [[maybe_unused]] uint64_t r = n_root_->write_mapped(out, offset);
+            assert(r == root);
+        }
+        out.write(zeros, bytes - offset);
+    }
+
+    /**
+     * @brief Replace the content of the data structure with data read from
+     * `in`.
+     *
+     * Reads data written by `serialize` of the same bit vector type. Nodes
+     * and leaves are allocated with the allocator of this bit vector and leaf
+     * capacities are restored as they were when serialized.
+     *
+     * The content is replaced only if the whole stream was read
+     * successfully and passed validation. On failure the bit vector is left
+     * unchanged and any partially loaded subtree is deallocated.
+     *
+     * @param in Stream to read from.
+     *
+     * @return False if the stream does not contain valid data for this bit
+     * vector type.
+     */
+    bool load(std::istream& in) {
+        uint32_t header[SERIAL_HEADER_WORDS];
+        uint32_t expected[SERIAL_HEADER_WORDS];
+        serial_header(expected);
+        in.read(reinterpret_cast<char*>(header), sizeof(header));
+        if (!in || memcmp(header, expected, sizeof(header)) != 0) {
+            [[unlikely]] return false;
+        }
+        uint8_t is_leaf = 0;
+        in.read(reinterpret_cast<char*>(&is_leaf), sizeof(is_leaf));
+        if (!in || is_leaf > 1) {
+            [[unlikely]] return false;
+        }
+        leaf* l = nullptr;
+        node* n = nullptr;
+        if (is_leaf) {
+            l = leaf::load(in, allocator_);
+        } else {
+            n = node::load(in, allocator_);
+        }
+        if (l == nullptr && n == nullptr) {
+            [[unlikely]] return false;
+        }
+        deallocate_tree();
+        root_is_leaf_ = is_leaf;
+        if (root_is_leaf_) {
+            l_root_ = l;
+        } else {
+            n_root_ = n;
+        }
+        compact_pos_ = 0;
+        return true;
+    }
+
+    /**
+     * @brief Generate a static snapshot with fast rank and select support.
+     *
+     * Intended for query heavy phases between bursts of updates. The snapshot
+     * supports constant time access and rank, and near constant time select,
+     * but is not updated when the bit vector is modified. The bit vector is
+     * not modified, so buffers need not be flushed first.
+     *
+     * The returned structure is owned by the caller.
+     *
+     * @tparam block_size Super block size and select sample rate of the
+     *                    snapshot.
+     *
+     * @return Pointer to a new bv::query_support instance.
+     */
+    template <uint32_t block_size = 2048>
+    query_support<dtype, leaf, block_size>* generate_query_structure() const {
+        auto* qs = new query_support<dtype, leaf, block_size>(size());
+        if (root_is_leaf_) {
+            qs->append(l_root_);
+        } else {
+            n_root_->generate_query_structure(qs);
+        }
+        qs->finalize();
+        return qs;
+    }
+
     /**
      * @brief Total size of data structure allocations in bits.
      *
@@ -506,22 +1819,26 @@ class bit_vector : uncopyable {
      *
      * If the `-DNDEBUG` compiler flag is given, this function will do nothing
      * since assertions will be `(void(0))`ed out.
+     *
+     * @param threads Number of threads to use for validating subtrees.
      */
-    void validate() const {
+    void validate(uint16_t threads = 1) const {
 #ifndef NDEBUG
         if (owned_allocator_) {
             uint64_t allocs = allocator_->live_allocations();
             if (root_is_leaf_) {
                 assert(allocs == l_root_->validate());
             } else {
-                assert(allocs == n_root_->validate());
+                assert(allocs == n_root_->validate(threads));
             }
         } else {
             if (root_is_leaf_)
                 l_root_->validate();
             else
-                n_root_->validate();
+                n_root_->validate(threads);
         }
+#else
+        (void)threads;
 #endif
     }
 
@@ -537,15 +1854,119 @@ class bit_vector : uncopyable {
         std::cout << std::endl;
     }
 
-    double leaf_usage() const {
+    double leaf_usage(uint16_t threads = 1) const {
         std::pair<uint64_t, uint64_t> p;
         if (root_is_leaf_) {
             p = l_root_->leaf_usage();
         } else {
-            p = n_root_->leaf_usage();
+            p = n_root_->leaf_usage(threads);
         }
         return double(p.second) / p.first;
     }
+
+    /**
+     * @brief Pass the leaves to `f` in logical order.
+     *
+     * @tparam F Callable as `f(const leaf*)`.
+     */
+    template <class F>
+    void for_each_leaf(F f) const {
+        if (root_is_leaf_) {
+            f(l_root_);
+        } else {
+            n_root_->for_each_leaf(f);
+        }
+    }
+
+    /**
+     * @brief Memory usage statistics of the allocator.
+     *
+     * The statistics cover everything allocated with the allocator, which
+     * includes other bit vectors sharing the allocator.
+     *
+     * @return Statistics struct of the allocator. bv::alloc_stats for the
+     * allocators in allocator.hpp.
+     */
+    auto allocator_stats() const { return allocator_->stats(); }
+
+    /**
+     * @brief Defragment the bit vector incrementally.
+     *
+     * Rewrites leaves in left-to-right order so that logically consecutive
+     * leaves are allocated consecutively, which makes them contiguous in
+     * memory with allocators such as bv::arena_alloc. Under-full leaves are
+     * repacked to approximately `fill * leaf_size` elements, improving
+     * `leaf_usage()`, and the memory of the old leaves is released.
+     *
+     * Work is done in steps of one bottom level node (at most `branches`
+     * leaves) at a time, until at least `max_leaves` leaves have been
+     * rewritten. The position reached is stored, and the next call continues
+     * from there, so compaction can be interleaved with other operations.
+     * Updates between calls may shift content past the stored position, in
+     * which case that content is compacted on the next pass.
+     *
+     * New leaves are allocated between `begin_compaction` and
+     * `end_compaction` calls to the allocator. bv::arena_alloc uses these to
+     * place the leaves in fresh chunks instead of reusing the blocks of the
+     * replaced leaves, and to return emptied chunks to the memory source.
+     *
+     * Leaves of compressed bit vectors are relocated but not repacked. Only
+     * the parts being rewritten are unshared from snapshots.
+     *
+     * @param max_leaves Number of leaves to rewrite before returning.
+     * @param fill       Target fill rate of repacked leaves. Clamped to
+     *                   \f$[0.5, 1]\f$.
+     *
+     * @return True if the end of the bit vector was reached, in which case the
+     * next call starts a new pass from the beginning.
+     */
+    bool compact(uint64_t max_leaves = ~uint64_t(0), double fill = 0.75) {
+        fill = fill < 0.5 ? 0.5 : (fill > 1 ? 1 : fill);
+        dtype target = fill * leaf_size;
+        allocator_->begin_compaction();
+        if (root_is_leaf_) {
+            leaf* old = l_root_;
+            if constexpr (compressed) {
+                l_root_ = old->clone(allocator_);
+            } else {
+                std::vector<uint64_t> data(old->size() / WORD_BITS + 2, 0);
+                old->decode(data.data());
+                l_root_ = build_leaf(data.data(), 0, old->size());
+            }
+            discard(old);
+            allocator_->end_compaction(true);
+            compact_pos_ = 0;
+            return true;
+        }
+        dtype n = size();
+        uint64_t done = 0;
+        while (done < max_leaves && compact_pos_ < n) {
+            uint16_t depth = 0;
+            for (node* nd = n_root_; !nd->has_leaves(); depth++) {
+                nd = reinterpret_cast<node*>(nd->child(0));
+            }
+            if (is_shared()) {
+                unshare_path(compact_pos_, depth);
+            }
+            node* nd = n_root_;
+            dtype start = 0;
+            while (!nd->has_leaves()) {
+                uint16_t idx = nd->child_sizes()->find(compact_pos_ - start + 1);
+                start += idx != 0 ? nd->child_sizes()->get(idx - 1) : 0;
+                nd = reinterpret_cast<node*>(nd->child(idx));
+            }
+            done += nd->child_count();
+            compact_leaves(nd, target);
+            compact_pos_ = start + nd->size();
+        }
+        if (compact_pos_ < n) {
+            allocator_->end_compaction(false);
+            return false;
+        }
+        allocator_->end_compaction(true);
+        compact_pos_ = 0;
+        return true;
+    }
 };
 }  // namespace bv
 #endif
\ No newline at end of file
@@ -294,6 +294,48 @@ class branchless_scan : uncopyable {
         idx ^= (dtype((elems_[idx] - q) & SIGN_BIT) >> (num_bits - 1));
         return idx;
     }
+
+    /**
+     * @brief Find the lowest child index s.t. the difference of cumulative
+     * sums at the index is at least q.
+     *
+     * Intended for select0 queries, where `this` contains cumulative sizes and
+     * `subtrahend` contains cumulative sums, such that the difference is the
+     * cumulative number of 0-bits.
+     *
+     * The same branchless binary search as in `find` is used. Since unused
+     * entries in both structures contain the same value, entries at index
+     * `size` or greater are treated as `(~dtype(0)) >> 1` to keep the
+     * differences monotonic.
+     *
+     * @param q          Query target.
+     * @param subtrahend Cumulative sums to subtract from these.
+     * @param size       Number of elements stored.
+     * @return \f$\underset{i}{\mathrm{arg min}}(\mathrm{cum\_sizes}[i] -
+     * \mathrm{cum\_sums}[i] \geq q)\f$.
+     */
+    uint16_t find_difference(dtype q, const branchless_scan& subtrahend,
+                             uint16_t size) const {
+        constexpr dtype SIGN_BIT = ~((~dtype(0)) >> 1);
+        constexpr dtype num_bits = sizeof(dtype) * 8;
+        constexpr dtype lines = CACHE_LINE / sizeof(dtype);
+        constexpr const uint16_t u_bits = 30 - __builtin_clz(branches);
+        for (dtype i = 0; i < branches; i += lines) {
+            __builtin_prefetch(elems_ + i);
+            __builtin_prefetch(subtrahend.elems_ + i);
+        }
+        auto diff = [&](uint16_t i) -> dtype {
+            return i < size ? elems_[i] - subtrahend.elems_[i]
+                            : (~dtype(0)) >> 1;
+        };
+        uint16_t idx = (uint16_t(1) << u_bits) - 1;
+        for (uint16_t i = u_bits; i > 0; --i) {
+            idx ^= (dtype((diff(idx) - q) & SIGN_BIT) >> (num_bits - i - 1)) |
+                   (uint16_t(1) << (i - 1));
+        }
+        idx ^= (dtype((diff(idx) - q) & SIGN_BIT) >> (num_bits - 1));
+        return idx;
+    }
 };
 
 }  // namespace bv
@@ -97,7 +97,7 @@ class buffer {
     static_assert(buffer_size <= ((1 << 16) - 1));
     static_assert(__builtin_popcount(buffer_size) == 1);
     static const constexpr uint16_t SCRATCH_ELEMS = buffer_size >= 6 ? buffer_size / 2 : 3; 
-    inline static BufferElement scratch[SCRATCH_ELEMS * 2];
+    inline static thread_local BufferElement scratch[SCRATCH_ELEMS * 2];
 
     BufferElement buffer_[buffer_size];
     uint16_t buffer_elems_;
@@ -120,6 +120,15 @@ class buffer {
         sort<buffer_size, true>(buffer_, scratch);
     }
 
+    // Like sort, but into target, leaving this buffer unchanged.
+    void sort_to(buffer& target) const {
+        for (uint16_t i = 0; i < buffer_elems_; i++) {
+            target.buffer_[i] = buffer_[i];
+        }
+        target.buffer_elems_ = buffer_elems_;
+        target.sort();
+    }
+
     bool is_full() const { return buffer_elems_ == buffer_size; }
 
     bool access(uint32_t& idx, bool& v) const {
@@ -391,6 +400,67 @@ class buffer {
         }
     }
 
+    // Combined access and rank. Returns the number of buffered 1-bits before
+    // idx and adjusts idx as rank does. If the bit at idx is buffered, v is
+    // set and found is true.
+    uint32_t access_rank(uint32_t& idx, bool& v, bool& found) const {
+        uint32_t ret = 0;
+        uint32_t o_idx = idx;
+        found = false;
+        if constexpr (sorted && !compressed) {
+            for (uint16_t i = 0; i < buffer_elems_; ++i) {
+                uint32_t b_idx = buffer_[i].index();
+                if (b_idx < o_idx) [[likely]] {
+                    if (buffer_[i].is_insertion()) {
+                        --idx;
+                        ret += buffer_[i].value();
+                    } else {
+                        ++idx;
+                        ret -= buffer_[i].value();
+                    }
+                } else if (b_idx == o_idx) {
+                    if (buffer_[i].is_insertion()) {
+                        v = buffer_[i].value();
+                        found = true;
+                        break;
+                    }
+                    ++idx;
+                    ret -= buffer_[i].value();
+                } else {
+                    break;
+                }
+            }
+            return ret;
+        } else if constexpr (!sorted) {
+            for (uint16_t i = buffer_elems_ - 1; i < buffer_elems_; --i) {
+                uint32_t b_idx = buffer_[i].index();
+                if (b_idx < idx) {
+                    --idx;
+                    ret += buffer_[i].value();
+                } else if (b_idx == idx && !found) {
+                    v = buffer_[i].value();
+                    found = true;
+                }
+            }
+            return ret;
+        } else {
+            for (uint16_t i = 0; i < buffer_elems_; ++i) {
+                uint32_t b_idx = buffer_[i].index();
+                if (b_idx < o_idx) {
+                    --idx;
+                    ret += buffer_[i].value();
+                } else {
+                    if (b_idx == o_idx) {
+                        v = buffer_[i].value();
+                        found = true;
+                    }
+                    break;
+                }
+            }
+            return ret;
+        }
+    }
+
     uint32_t clear_first(uint32_t& elems) {
         static_assert(sorted && compressed);
         uint16_t i = 0; 
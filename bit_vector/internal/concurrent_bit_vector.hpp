@@ -0,0 +1,315 @@
+#ifndef BV_CONCURRENT_BIT_VECTOR_HPP
+#define BV_CONCURRENT_BIT_VECTOR_HPP
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "uncopyable.hpp"
+
+#ifndef CACHE_LINE
+// Apparently the most common cache line size is 64.
+#define CACHE_LINE 64
+#endif
+
+namespace bv {
+
+/**
+ * @brief Bit vector supporting concurrent readers and a single writer.
+ *
+ * The writer updates a private bit vector, and publishes an immutable
+ * version of it after each update with `bit_vector::snapshot`. Versions
+ * share all nodes and leaves with the private bit vector, and the next
+ * update copies the root-to-leaf paths it descends, along with any sibling
+ * that rebalancing moves elements to or from. Publishing thus costs time
+ * and memory proportional to the modified paths.
+ *
+ * Replaced versions are retired with the current epoch and deleted once no
+ * reader can still be reading them. Readers announce the epoch they started
+ * reading in in a per-reader slot and never wait for the writer. The writer
+ * never waits for readers either: after each publication it deletes the
+ * retired versions older than every announced epoch, and leaves the rest for
+ * a later update. Each read section sees a single consistent version. Long
+ * read sections only delay reclamation.
+ *
+ * Updates can be batched with `update` to publish several modifications at
+ * once.
+ *
+ * Usage:
+ *
+ * ```
+ * bv::concurrent_bit_vector<bv::bv> cbv;
+ * // Writer thread.
+ * cbv.insert(0, true);
+ * // Reader threads.
+ * auto r = cbv.reader();
+ * if (r) {
+ *     uint64_t ones = r.sum();
+ *     r.read([&](const bv::bv& b) { return b.rank(b.size() / 2); });
+ * }
+ * ```
+ *
+ * @tparam bit_vector_type Underlying bit vector. Some kind of bv::bit_vector.
+ * @tparam max_readers     Maximum number of simultaneously registered readers.
+ */
+template <class bit_vector_type, uint16_t max_readers = 64>
+class concurrent_bit_vector : uncopyable {
+   private:
+    /** @brief Slot value for slots not held by any reader. */
+    static const constexpr uint64_t FREE = ~uint64_t(0);
+    /** @brief Slot value for readers outside of read sections. */
+    static const constexpr uint64_t IDLE = FREE - 1;
+
+    /**
+     * @brief Per-reader announcement of the epoch being read.
+     *
+     * Contains `FREE`, `IDLE` or the epoch at the start of the read section.
+     */
+    struct alignas(CACHE_LINE) slot {
+        std::atomic<uint64_t> state{FREE};
+    };
+
+    /**
+     * @brief Replaced version waiting for readers to leave it.
+     */
+    struct retired_version {
+        const bit_vector_type* version;  ///< Replaced version.
+        uint64_t epoch;                  ///< Epoch when it was replaced.
+    };
+
+    bit_vector_type writer_;  ///< Private bit vector updated by the writer.
+    std::atomic<const bit_vector_type*> published_;  ///< Version for readers.
+    std::atomic<uint64_t> epoch_;          ///< Number of publications.
+    std::vector<retired_version> retired_;  ///< Versions not yet deleted.
+    mutable slot slots_[max_readers];      ///< Reader announcements.
+
+    /**
+     * @brief Publish the current state of the writer's bit vector.
+     *
+     * The replaced version is retired with the epoch it was published in,
+     * since only readers that announced that epoch or an earlier one may be
+     * reading it.
+     */
+    void publish() {
+        const bit_vector_type* old = published_.exchange(writer_.snapshot());
+        retired_.push_back({old, epoch_.fetch_add(1)});
+        reclaim();
+    }
+
+    /**
+     * @brief Delete retired versions that no reader can be reading.
+     *
+     * Never waits for readers. Versions still possibly in use are kept for a
+     * later call.
+     */
+    void reclaim() {
+        uint64_t oldest = epoch_.load();
+        for (uint16_t i = 0; i < max_readers; i++) {
+            uint64_t s = slots_[i].state.load();
+            oldest = s < oldest ? s : oldest;
+        }
+        uint64_t kept = 0;
+        for (uint64_t i = 0; i < retired_.size(); i++) {
+            if (retired_[i].epoch < oldest) {
+                delete retired_[i].version;
+            } else {
+                retired_[kept++] = retired_[i];
+            }
+        }
+        retired_.resize(kept);
+    }
+
+   public:
+    /**
+     * @brief Handle for reading from a thread.
+     *
+     * Holds a reader slot for its lifetime. A handle should only be used by
+     * one thread at a time. An empty handle, returned when no slot was free,
+     * converts to `false` and may not be read from.
+     */
+    class reader_handle : uncopyable {
+       private:
+        const concurrent_bit_vector* parent_;  ///< Structure to read.
+        uint16_t slot_;                        ///< Index of the held slot.
+
+       public:
+        reader_handle(const concurrent_bit_vector* parent, uint16_t slot_idx)
+            : parent_(parent), slot_(slot_idx) {}
+
+        reader_handle(reader_handle&& other)
+            : parent_(other.parent_), slot_(other.slot_) {
+            other.parent_ = nullptr;
+        }
+
+        ~reader_handle() {
+            if (parent_ != nullptr) {
+                parent_->slots_[slot_].state.store(FREE);
+            }
+        }
+
+        /** @brief True if the handle holds a reader slot. */
+        explicit operator bool() const { return parent_ != nullptr; }
+
+        /**
+         * @brief Run `f` on a consistent version of the bit vector.
+         *
+         * The writer may publish new versions during `f`, but the version
+         * passed to `f` is neither modified nor deleted before `f` returns.
+         *
+         * @tparam F Callable as `f(const bit_vector_type&)`.
+         *
+         * @return Return value of `f`.
+         */
+        template <class F>
+        auto read(F f) const {
+            assert(parent_ != nullptr);
+            auto& state = parent_->slots_[slot_].state;
+            state.store(parent_->epoch_.load());
+            struct release {
+                std::atomic<uint64_t>& s;
+                ~release() { s.store(IDLE); }
+            } r{state};
+            return f(*parent_->published_.load());
+        }
+
+        /** @brief Value of the i<sup>th</sup> bit. */
+        bool at(uint64_t i) const {
+            return read([&](const bit_vector_type& b) { return b.at(i); });
+        }
+
+        /** @brief Number of 1-bits before position `i`. */
+        uint64_t rank(uint64_t i) const {
+            return read([&](const bit_vector_type& b) { return b.rank(i); });
+        }
+
+        /** @brief Position of the x<sup>th</sup> 1-bit. */
+        uint64_t select(uint64_t x) const {
+            return read([&](const bit_vector_type& b) { return b.select(x); });
+        }
+
+        /** @brief Number of bits stored. */
+        uint64_t size() const {
+            return read([](const bit_vector_type& b) { return b.size(); });
+        }
+
+        /** @brief Number of 1-bits stored. */
+        uint64_t sum() const {
+            return read([](const bit_vector_type& b) { return b.sum(); });
+        }
+    };
+
+    /**
+     * @brief Create an empty structure.
+     */
+    concurrent_bit_vector()
+        : writer_(), published_(writer_.snapshot()), epoch_(0), slots_() {}
+
+    /**
+     * @brief Delete all versions.
+     *
+     * No reader handles may be in use.
+     */
+    ~concurrent_bit_vector() {
+        delete published_.load();
+        for (auto& r : retired_) {
+            delete r.version;
+        }
+    }
+
+    /**
+     * @brief Register a reader.
+     *
+     * @return Handle for reading, holding a reader slot until destroyed, or
+     * an empty handle if all `max_readers` slots are in use.
+     */
+    reader_handle reader() const {
+        for (uint16_t i = 0; i < max_readers; i++) {
+            uint64_t expected = FREE;
+            if (slots_[i].state.compare_exchange_strong(expected, IDLE)) {
+                return reader_handle(this, i);
+            }
+        }
+        [[unlikely]] return reader_handle(nullptr, 0);
+    }
+
+    /**
+     * @brief Apply `f` to the bit vector and publish the result.
+     *
+     * Several modifications in `f` are published together. Nodes and leaves
+     * shared with published versions are copied before they are modified.
+     *
+     * Only one thread may update the structure at a time.
+     *
+     * @tparam F Callable as `f(bit_vector_type&)`.
+     *
+     * @return Return value of `f`.
+     */
+    template <class F>
+    auto update(F f) {
+        struct publisher {
+            concurrent_bit_vector* c;
+            ~publisher() { c->publish(); }
+        } p{this};
+        return f(writer_);
+    }
+
+    /** @brief Insert `v` at position `index`. */
+    void insert(uint64_t index, bool v) {
+        update([&](bit_vector_type& b) { b.insert(index, v); });
+    }
+
+    /** @brief Remove the bit at position `index`. */
+    bool remove(uint64_t index) {
+        return update([&](bit_vector_type& b) { return b.remove(index); });
+    }
+
+    /** @brief Set the bit at position `index` to `v`. */
+    void set(uint64_t index, bool v) {
+        update([&](bit_vector_type& b) { b.set(index, v); });
+    }
+
+    /**
+     * @brief Latest version of the bit vector for use by the writer.
+     *
+     * Only safe to use from the writing thread, which is the only thread
+     * that can modify the bit vector.
+     */
+    const bit_vector_type& current() const { return writer_; }
+
+    /**
+     * @brief Number of replaced versions not yet deleted.
+     *
+     * Only safe to call from the writing thread.
+     */
+    uint64_t retired() const { return retired_.size(); }
+
+    /**
+     * @brief Total size of the data structure in bits.
+     *
+     * Nodes and leaves only referenced by retired versions are not included.
+     * Only safe to call from the writing thread.
+     */
+    uint64_t bit_size() const {
+        uint64_t ret = 8 * sizeof(concurrent_bit_vector);
+        ret -= 8 * sizeof(bit_vector_type);
+        return ret + writer_.bit_size();
+    }
+
+    /**
+     * @brief Check that the writer's bit vector is valid and published.
+     *
+     * Only safe to call from the writing thread.
+     */
+    void validate() const {
+        writer_.validate();
+        const bit_vector_type* published = published_.load();
+        published->validate();
+        assert(writer_.size() == published->size());
+        assert(writer_.sum() == published->sum());
+    }
+};
+
+}  // namespace bv
+
+#endif
@@ -27,7 +27,8 @@ class gap_leaf : uncopyable {
     }
 
    private:
-    inline static uint64_t data_scratch_[leaf_size / WORD_BITS];
+    /** @brief Per-thread space for rewriting blocks. */
+    inline static thread_local uint64_t data_scratch_[leaf_size / WORD_BITS];
 
     class Block : uncopyable {
        private:
@@ -426,6 +427,29 @@ class gap_leaf : uncopyable {
         return pos;
     }
 
+    uint32_t select0(uint32_t x) const {
+        uint32_t pos = 0;
+        uint32_t n_blocks = capacity_ / BLOCK_WORDS;
+        for (uint32_t i = 0; i < n_blocks; i++) {
+            // Gaps at the end of blocks contain 0-bits that need to be masked.
+            uint32_t b_elems = BLOCK_SIZE - gaps_[i];
+            const uint64_t* block = data_ + i * BLOCK_WORDS;
+            for (uint32_t j = 0; j < BLOCK_WORDS && b_elems > 0; j++) {
+                uint32_t bits = b_elems < WORD_BITS ? b_elems : WORD_BITS;
+                uint64_t word = ~block[j];
+                word &= bits < WORD_BITS ? (ONE << bits) - 1 : ~uint64_t(0);
+                uint32_t pop = __builtin_popcountll(word);
+                if (pop >= x) [[unlikely]] {
+                    return pos + __builtin_ctzll(_pdep_u64(ONE << (x - 1), word));
+                }
+                x -= pop;
+                pos += bits;
+                b_elems -= bits;
+            }
+        }
+        return pos;
+    }
+
     uint64_t bits_size() const {
         return 8 * (sizeof(*this) + capacity_ * sizeof(uint64_t));
     }
@@ -20,6 +20,11 @@
 #include "buffer.hpp"
 #include "circular_buffer.hpp"
 
+#ifndef CACHE_LINE
+// Apparently the most common cache line size is 64.
+#define CACHE_LINE 64
+#endif
+
 namespace bv {
 
 /**
@@ -65,9 +70,13 @@ class leaf : uncopyable {
     uint32_t size_;         ///< Logical number of bits stored.
     uint32_t p_sum_;        ///< Logical number of 1-bits stored.
     uint32_t run_index_;    ///< next index to write for runs.
+    uint32_t refs_;         ///< References beyond the first, from snapshots.
     buf buf_;
     uint64_t* data_;  ///< Pointer to data storage.
-    inline static uint64_t data_scratch[leaf_size / 64];
+    /** @brief Per-thread space for rewriting compressed data. */
+    inline static thread_local uint64_t data_scratch[leaf_size / 64];
+    /** @brief Per-thread space for sorting unsorted buffers in queries. */
+    inline static thread_local un_comp_buf sort_scratch;
 
     /** @brief 0x1 to be used in  bit operations. */
     static const constexpr uint64_t MASK = 1;
@@ -123,6 +132,7 @@ class leaf : uncopyable {
         type_info_ = 0;
         size_ = elems;
         p_sum_ = 0;
+        refs_ = 0;
         if constexpr (compressed) {
             p_sum_ = val ? elems : p_sum_;
             run_index_ = 0;
@@ -167,6 +177,22 @@ class leaf : uncopyable {
     uint32_t p_sum() const { return p_sum_; }
     /** @brief Getter for size_ */
     uint32_t size() const { return size_; }
+    /** @brief Whether the leaf is referenced by more than one parent. */
+    bool is_shared() const { return refs_ != 0; }
+    /** @brief Add a reference to the leaf. */
+    void add_ref() { refs_++; }
+    /**
+     * @brief Drop a reference to the leaf.
+     *
+     * @return True if the dropped reference was the last one.
+     */
+    bool drop_ref() {
+        if (refs_ == 0) {
+            return true;
+        }
+        refs_--;
+        return false;
+    }
     /** @brief Getter for number of buffer elements */
     uint16_t buffer_count() const { return buf_.size(); }
     /** @brief Get pointer to the buffer */
@@ -370,22 +396,93 @@ class leaf : uncopyable {
         auto& un_buf = reinterpret_cast<const un_comp_buf&>(buf_);
 #pragma GCC diagnostic pop
         uint32_t count = un_buf.rank(n);
-        uint32_t target_word = n / WORD_BITS;
-        uint32_t target_offset = n % WORD_BITS;
-        if constexpr (avx) {
-            if (target_word) {
-                count += pop::popcnt(data_, target_word * 8);
+        return count + data_rank(n);
+    }
+
+    /**
+     * @brief Value of the i<sup>th</sup> element and the number of 1-bits
+     * before it.
+     *
+     * Equivalent to `at(i)` and `rank(i)` but scans the buffer (or runs) only
+     * once.
+     *
+     * @param i    Index to access.
+     * @param rank Set to \f$\sum_{j = 0}^{i - 1} \mathrm{bv}[j]\f$.
+     *
+     * @return Value of bit at index i.
+     */
+    bool access_rank(uint32_t i, uint32_t& rank) const {
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                return c_access_rank(i, rank);
             }
-        } else {
-            for (uint32_t i = 0; i < target_word; i++) {
-                count += __builtin_popcountll(data_[i]);
+        }
+#pragma GCC diagnostic ignored "-Wstrict-aliasing"
+        auto& un_buf = reinterpret_cast<const un_comp_buf&>(buf_);
+#pragma GCC diagnostic pop
+        bool v = false;
+        bool found = false;
+        rank = un_buf.access_rank(i, v, found);
+        rank += data_rank(i);
+        if (found) {
+            [[unlikely]] return v;
+        }
+        return MASK & (data_[i / WORD_BITS] >> (i % WORD_BITS));
+    }
+
+    /**
+     * @brief Number of 1-bits up to each of a sorted sequence of positions.
+     *
+     * Since the data index corresponding to a logical position is
+     * non-decreasing, the population count is maintained incrementally and
+     * only the words between consecutive queries are counted.
+     *
+     * @tparam dtype Integer type used for indexing by the caller.
+     *
+     * @param indexes Non-decreasing query positions.
+     * @param n       Number of queries.
+     * @param out     Output array for `n` results.
+     * @param offset  Value to subtract from `indexes` to get local positions.
+     * @param base    Value to add to each result.
+     */
+    template <class dtype>
+    void rank_batch(const dtype* indexes, dtype n, dtype* out, dtype offset,
+                    dtype base) const {
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                for (dtype i = 0; i < n; i++) {
+                    out[i] = base + c_rank(indexes[i] - offset);
+                }
+                return;
             }
         }
-        if (target_offset != 0) {
-            count += __builtin_popcountll(data_[target_word] &
-                                          ((MASK << target_offset) - 1));
+#pragma GCC diagnostic ignored "-Wstrict-aliasing"
+        auto& un_buf = reinterpret_cast<const un_comp_buf&>(buf_);
+#pragma GCC diagnostic pop
+        uint32_t word = 0;
+        uint32_t count = 0;
+        for (dtype i = 0; i < n; i++) {
+            uint32_t index = indexes[i] - offset;
+            uint32_t b_count = un_buf.rank(index);
+            uint32_t target_word = index / WORD_BITS;
+            uint32_t target_offset = index % WORD_BITS;
+            if constexpr (avx) {
+                if (target_word > word) {
+                    count += pop::popcnt(data_ + word, (target_word - word) * 8);
+                }
+            } else {
+                for (; word < target_word; word++) {
+                    count += __builtin_popcountll(data_[word]);
+                }
+            }
+            word = target_word;
+            uint32_t res = count + b_count;
+            if (target_offset != 0) {
+                res += __builtin_popcountll(data_[target_word] &
+                                            ((MASK << target_offset) - 1));
+            }
+            out[i] = base + res;
         }
-        return count;
     }
 
     /**
@@ -410,21 +507,13 @@ class leaf : uncopyable {
         if (buf_.size() == 0) {
             return unb_select(x);
         }
-        if constexpr (sorted_buffers == false) {
-#pragma GCC diagnostic ignored "-Wstrict-aliasing"
-            auto& unc_buf = const_cast<buf&>(buf_);
-            unc_buf.sort();
-#pragma GCC diagnostic pop
-        }
         uint32_t pop = 0;
         uint32_t pos = 0;
         uint16_t current_buffer = 0;
         int8_t a_pos_offset = 0;
         int32_t b_index = -100;
 
-#pragma GCC diagnostic ignored "-Wstrict-aliasing"
-        auto& un_buf = reinterpret_cast<const un_comp_buf&>(buf_);
-#pragma GCC diagnostic pop
+        const un_comp_buf& un_buf = sorted_buf();
         // Step one 64-bit word at a time considering the buffer until pop >= x
         for (uint32_t j = 0; j < capacity_; j++) {
             pop += __builtin_popcountll(data_[j]);
@@ -501,6 +590,127 @@ class leaf : uncopyable {
         return ++pos;
     }
 
+    /**
+     * @brief Index of the x<sup>th</sup> 1-bit for each of a sorted sequence of
+     * selection targets.
+     *
+     * The leaf is scanned one data word at a time in segments between buffer
+     * elements, continuing from the word containing the previous answer, so
+     * the whole batch is answered in a single pass over the leaf.
+     *
+     * @tparam dtype Integer type used for indexing by the caller.
+     *
+     * @param xs     Non-decreasing selection targets.
+     * @param n      Number of targets.
+     * @param out    Output array for `n` results.
+     * @param offset Value to subtract from `xs` to get local targets.
+     * @param base   Value to add to each result.
+     */
+    template <class dtype>
+    void select_batch(const dtype* xs, dtype n, dtype* out, dtype offset,
+                      dtype base) const {
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                for (dtype i = 0; i < n; i++) {
+                    out[i] = base + c_select(xs[i] - offset);
+                }
+                return;
+            }
+        }
+        const un_comp_buf& un_buf = sorted_buf();
+        uint16_t b_size = buffer_size != 0 ? un_buf.size() : 0;
+        uint16_t b = 0;
+        uint32_t pos = 0;
+        uint32_t d_pos = 0;
+        uint32_t pop = 0;
+        for (dtype i = 0; i < n; i++) {
+            uint32_t x = xs[i] - offset;
+            while (true) {
+                uint32_t seg_end = b < b_size ? un_buf[b].index() : size_;
+                if (pos < seg_end) {
+                    uint32_t bits = WORD_BITS - d_pos % WORD_BITS;
+                    bits = bits < seg_end - pos ? bits : seg_end - pos;
+                    uint64_t word =
+                        data_[d_pos / WORD_BITS] >> (d_pos % WORD_BITS);
+                    word &= bits < WORD_BITS ? (MASK << bits) - 1 : ~uint64_t(0);
+                    uint32_t w_pop = __builtin_popcountll(word);
+                    if (pop + w_pop >= x) {
+                        out[i] = base + pos +
+                                 __builtin_ctzll(_pdep_u64(
+                                     uint64_t(1) << (x - pop - 1), word));
+                        [[unlikely]] break;
+                    }
+                    pop += w_pop;
+                    pos += bits;
+                    d_pos += bits;
+                    continue;
+                }
+                assert(b < b_size);
+                if (un_buf[b].is_insertion()) {
+                    if (un_buf[b].value()) {
+                        if (pop + 1 >= x) {
+                            out[i] = base + pos;
+                            [[unlikely]] break;
+                        }
+                        pop++;
+                    }
+                    pos++;
+                } else {
+                    d_pos++;
+                }
+                b++;
+            }
+        }
+    }
+
+    /**
+     * @brief Index of the x<sup>th</sup> 0-bit in the data structure
+     *
+     * Counterpart of `select` for 0-bits. Linear in the leaf size.
+     *
+     * @param x Selection target.
+     *
+     * @return \f$\underset{i \in [0..n)}{\mathrm{arg min}}\left(\sum_{j = 0}^i
+     * (1 - \mathrm{bv}[j])\right) = x\f$.
+     */
+    uint32_t select0(uint32_t x) const {
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                return c_select0(x);
+            }
+        }
+        if constexpr (buffer_size == 0) {
+            return unb_select0(x);
+        }
+        if (buf_.size() == 0) {
+            return unb_select0(x);
+        }
+        const un_comp_buf& un_buf = sorted_buf();
+        // Data bits are read in segments between buffer elements.
+        uint32_t pos = 0;
+        uint32_t d_pos = 0;
+        for (uint16_t b = 0; b < un_buf.size(); b++) {
+            uint32_t seg = un_buf[b].index() - pos;
+            uint32_t offset = segment_select0(d_pos, seg, x);
+            if (offset < seg) {
+                return pos + offset;
+            }
+            pos += seg;
+            d_pos += seg;
+            if (un_buf[b].is_insertion()) {
+                if (!un_buf[b].value()) {
+                    if (--x == 0) {
+                        return pos;
+                    }
+                }
+                pos++;
+            } else {
+                d_pos++;
+            }
+        }
+        return pos + segment_select0(d_pos, size_ - pos, x);
+    }
+
     /**
      * @brief Size of the leaf and associated data in bits.
      */
@@ -1123,6 +1333,123 @@ class leaf : uncopyable {
         p_sum_ += o_p_sum;
     }
 
+    /**
+     * @brief Fill an empty leaf with "elems" bits from a packed word array.
+     *
+     * Intended for bulk construction where the contents of the leaf are known
+     * beforehand. Bit `j` of the leaf will be set to bit `offset + j` of
+     * `words`.
+     *
+     * **Will not** ensure sufficient capacity. The leaf is assumed to be empty
+     * with zeroed data, as after allocation.
+     *
+     * Compressed leaves are run length encoded if the encoding is expected to
+     * be beneficial.
+     *
+     * @param words  Source data.
+     * @param offset Index of the first bit in `words` to copy.
+     * @param elems  Number of bits to copy.
+     */
+    void assign(const uint64_t* words, uint64_t offset, uint32_t elems) {
+        assert(size_ == 0);
+        assert(buf_.size() == 0);
+        assert(elems <= capacity_ * WORD_BITS);
+        const uint64_t* source = words + offset / WORD_BITS;
+        uint32_t shift = offset % WORD_BITS;
+        uint32_t copy_words = elems / WORD_BITS;
+        uint32_t overhang = elems % WORD_BITS;
+        if (shift == 0) {
+            memcpy(data_, source, copy_words * sizeof(uint64_t));
+            if (overhang != 0) {
+                [[likely]] data_[copy_words] =
+                    source[copy_words] & ((MASK << overhang) - 1);
+            }
+        } else {
+            for (uint32_t i = 0; i < copy_words; i++) {
+                data_[i] = source[i] >> shift;
+                data_[i] |= source[i + 1] << (WORD_BITS - shift);
+            }
+            if (overhang != 0) {
+                uint64_t w = source[copy_words] >> shift;
+                if (overhang > WORD_BITS - shift) {
+                    w |= source[copy_words + 1] << (WORD_BITS - shift);
+                }
+                [[likely]] data_[copy_words] = w & ((MASK << overhang) - 1);
+            }
+        }
+        uint32_t used_words = copy_words + (overhang ? 1 : 0);
+        if constexpr (avx) {
+            p_sum_ = used_words ? pop::popcnt(data_, used_words * 8) : 0;
+        } else {
+            p_sum_ = 0;
+            for (uint32_t i = 0; i < used_words; i++) {
+                p_sum_ += __builtin_popcountll(data_[i]);
+            }
+        }
+        size_ = elems;
+        if constexpr (compressed) {
+            if (size_ > 0) {
+                c_rle_check_convert();
+            }
+        }
+    }
+
+    /**
+     * @brief Remove elements in the \f$[\mathrm{begin}, \mathrm{end})\f$
+     * range from the leaf.
+     *
+     * The buffer is committed, after which the elements following the range
+     * are shifted a word at a time. Linear in the leaf size instead of the
+     * number of elements removed.
+     *
+     * Only supported for uncompressed leaves.
+     *
+     * Will update size and p_sum.
+     *
+     * @param begin Index of the first element to remove.
+     * @param end   Index following the last element to remove.
+     */
+    void remove_range(uint32_t begin, uint32_t end) {
+        if constexpr (compressed) {
+            assert(!is_compressed());
+        }
+        assert(begin <= end && end <= size_);
+        commit<false>();
+        if (begin == 0) {
+            clear_first(end);
+            return;
+        }
+        if (end == size_) {
+            clear_last(size_ - begin);
+            return;
+        }
+        p_sum_ -= rank(end) - rank(begin);
+        uint32_t shift = end - begin;
+        uint32_t n_size = size_ - shift;
+        uint32_t b_word = begin / WORD_BITS;
+        uint64_t keep = data_[b_word] & ((MASK << (begin % WORD_BITS)) - 1);
+        for (uint32_t pos = b_word * WORD_BITS; pos < n_size; pos += WORD_BITS) {
+            uint32_t s_pos = pos + shift;
+            uint32_t s_word = s_pos / WORD_BITS;
+            uint32_t s_offset = s_pos % WORD_BITS;
+            uint64_t word = data_[s_word] >> s_offset;
+            if (s_offset != 0 && s_word + 1u < capacity_) {
+                word |= data_[s_word + 1] << (WORD_BITS - s_offset);
+            }
+            data_[pos / WORD_BITS] = word;
+        }
+        data_[b_word] = (data_[b_word] & ~((MASK << (begin % WORD_BITS)) - 1)) | keep;
+        // Clear the shifted out elements.
+        uint32_t e_word = n_size / WORD_BITS;
+        if (n_size % WORD_BITS) {
+            data_[e_word++] &= (MASK << (n_size % WORD_BITS)) - 1;
+        }
+        for (; e_word * WORD_BITS < size_; e_word++) {
+            data_[e_word] = 0;
+        }
+        size_ = n_size;
+    }
+
     void flush() {
         if constexpr (compressed) {
             if (is_compressed()) {
@@ -1166,6 +1493,366 @@ class leaf : uncopyable {
         return start + size_;
     }
 
+    /**
+     * @brief Write the logical content of the leaf to `target`.
+     *
+     * Unlike `dump`, this does not commit the buffer or modify the leaf in
+     * any way, so it can be used for read-only traversal. Buffered operations
+     * are merged with the data (or runs, for compressed leaves) on the fly.
+     *
+     * @param target Array of at least \f$\lceil \mathrm{size} / 64\rceil\f$
+     *               words. Will be overwritten.
+     *
+     * @return Number of bits written.
+     */
+    uint32_t decode(uint64_t* target) const { return decode(target, 0, size_); }
+
+    /**
+     * @brief Write the logical bits in \f$[\mathrm{begin}, \mathrm{begin} +
+     * \mathrm{len})\f$ to the start of `target`.
+     *
+     * For uncompressed leaves, the data position corresponding to `begin` is
+     * found from the buffer, after which only the requested data words are
+     * read.
+     *
+     * @param target Array of at least \f$\lceil \mathrm{len} / 64\rceil\f$
+     *               words. Will be overwritten.
+     * @param begin  First logical position to write.
+     * @param len    Number of bits to write. `begin + len <= size`.
+     *
+     * @return Number of bits written.
+     */
+    uint32_t decode(uint64_t* target, uint32_t begin, uint32_t len) const {
+        assert(begin + len <= size_);
+        uint32_t end = begin + len;
+        for (uint32_t i = 0; i * WORD_BITS < len; i++) {
+            target[i] = 0;
+        }
+        uint32_t t_pos = begin;
+        // Emit the lowest `n` bits of `bits` as logical positions
+        // [t_pos, t_pos + n). 0 < n <= 64. Callers never straddle `begin`.
+        auto emit = [&](uint64_t bits, uint32_t n) {
+            if (t_pos < begin) {
+                t_pos += n;
+                [[unlikely]] return;
+            }
+            if (t_pos + n > end) {
+                n = end - t_pos;
+                bits &= (MASK << n) - 1;
+            }
+            uint32_t o = t_pos - begin;
+            uint32_t t_offset = o % WORD_BITS;
+            target[o / WORD_BITS] |= bits << t_offset;
+            if (t_offset + n > WORD_BITS) {
+                target[o / WORD_BITS + 1] |= bits >> (WORD_BITS - t_offset);
+            }
+            t_pos += n;
+        };
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                bool val = type_info_ & C_ONE_MASK;
+                uint8_t* data = reinterpret_cast<uint8_t*>(data_);
+                uint16_t b = 0;
+                t_pos = 0;
+                for (uint32_t d_idx = 0; d_idx < run_index_ && t_pos < end;
+                     d_idx++) {
+                    uint32_t rl = 0;
+                    if ((data[d_idx] & 0b11000000) == 0b11000000) {
+                        rl = data[d_idx] & 0b00111111;
+                    } else if ((data[d_idx] >> 7) == 0) {
+                        rl = data[d_idx++];
+                        rl = (rl << 8) | data[d_idx++];
+                        rl = (rl << 8) | data[d_idx++];
+                        rl = (rl << 8) | data[d_idx];
+                    } else {
+                        rl = data[d_idx++] & 0b00011111;
+                        rl = (rl << 8) | data[d_idx];
+                        if ((data[d_idx - 1] & 0b10100000) == 0b10100000) {
+                            rl = (rl << 8) | data[++d_idx];
+                        }
+                    }
+                    while (rl > 0 && t_pos < end) {
+                        uint32_t e = b < buf_.size() ? buf_[b].index() : size_;
+                        if (e == t_pos) {
+                            [[unlikely]] emit(buf_[b++].value(), 1);
+                            continue;
+                        }
+                        uint32_t r_len = e - t_pos < rl ? e - t_pos : rl;
+                        if (t_pos < begin) {
+                            // Skip run prefix outside the requested range.
+                            r_len = begin - t_pos < r_len ? begin - t_pos
+                                                          : r_len;
+                            t_pos += r_len;
+                            rl -= r_len;
+                            continue;
+                        }
+                        r_len = r_len < WORD_BITS ? r_len : WORD_BITS;
+                        uint64_t bits = r_len < WORD_BITS
+                                            ? (MASK << r_len) - 1
+                                            : ~uint64_t(0);
+                        emit(val ? bits : 0, r_len);
+                        rl -= r_len;
+                    }
+                    val = !val;
+                }
+                for (; b < buf_.size() && t_pos < end; b++) {
+                    emit(buf_[b].value(), 1);
+                }
+                return len;
+            }
+        }
+        const un_comp_buf& un_buf = sorted_buf();
+        uint16_t b_size = buffer_size != 0 ? un_buf.size() : 0;
+        uint16_t b = 0;
+        uint32_t d_pos = begin;
+        for (; b < b_size && un_buf[b].index() < begin; b++) {
+            d_pos += un_buf[b].is_insertion() ? -1 : 1;
+        }
+        while (t_pos < end) {
+            uint32_t e = b < b_size ? un_buf[b].index() : size_;
+            if (e == t_pos) {
+                if (un_buf[b].is_insertion()) {
+                    emit(un_buf[b].value(), 1);
+                } else {
+                    d_pos++;
+                }
+                b++;
+                [[unlikely]] continue;
+            }
+            uint32_t d_len = WORD_BITS - d_pos % WORD_BITS;
+            d_len = d_len < e - t_pos ? d_len : e - t_pos;
+            uint64_t bits = data_[d_pos / WORD_BITS] >> (d_pos % WORD_BITS);
+            bits &= d_len < WORD_BITS ? (MASK << d_len) - 1 : ~uint64_t(0);
+            emit(bits, d_len);
+            d_pos += d_len;
+        }
+        return len;
+    }
+
+    /**
+     * @brief Read `width` consecutive bits starting at `index`.
+     *
+     * The bit at `index` is the least significant bit of the result.
+     *
+     * @param index Logical position of the first bit.
+     * @param width Number of bits to read. In \f$[1, 64]\f$ and
+     *              `index + width <= size`.
+     *
+     * @return The requested bits packed into a word.
+     */
+    uint64_t get_bits(uint32_t index, uint16_t width) const {
+        assert(width > 0 && width <= WORD_BITS);
+        assert(index + width <= size_);
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                uint64_t ret;
+                decode(&ret, index, width);
+                return ret;
+            }
+        }
+        if constexpr (buffer_size != 0) {
+            if (buf_.size() != 0) {
+                uint64_t ret;
+                decode(&ret, index, width);
+                [[unlikely]] return ret;
+            }
+        }
+        uint32_t word = index / WORD_BITS;
+        uint32_t offset = index % WORD_BITS;
+        uint64_t ret = data_[word] >> offset;
+        if (offset + width > WORD_BITS) {
+            ret |= data_[word + 1] << (WORD_BITS - offset);
+        }
+        return width < WORD_BITS ? ret & ((MASK << width) - 1) : ret;
+    }
+
+    /**
+     * @brief Write the leaf to `out` in binary form.
+     *
+     * Writes the capacity, metadata, raw buffer content and the used part of
+     * the data array as is, so compressed leaves are stored in their run
+     * length encoded form. The format uses native byte order.
+     *
+     * @param out Stream to write to.
+     */
+    void serialize(std::ostream& out) const {
+        out.write(reinterpret_cast<const char*>(&capacity_), sizeof(capacity_));
+        out.write(reinterpret_cast<const char*>(&type_info_),
+                  sizeof(type_info_));
+        out.write(reinterpret_cast<const char*>(&size_), sizeof(size_));
+        out.write(reinterpret_cast<const char*>(&p_sum_), sizeof(p_sum_));
+        out.write(reinterpret_cast<const char*>(&run_index_),
+                  sizeof(run_index_));
+        out.write(reinterpret_cast<const char*>(&buf_), sizeof(buf));
+        uint32_t words = used_words();
+        out.write(reinterpret_cast<const char*>(&words), sizeof(words));
+        out.write(reinterpret_cast<const char*>(data_),
+                  words * sizeof(uint64_t));
+    }
+
+    /**
+     * @brief Read a leaf written by `serialize` from `in`.
+     *
+     * The leaf is allocated with the same capacity as the serialized leaf.
+     * Capacity, size, buffer and data length are checked against the
+     * template bounds and each other, and the leaf is rejected if they are
+     * inconsistent.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param in    Stream to read from.
+     * @param alloc Allocator to use for allocating the leaf.
+     *
+     * @return Pointer to the loaded leaf or `nullptr` if reading failed.
+     */
+    template <class allocator>
+    static leaf* load(std::istream& in, allocator* alloc) {
+        uint16_t cap = 0;
+        in.read(reinterpret_cast<char*>(&cap), sizeof(cap));
+        if (!in || cap == 0 || cap > init_capacity(leaf_size)) {
+            [[unlikely]] return nullptr;
+        }
+        leaf* l = alloc->template allocate_leaf<leaf>(cap);
+        in.read(reinterpret_cast<char*>(&l->type_info_), sizeof(type_info_));
+        in.read(reinterpret_cast<char*>(&l->size_), sizeof(size_));
+        in.read(reinterpret_cast<char*>(&l->p_sum_), sizeof(p_sum_));
+        in.read(reinterpret_cast<char*>(&l->run_index_), sizeof(run_index_));
+#pragma GCC diagnostic ignored "-Wclass-memaccess"
+        in.read(reinterpret_cast<char*>(&l->buf_), sizeof(buf));
+#pragma GCC diagnostic pop
+        uint32_t words = 0;
+        in.read(reinterpret_cast<char*>(&words), sizeof(words));
+        if (!in || words > cap || !l->metadata_valid() ||
+            words != l->used_words()) {
+            alloc->deallocate_leaf(l);
+            [[unlikely]] return nullptr;
+        }
+        in.read(reinterpret_cast<char*>(l->data_), words * sizeof(uint64_t));
+        if (!in) {
+            alloc->deallocate_leaf(l);
+            [[unlikely]] return nullptr;
+        }
+        return l;
+    }
+
+    /**
+     * @brief Allocate a copy of this leaf with the same capacity.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param alloc Allocator to use for allocating the copy.
+     */
+    template <class allocator>
+    leaf* clone(allocator* alloc) const {
+        leaf* l = alloc->template allocate_leaf<leaf>(capacity_);
+        l->type_info_ = type_info_;
+        l->size_ = size_;
+        l->p_sum_ = p_sum_;
+        l->run_index_ = run_index_;
+#pragma GCC diagnostic ignored "-Wclass-memaccess"
+        memcpy(&l->buf_, &buf_, sizeof(buf));
+#pragma GCC diagnostic pop
+        memcpy(l->data_, data_, capacity_ * sizeof(uint64_t));
+        return l;
+    }
+
+    /**
+     * @brief Number of bytes in the leaf object part of a memory-mapped leaf
+     * record.
+     */
+    static constexpr uint64_t mapped_header_bytes() {
+        return (sizeof(leaf) + sizeof(uint64_t) - 1) / sizeof(uint64_t) *
+               sizeof(uint64_t);
+    }
+
+    /**
+     * @brief Number of bytes used by the leaf in the memory-mapped format.
+     *
+     * The record consists of the leaf object followed by the data words in
+     * use and one extra word, padded to a multiple of `CACHE_LINE` bytes.
+     */
+    uint64_t mapped_bytes() const {
+        uint64_t bytes =
+            mapped_header_bytes() + mapped_words() * sizeof(uint64_t);
+        return (bytes + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    }
+
+    /**
+     * @brief Write the leaf to `out` in the memory-mapped format.
+     *
+     * The leaf object is written as is, with the capacity reduced to the
+     * number of data words written and the data pointer cleared, followed by
+     * the data words in use and one extra word. Buffers and run-length
+     * encoding are kept, so that the regular query functions can be used on
+     * the mapped record.
+     *
+     * @param out Stream to write to.
+     */
+    void write_mapped(std::ostream& out) const {
+        static const char zeros[CACHE_LINE] = {};
+        alignas(leaf) uint8_t record[mapped_header_bytes()] = {};
+        memcpy(record, static_cast<const void*>(this), sizeof(leaf));
+        leaf* l = reinterpret_cast<leaf*>(record);
+        uint32_t words = mapped_words();
+        l->capacity_ = words;
+        l->refs_ = 0;
+        l->data_ = nullptr;
+        out.write(reinterpret_cast<const char*>(record), sizeof(record));
+        out.write(reinterpret_cast<const char*>(data_),
+                  words * sizeof(uint64_t));
+        out.write(zeros,
+                  mapped_bytes() - sizeof(record) - words * sizeof(uint64_t));
+    }
+
+    /**
+     * @brief Set up a read-only leaf for a record written by `write_mapped`.
+     *
+     * The leaf object is copied from the record to `space` and pointed at the
+     * data words in the record. No memory is allocated and the data words are
+     * not copied.
+     *
+     * Only const query functions may be used on the returned leaf.
+     *
+     * @param record Start of the leaf record in mapped memory.
+     * @param space  At least `sizeof(leaf)` bytes suitably aligned for a leaf.
+     *
+     * @return Pointer to the leaf in `space`.
+     */
+    static const leaf* map(const uint8_t* record, void* space) {
+        memcpy(space, record, sizeof(leaf));
+        leaf* l = reinterpret_cast<leaf*>(space);
+        l->data_ = reinterpret_cast<uint64_t*>(
+            const_cast<uint8_t*>(record + mapped_header_bytes()));
+        return l;
+    }
+
+    /**
+     * @brief Check that a leaf record fits in the mapping.
+     *
+     * Intended for validating untrusted mapped data before querying it.
+     *
+     * @param record Start of the leaf record in mapped memory.
+     * @param bytes  Number of mapped bytes available from `record`.
+     * @param size   Set to the number of bits in the leaf.
+     * @param sum    Set to the number of 1-bits in the leaf.
+     *
+     * @return True if the record and its data words are within `bytes` and
+     * the leaf metadata is consistent.
+     */
+    static bool mapped_valid(const uint8_t* record, uint64_t bytes,
+                             uint64_t& size, uint64_t& sum) {
+        if (bytes < mapped_header_bytes()) {
+            [[unlikely]] return false;
+        }
+        alignas(leaf) uint8_t space[sizeof(leaf)];
+        const leaf* l = map(record, space);
+        size = l->size_;
+        sum = l->p_sum_;
+        return l->capacity_ * sizeof(uint64_t) <=
+                   bytes - mapped_header_bytes() &&
+               l->metadata_valid();
+    }
+
     bool is_compressed() const {
         if constexpr (compressed) {
             return type_info_ & C_TYPE_MASK;
@@ -1312,6 +1999,23 @@ class leaf : uncopyable {
     }
 
    private:
+    /**
+     * @brief Buffer of an uncompressed leaf, sorted by index.
+     *
+     * Unsorted buffers are sorted into per-thread scratch space, so that
+     * const queries never modify leaves that may be read concurrently.
+     */
+    const un_comp_buf& sorted_buf() const {
+#pragma GCC diagnostic ignored "-Wstrict-aliasing"
+        auto& un_buf = reinterpret_cast<const un_comp_buf&>(buf_);
+#pragma GCC diagnostic pop
+        if constexpr (sorted_buffers == false) {
+            un_buf.sort_to(sort_scratch);
+            return sort_scratch;
+        }
+        return un_buf;
+    }
+
     /**
      * @brief Add an element to the end of the leaf data.
      *
@@ -1351,6 +2055,104 @@ class leaf : uncopyable {
         p_sum_ += uint64_t(x);
     }
 
+    /**
+     * @brief Number of words of the data array that contain information.
+     *
+     * For compressed leaves this is the space used by runs. Otherwise this is
+     * the space used by data bits, accounting for buffered operations.
+     */
+    uint32_t used_words() const {
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                return (run_index_ + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+            }
+        }
+        uint32_t bits = size_;
+        if constexpr (buffer_size != 0) {
+#pragma GCC diagnostic ignored "-Wstrict-aliasing"
+            auto& un_buf = reinterpret_cast<const un_comp_buf&>(buf_);
+#pragma GCC diagnostic pop
+            for (uint16_t i = 0; i < un_buf.size(); i++) {
+                bits += un_buf[i].is_insertion() ? -1 : 1;
+            }
+        }
+        uint32_t words = (bits + WORD_BITS - 1) / WORD_BITS;
+        return words < capacity_ ? words : capacity_;
+    }
+
+    /**
+     * @brief Check that the metadata of a deserialized or mapped leaf is
+     * consistent with its capacity.
+     *
+     * Data words are not inspected.
+     *
+     * @return True if size, sum, buffer and run index fit the template bounds
+     * and the data stored fits in `capacity_` words.
+     */
+    bool metadata_valid() const {
+        if (p_sum_ > size_ || buf_.size() > buf::max_elems()) {
+            return false;
+        }
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                return run_index_ <= capacity_ * sizeof(uint64_t);
+            }
+        } else {
+            if (size_ > leaf_size) {
+                return false;
+            }
+        }
+        int64_t bits = size_;
+        if constexpr (buffer_size != 0) {
+#pragma GCC diagnostic ignored "-Wstrict-aliasing"
+            auto& un_buf = reinterpret_cast<const un_comp_buf&>(buf_);
+#pragma GCC diagnostic pop
+            for (uint16_t i = 0; i < un_buf.size(); i++) {
+                if (un_buf[i].index() > size_) {
+                    return false;
+                }
+                bits += un_buf[i].is_insertion() ? -1 : 1;
+            }
+        }
+        return bits >= 0 && uint64_t(bits) <= capacity_ * WORD_BITS;
+    }
+
+    /**
+     * @brief Number of data words written in the memory-mapped format.
+     *
+     * Select on buffered leaves scans one word past the data bits when the
+     * target is a buffered insertion at the end of the leaf.
+     */
+    uint32_t mapped_words() const {
+        uint32_t words = used_words() + 1;
+        return words < capacity_ ? words : capacity_;
+    }
+
+    /**
+     * @brief Number of 1-bits in the first `n` bits of the data array.
+     *
+     * Does not account for buffered operations.
+     */
+    uint32_t data_rank(uint32_t n) const {
+        uint32_t count = 0;
+        uint32_t target_word = n / WORD_BITS;
+        uint32_t target_offset = n % WORD_BITS;
+        if constexpr (avx) {
+            if (target_word) {
+                count += pop::popcnt(data_, target_word * 8);
+            }
+        } else {
+            for (uint32_t i = 0; i < target_word; i++) {
+                count += __builtin_popcountll(data_[i]);
+            }
+        }
+        if (target_offset != 0) {
+            count += __builtin_popcountll(data_[target_word] &
+                                          ((MASK << target_offset) - 1));
+        }
+        return count;
+    }
+
     uint32_t unb_select(uint32_t x) const {
         uint32_t pop = 0;
         uint32_t pos = 0;
@@ -1372,6 +2174,59 @@ class leaf : uncopyable {
         return pos + 63 - __builtin_clzll(_pdep_u64(add_loc, data_[j]));
     }
 
+    uint32_t unb_select0(uint32_t x) const {
+        uint32_t pop = 0;
+        uint32_t pos = 0;
+        uint32_t prev_pop = 0;
+        uint32_t j = 0;
+
+        // Step one 64-bit word at a time until pop >= x
+        for (; j < capacity_; j++) {
+            prev_pop = pop;
+            pop += __builtin_popcountll(~data_[j]);
+            pos += WORD_BITS;
+            if (pop >= x) {
+                [[unlikely]] break;
+            }
+        }
+        pos -= WORD_BITS;
+        uint64_t add_loc = x - prev_pop - 1;
+        add_loc = uint64_t(1) << add_loc;
+        return pos + 63 - __builtin_clzll(_pdep_u64(add_loc, ~data_[j]));
+    }
+
+    /**
+     * @brief Find the x<sup>th</sup> 0-bit in a segment of the data array.
+     *
+     * Used for select0 when buffered operations need to be accounted for.
+     *
+     * @param start Index of the first data bit in the segment.
+     * @param len   Length of the segment.
+     * @param x     Selection target. Decremented by the number of 0-bits in the
+     *              segment if the target is not in the segment.
+     *
+     * @return Offset of the x<sup>th</sup> 0-bit from `start` or `len` if the
+     * segment contains fewer than x 0-bits.
+     */
+    uint32_t segment_select0(uint32_t start, uint32_t len, uint32_t& x) const {
+        uint32_t offset = 0;
+        while (offset < len) {
+            uint32_t idx = start + offset;
+            uint32_t bits = WORD_BITS - idx % WORD_BITS;
+            bits = bits < len - offset ? bits : len - offset;
+            uint64_t word = ~data_[idx / WORD_BITS] >> (idx % WORD_BITS);
+            word &= bits < WORD_BITS ? (MASK << bits) - 1 : ~uint64_t(0);
+            uint32_t pop = __builtin_popcountll(word);
+            if (pop >= x) {
+                [[unlikely]] return offset + __builtin_ctzll(_pdep_u64(
+                                                 uint64_t(1) << (x - 1), word));
+            }
+            x -= pop;
+            offset += bits;
+        }
+        return len;
+    }
+
     /**
      * @brief Commit and clear the Insert/Remove buffer for the leaf.
      *
@@ -1621,6 +2476,40 @@ class leaf : uncopyable {
         return count;
     }
 
+    bool c_access_rank(uint32_t i, uint32_t& rank) const {
+        bool v = false;
+        bool found = false;
+        rank = buf_.access_rank(i, v, found);
+        bool val = type_info_ & C_ONE_MASK;
+        uint32_t c_i = 0;
+        uint8_t* data = reinterpret_cast<uint8_t*>(data_);
+        for (uint32_t d_idx = 0; d_idx < run_index_; d_idx++) {
+            uint32_t rl = 0;
+            if ((data[d_idx] & 0b11000000) == 0b11000000) {
+                rl = data[d_idx] & 0b00111111;
+            } else if ((data[d_idx] >> 7) == 0) {
+                rl = data[d_idx++];
+                rl = (rl << 8) | data[d_idx++];
+                rl = (rl << 8) | data[d_idx++];
+                rl = (rl << 8) | data[d_idx];
+            } else {
+                rl = data[d_idx++] & 0b00011111;
+                rl = (rl << 8) | data[d_idx];
+                if ((data[d_idx - 1] & 0b10100000) == 0b10100000) {
+                    rl = (rl << 8) | data[++d_idx];
+                }
+            }
+            if (c_i + rl > i) {
+                rank += val * (i - c_i);
+                break;
+            }
+            c_i += rl;
+            rank += rl * val;
+            val = !val;
+        }
+        return found ? v : val;
+    }
+
     uint32_t c_select(uint32_t x) const {
         // std::cout << "c_select(" << x << ") called" << std::endl;
         bool val = type_info_ & C_ONE_MASK;
@@ -1687,6 +2576,63 @@ class leaf : uncopyable {
         return --c_i;
     }
 
+    uint32_t c_select0(uint32_t x) const {
+        bool val = type_info_ & C_ONE_MASK;
+        uint8_t* data = reinterpret_cast<uint8_t*>(data_);
+        uint16_t b_idx = 0;
+        uint32_t c_i = 0;
+        uint32_t count = 0;
+        uint32_t d_idx = 0;
+        while (d_idx < run_index_) {
+            uint32_t rl = 0;
+            if ((data[d_idx] & 0b11000000) == 0b11000000) {
+                rl = data[d_idx++] & 0b00111111;
+            } else if ((data[d_idx] >> 7) == 0) {
+                rl = data[d_idx++] << 24;
+                rl |= data[d_idx++] << 16;
+                rl |= data[d_idx++] << 8;
+                rl |= data[d_idx++];
+            } else if ((data[d_idx] & 0b10100000) == 0b10100000) {
+                rl = (data[d_idx++] & 0b00011111) << 16;
+                rl |= data[d_idx++] << 8;
+                rl |= data[d_idx++];
+            } else {
+                rl = (data[d_idx++] & 0b00011111) << 8;
+                rl |= data[d_idx++];
+            }
+            // Buffer elements are at their final positions, so they split the
+            // run into segments.
+            while (b_idx < buf_.size() && buf_[b_idx].index() < c_i + rl) {
+                uint32_t seg = buf_[b_idx].index() - c_i;
+                if (!val && count + seg >= x) {
+                    return c_i + x - count - 1;
+                }
+                count += val ? 0 : seg;
+                c_i += seg;
+                rl -= seg;
+                if (!buf_[b_idx].value() && ++count == x) {
+                    return c_i;
+                }
+                c_i++;
+                b_idx++;
+                [[unlikely]] (void(0));
+            }
+            if (!val && count + rl >= x) {
+                return c_i + x - count - 1;
+            }
+            count += val ? 0 : rl;
+            c_i += rl;
+            val = !val;
+        }
+        for (; b_idx < buf_.size(); b_idx++) {
+            if (!buf_[b_idx].value() && ++count == x) {
+                break;
+            }
+            c_i++;
+        }
+        return c_i;
+    }
+
     void c_append(leaf* other, uint32_t elems) {
         uint32_t copied = 0;
         bool val = other->first_value();
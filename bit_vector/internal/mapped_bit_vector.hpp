@@ -0,0 +1,287 @@
+#ifndef BV_MAPPED_BIT_VECTOR_HPP
+#define BV_MAPPED_BIT_VECTOR_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+
+#include "uncopyable.hpp"
+
+namespace bv {
+
+/**
+ * @brief Read-only view of a bit vector in the memory-mapped format.
+ *
+ * The file is written with `bv::bit_vector::write_mapped` and consists of a
+ * header page followed by node and leaf records, each aligned to `CACHE_LINE`
+ * bytes:
+ *
+ * - Node records hold the cumulative size and sum arrays exactly as stored in
+ *   bv::node, followed by byte offsets of the children. Branch selection uses
+ *   `branchless_scan::find` directly on the mapped arrays.
+ * - Leaf records hold the leaf object followed by the data words in use.
+ *   Queries copy the leaf object to the stack and point it at the mapped data
+ *   words, so leaf rank and select kernels, including buffered and run-length
+ *   encoded leaves, are used as is.
+ *
+ * Views are attached with `init`, which bounds checks every record against
+ * the mapping and rejects data that is truncated or not written for this bit
+ * vector type. Data words themselves are not inspected.
+ *
+ * Queries do no heap allocation and do not copy data words. The format uses
+ * native byte order and is only intended to be read by a view of the same bit
+ * vector type.
+ *
+ * @tparam leaf_type Leaf type of the bit vector. Some kind of bv::leaf.
+ * @tparam node_type Node type of the bit vector. Some kind of bv::node.
+ * @tparam dtype     Integer type to use for indexing (uint32_t or uint64_t).
+ */
+template <class leaf_type, class node_type, class dtype>
+class mapped_bit_vector : uncopyable {
+   public:
+    /** @brief Size of the header, to keep records page aligned. */
+    static const constexpr uint64_t PAGE_BYTES = 4096;
+
+   private:
+    /** @brief Magic number at the start of the header, "BVMM". */
+    static const constexpr uint64_t MAGIC = 0x4d4d5642;
+    /** @brief Number of 64-bit words in the header. */
+    static const constexpr uint16_t HEADER_WORDS = 9;
+
+    const uint8_t* base_;  ///< Start of the mapped file.
+    uint64_t bytes_;       ///< Size of the mapped file in bytes.
+    const uint8_t* root_;  ///< Start of the root record.
+    bool root_is_leaf_;    ///< True if the root record is a leaf.
+    bool owned_;           ///< True if the mapping is to be unmapped.
+    dtype size_;           ///< Number of bits stored.
+    dtype sum_;            ///< Number of 1-bits stored.
+
+    /**
+     * @brief Check the header and records and set up the view.
+     *
+     * Every record reachable from the root is bounds checked against the
+     * mapping, so that queries never dereference memory outside of it.
+     *
+     * @return False if the data is not in the memory-mapped format for this
+     * bit vector type.
+     */
+    bool setup() {
+        const uint64_t* header = reinterpret_cast<const uint64_t*>(base_);
+        if (reinterpret_cast<uintptr_t>(base_) % sizeof(uint64_t) != 0 ||
+            bytes_ < PAGE_BYTES || header[0] != MAGIC ||
+            header[1] != sizeof(dtype) || header[2] != sizeof(leaf_type) ||
+            header[3] != node_type::mapped_bytes() || header[4] > 1 ||
+            header[8] > bytes_ || header[5] < PAGE_BYTES ||
+            header[5] >= header[8]) {
+            [[unlikely]] return false;
+        }
+        uint64_t size = 0;
+        uint64_t sum = 0;
+        bool valid;
+        if (header[4]) {
+            valid = leaf_type::mapped_valid(base_ + header[5],
+                                            header[8] - header[5], size, sum);
+        } else {
+            valid = node_type::mapped_valid(base_, header[5], header[8], size,
+                                            sum);
+        }
+        if (!valid || size != header[6] || sum != header[7]) {
+            [[unlikely]] return false;
+        }
+        root_is_leaf_ = header[4];
+        root_ = base_ + header[5];
+        size_ = header[6];
+        sum_ = header[7];
+        return true;
+    }
+
+    /**
+     * @brief Unmap owned memory and reset the view to empty.
+     */
+    void release() {
+        if (owned_) {
+            munmap(const_cast<uint8_t*>(base_), bytes_);
+        }
+        base_ = nullptr;
+        bytes_ = 0;
+        root_ = nullptr;
+        root_is_leaf_ = true;
+        owned_ = false;
+        size_ = 0;
+        sum_ = 0;
+    }
+
+   public:
+    /**
+     * @brief Create an empty view.
+     *
+     * Use `init` to attach the view to data in the memory-mapped format.
+     */
+    mapped_bit_vector()
+        : base_(nullptr),
+          bytes_(0),
+          root_(nullptr),
+          root_is_leaf_(true),
+          owned_(false),
+          size_(0),
+          sum_(0) {}
+
+    /**
+     * @brief Attach the view to memory containing the memory-mapped format.
+     *
+     * The memory is not copied and needs to outlive the view.
+     *
+     * @param data  Start of the data. Needs to be aligned to 8 bytes.
+     * @param bytes Size of the data in bytes.
+     *
+     * @return False if the data is not valid for this bit vector type, in
+     * which case the view is left empty.
+     */
+    bool init(const void* data, uint64_t bytes) {
+        release();
+        base_ = reinterpret_cast<const uint8_t*>(data);
+        bytes_ = bytes;
+        if (!setup()) {
+            release();
+            [[unlikely]] return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Map a file in the memory-mapped format read-only and attach the
+     * view to it.
+     *
+     * The file is unmapped when the view is destroyed or attached elsewhere.
+     *
+     * @param path Path of the file to map.
+     *
+     * @return False if the file can not be opened or mapped, or does not
+     * contain valid data for this bit vector type, in which case the view is
+     * left empty.
+     */
+    bool init(const char* path) {
+        release();
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            [[unlikely]] return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            close(fd);
+            [[unlikely]] return false;
+        }
+        void* m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (m == MAP_FAILED) {
+            [[unlikely]] return false;
+        }
+        base_ = reinterpret_cast<const uint8_t*>(m);
+        bytes_ = st.st_size;
+        owned_ = true;
+        if (!setup()) {
+            release();
+            [[unlikely]] return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Unmap the file if it was mapped by the view.
+     */
+    ~mapped_bit_vector() { release(); }
+
+    /**
+     * @brief Write the header page of the memory-mapped format.
+     *
+     * Intended for use by `bv::bit_vector::write_mapped`.
+     *
+     * @param out          Stream to write to.
+     * @param root_is_leaf True if the root record is a leaf.
+     * @param root         Byte offset of the root record.
+     * @param size         Number of bits stored.
+     * @param sum          Number of 1-bits stored.
+     * @param bytes        Total size of the file in bytes.
+     */
+    static void write_header(std::ostream& out, bool root_is_leaf,
+                             uint64_t root, dtype size, dtype sum,
+                             uint64_t bytes) {
+        static_assert(HEADER_WORDS <= PAGE_BYTES / sizeof(uint64_t));
+        uint64_t header[PAGE_BYTES / sizeof(uint64_t)] = {
+            MAGIC,
+            sizeof(dtype),
+            sizeof(leaf_type),
+            node_type::mapped_bytes(),
+            root_is_leaf,
+            root,
+            size,
+            sum,
+            bytes};
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    }
+
+    /**
+     * @brief Access the value of the i<sup>th</sup> element.
+     *
+     * @param i Index to access.
+     */
+    bool at(dtype i) const {
+        assert(i < size_);
+        if (root_is_leaf_) {
+            alignas(leaf_type) uint8_t space[sizeof(leaf_type)];
+            [[unlikely]] return leaf_type::map(root_, space)->at(i);
+        }
+        return node_type::mapped_at(base_, root_, i);
+    }
+
+    /**
+     * @brief Number of 1-bits before position `i`.
+     *
+     * @param i Position in \f$[0, \mathrm{size}]\f$.
+     *
+     * @return \f$\sum_{j = 0}^{i - 1} \mathrm{bv}[j]\f$.
+     */
+    dtype rank(dtype i) const {
+        assert(i <= size_);
+        if (root_is_leaf_) {
+            alignas(leaf_type) uint8_t space[sizeof(leaf_type)];
+            [[unlikely]] return leaf_type::map(root_, space)->rank(i);
+        }
+        return node_type::mapped_rank(base_, root_, i);
+    }
+
+    /**
+     * @brief Position of the x<sup>th</sup> 1-bit.
+     *
+     * @param x Selection target in \f$[1, \mathrm{sum}]\f$.
+     *
+     * @return \f$\underset{i \in [0..n)}{\mathrm{arg min}}\left(\sum_{j = 0}^i
+     * \mathrm{bv}[j]\right) = x\f$.
+     */
+    dtype select(dtype x) const {
+        assert(x > 0 && x <= sum_);
+        if (root_is_leaf_) {
+            alignas(leaf_type) uint8_t space[sizeof(leaf_type)];
+            [[unlikely]] return leaf_type::map(root_, space)->select(x);
+        }
+        return node_type::mapped_select(base_, root_, x);
+    }
+
+    /** @brief Number of bits stored. */
+    dtype size() const { return size_; }
+
+    /** @brief Number of 1-bits stored. */
+    dtype sum() const { return sum_; }
+
+    /** @brief Size of the mapped data in bits. */
+    uint64_t bits_size() const { return bytes_ * 8; }
+};
+
+}  // namespace bv
+
+#endif
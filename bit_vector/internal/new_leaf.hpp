@@ -16,7 +16,7 @@ template <uint16_t buffer_size, uint32_t leaf_size, bool avx = true,
           bool compressed = false, bool sorted_buffers = true>
 class leaf : uncopyable {
    private:
-    inline static uint64_t data_scratch[leaf_size / 64];
+    inline static thread_local uint64_t data_scratch[leaf_size / 64];
     static const constexpr uint32_t LEAF_BYTES =
         sizeof(uint32_t) * 3 +  // size, partial sum and capacity.
         sizeof(uint32_t) *
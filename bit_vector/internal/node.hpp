@@ -4,7 +4,10 @@
 #include <cassert>
 #include <cstdint>
 #include <cstring>
+#include <iostream>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #ifndef CACHE_LINE
 // Apparently the most common cache line size is 64.
@@ -81,7 +84,8 @@ class node : uncopyable {
     /**
      * @brief Number of active children.
      */
-    uint16_t child_count_;  // Bad word alignment. betewen 16 and 48 dead bits...
+    uint16_t child_count_;
+    uint32_t refs_;  ///< References beyond the first, from snapshots.
     /**
      * @brief Cumulative child sizes and `(~0) >> 1` for non-existing children.
      */
@@ -92,9 +96,19 @@ class node : uncopyable {
      */
     branching child_sums_;
     void* children_[branches];  ///< pointers to bv::leaf or bv::node children.
+    /** @brief Per-thread space for decoding leaves in `dump`. */
+    inline static thread_local uint64_t dump_scratch[leaf_size / 64 + 1];
 
     /** @brief Number of bits in a computer word. */
     static const constexpr uint64_t WORD_BITS = 64;
+    /** @brief Offset of cumulative sizes in a memory-mapped node record. */
+    static const constexpr uint64_t MAPPED_SIZES = 8;
+    /** @brief Offset of cumulative sums in a memory-mapped node record. */
+    static const constexpr uint64_t MAPPED_SUMS =
+        MAPPED_SIZES + sizeof(dtype) * branches;
+    /** @brief Offset of child offsets in a memory-mapped node record. */
+    static const constexpr uint64_t MAPPED_CHILDREN =
+        MAPPED_SUMS + sizeof(dtype) * branches;
 
     static_assert(leaf_size >= 256, "leaf size needs to be a at least 256");
     static_assert((leaf_size % 128) == 0,
@@ -106,7 +120,12 @@ class node : uncopyable {
     /**
      * @brief Constructor
      */
-    node() : meta_data_(0), child_count_(0), child_sizes_(), child_sums_() {}
+    node()
+        : meta_data_(0),
+          child_count_(0),
+          refs_(0),
+          child_sizes_(),
+          child_sums_() {}
 
     /**
      * @brief Set whether the children of the node are leaves or internal nodes
@@ -128,6 +147,72 @@ class node : uncopyable {
      */
     bool has_leaves() const { return meta_data_ >> 7; }
 
+    /** @brief Whether the node is referenced by more than one parent. */
+    bool is_shared() const { return refs_ != 0; }
+    /** @brief Add a reference to the node. */
+    void add_ref() { refs_++; }
+    /**
+     * @brief Drop a reference to the node.
+     *
+     * @return True if the dropped reference was the last one.
+     */
+    bool drop_ref() {
+        if (refs_ == 0) {
+            return true;
+        }
+        refs_--;
+        return false;
+    }
+
+    /**
+     * @brief Get a leaf that can be modified in place in place of `l`.
+     *
+     * A leaf shared with snapshots is copied and one reference to it is
+     * dropped.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param l     Leaf about to be modified.
+     * @param alloc Allocator to use for the copy.
+     */
+    template <class allocator>
+    static leaf_type* unshare(leaf_type* l, allocator* alloc) {
+        if (!l->is_shared()) {
+            [[likely]] return l;
+        }
+        leaf_type* copy = l->clone(alloc);
+        l->drop_ref();
+        return copy;
+    }
+
+    /**
+     * @brief Get a node that can be modified in place in place of `n`.
+     *
+     * A node shared with snapshots is copied, references are added to its
+     * children and one reference to it is dropped.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param n     Node about to be modified.
+     * @param alloc Allocator to use for the copy.
+     */
+    template <class allocator>
+    static node* unshare(node* n, allocator* alloc) {
+        if (!n->is_shared()) {
+            [[likely]] return n;
+        }
+        node* copy = n->clone(alloc);
+        for (uint16_t i = 0; i < n->child_count_; i++) {
+            if (n->has_leaves()) {
+                reinterpret_cast<leaf_type*>(n->children_[i])->add_ref();
+            } else {
+                reinterpret_cast<node*>(n->children_[i])->add_ref();
+            }
+        }
+        n->drop_ref();
+        return copy;
+    }
+
     /**
      * @brief Access the value of the index<sup>th</sup> element of the logical
      * structure.
@@ -148,6 +233,80 @@ class node : uncopyable {
         }
     }
 
+    /**
+     * @brief Access the value of the index<sup>th</sup> element and count the
+     * 1-bits before it.
+     *
+     * Recurses to children based on cumulative sizes, as `at` does, adding
+     * the cumulative sums of preceding children to `rank` on the way.
+     *
+     * @param index Index to access.
+     * @param rank  Set to the number of 1-bits before `index`.
+     *
+     * @return Value of the index<sup>th</sup> element.
+     */
+    bool access_rank(dtype index, dtype& rank) const {
+        uint16_t child_index = child_sizes_.find(index + 1);
+        dtype offset = 0;
+        if (child_index != 0) {
+            index -= child_sizes_.get(child_index - 1);
+            [[likely]] offset = child_sums_.get(child_index - 1);
+        }
+        if (has_leaves()) {
+            const leaf_type* child =
+                reinterpret_cast<const leaf_type*>(children_[child_index]);
+            uint32_t l_rank;
+            bool ret = child->access_rank(index, l_rank);
+            rank = offset + l_rank;
+            [[unlikely]] return ret;
+        } else {
+            const node* child =
+                reinterpret_cast<const node*>(children_[child_index]);
+            bool ret = child->access_rank(index, rank);
+            rank += offset;
+            return ret;
+        }
+    }
+
+    /**
+     * @brief Read `width` consecutive bits starting at `index`.
+     *
+     * Recurses to the child containing `index`. If the range continues past
+     * the end of the child, the remaining bits are read from the following
+     * children.
+     *
+     * @param index Position of the first bit.
+     * @param width Number of bits to read. In \f$[1, 64]\f$.
+     *
+     * @return The requested bits packed into a word, with the bit at `index`
+     * as the least significant bit.
+     */
+    uint64_t get_bits(dtype index, uint16_t width) const {
+        uint16_t child_index = child_sizes_.find(index + 1);
+        dtype start = child_index != 0 ? child_sizes_.get(child_index - 1) : 0;
+        uint64_t ret = 0;
+        uint16_t done = 0;
+        while (done < width) {
+            dtype c_size = child_sizes_.get(child_index) - start;
+            dtype local = index + done - start;
+            uint16_t len = width - done;
+            len = len < c_size - local ? len : c_size - local;
+            if (has_leaves()) {
+                const leaf_type* child =
+                    reinterpret_cast<const leaf_type*>(children_[child_index]);
+                [[unlikely]] ret |= child->get_bits(local, len) << done;
+            } else {
+                const node* child =
+                    reinterpret_cast<const node*>(children_[child_index]);
+                ret |= child->get_bits(local, len) << done;
+            }
+            done += len;
+            start += c_size;
+            child_index++;
+        }
+        return ret;
+    }
+
     /**
      * @brief Set the value of the logical index<sup>th</sup> element to v.
      *
@@ -155,18 +314,23 @@ class node : uncopyable {
      * based on return value. Change is returned so parents can update partial
      * sums as well.
      *
+     * @tparam with_rank If true, the number of 1-bits before `index` is added
+     *                   to `*rank` on the way down.
+     *
      * @param index Index of element to set value of
      * @param v     Value to set element to.
+     * @param alloc Allocator instance to use if compressed leaves need to be
+     *              reallocated.
+     * @param rank  Rank accumulator. Only used if `with_rank`.
      *
      * @return Change to data structure sum triggered by the set operation.
      */
-    template <class allocator>
-    int set(dtype index, bool v, allocator alloc) {
+    template <bool with_rank = false, class allocator>
+    int set(dtype index, bool v, allocator alloc, dtype* rank = nullptr) {
         uint16_t child_index = child_sizes_.find(index + 1);
         int change = 0;
         if (has_leaves()) {
-            leaf_type* child =
-                reinterpret_cast<leaf_type*>(children_[child_index]);
+            leaf_type* child = own_leaf(child_index, alloc);
             if constexpr (compressed) {
                 if (child->is_compressed() && child->need_realloc()) {
                     std::cerr << "Compressed leaf desires reallocation" << std::endl;
@@ -187,9 +351,14 @@ class node : uncopyable {
                 }
             }
             index -= child_index != 0 ? child_sizes_.get(child_index - 1) : 0;
+            if constexpr (with_rank) {
+                *rank += child_index != 0 ? child_sums_.get(child_index - 1)
+                                          : 0;
+                *rank += child->rank(index);
+            }
             [[unlikely]] change = child->set(index, v);
         } else {
-            node* child = reinterpret_cast<node*>(children_[child_index]);
+            node* child = own_node(child_index, alloc);
             if constexpr (compressed) {
                 if (child->child_count() == branches) {
                     rebalance_node(child_index, alloc);
@@ -199,7 +368,11 @@ class node : uncopyable {
                 }
             }
             index -= child_index != 0 ? child_sizes_.get(child_index - 1) : 0;
-            change = child->set(index, v, alloc);
+            if constexpr (with_rank) {
+                *rank += child_index != 0 ? child_sums_.get(child_index - 1)
+                                          : 0;
+            }
+            change = child->template set<with_rank>(index, v, alloc, rank);
         }
         uint16_t c_count = child_count_;
         child_sums_.increment(child_index, c_count, change);
@@ -234,6 +407,48 @@ class node : uncopyable {
         }
     }
 
+    /**
+     * @brief Number of 1-bits up to each of a sorted sequence of positions.
+     *
+     * Consecutive queries targeting the same child are passed to the child as
+     * a group, so each subtree is descended into at most once per batch.
+     *
+     * @param indexes Non-decreasing query positions.
+     * @param n       Number of queries.
+     * @param out     Output array for `n` results.
+     * @param offset  Value to subtract from `indexes` to get local positions.
+     * @param base    Number of 1-bits preceding this subtree.
+     */
+    void rank_batch(const dtype* indexes, dtype n, dtype* out, dtype offset,
+                    dtype base) const {
+        dtype i = 0;
+        while (i < n) {
+            uint16_t child_index = child_sizes_.find(indexes[i] - offset);
+            dtype start = 0;
+            dtype c_base = base;
+            if (child_index != 0) {
+                start = child_sizes_.get(child_index - 1);
+                [[likely]] c_base += child_sums_.get(child_index - 1);
+            }
+            dtype end = offset + child_sizes_.get(child_index);
+            dtype count = 1;
+            while (i + count < n && indexes[i + count] <= end) {
+                count++;
+            }
+            if (has_leaves()) {
+                leaf_type* child =
+                    reinterpret_cast<leaf_type*>(children_[child_index]);
+                [[unlikely]] child->rank_batch(indexes + i, count, out + i,
+                                               offset + start, c_base);
+            } else {
+                node* child = reinterpret_cast<node*>(children_[child_index]);
+                child->rank_batch(indexes + i, count, out + i, offset + start,
+                                  c_base);
+            }
+            i += count;
+        }
+    }
+
     /**
      * @brief Calculates the index of the count<sup>tu</sup> 1-bit
      *
@@ -262,6 +477,78 @@ class node : uncopyable {
         }
     }
 
+    /**
+     * @brief Index of the count<sup>th</sup> 1-bit for each of a sorted
+     * sequence of selection targets.
+     *
+     * Consecutive targets resolving to the same child are passed to the child
+     * as a group, so each subtree is descended into at most once per batch.
+     *
+     * @param counts Non-decreasing selection targets.
+     * @param n      Number of targets.
+     * @param out    Output array for `n` results.
+     * @param offset Number of 1-bits preceding this subtree.
+     * @param base   Number of bits preceding this subtree.
+     */
+    void select_batch(const dtype* counts, dtype n, dtype* out, dtype offset,
+                      dtype base) const {
+        dtype i = 0;
+        while (i < n) {
+            uint16_t child_index = child_sums_.find(counts[i] - offset);
+            dtype start = 0;
+            dtype c_offset = offset;
+            if (child_index != 0) {
+                start = child_sizes_.get(child_index - 1);
+                [[likely]] c_offset += child_sums_.get(child_index - 1);
+            }
+            dtype end = offset + child_sums_.get(child_index);
+            dtype count = 1;
+            while (i + count < n && counts[i + count] <= end) {
+                count++;
+            }
+            if (has_leaves()) {
+                leaf_type* child =
+                    reinterpret_cast<leaf_type*>(children_[child_index]);
+                [[unlikely]] child->select_batch(counts + i, count, out + i,
+                                                 c_offset, base + start);
+            } else {
+                node* child = reinterpret_cast<node*>(children_[child_index]);
+                child->select_batch(counts + i, count, out + i, c_offset,
+                                    base + start);
+            }
+            i += count;
+        }
+    }
+
+    /**
+     * @brief Calculates the index of the count<sup>th</sup> 0-bit
+     *
+     * Recurses to children based on the difference of cumulative sizes and
+     * sums, i.e. the cumulative number of 0-bits.
+     *
+     * @param count Number of 0-bits to sum up to
+     *
+     * @return \f$\underset{i \in [0..n)}{\mathrm{arg min}}\left(\sum_{j = 0}^i
+     * (1 - \mathrm{bv}[j])\right) =  \f$ count.
+     */
+    dtype select0(dtype count) const {
+        uint16_t child_index =
+            child_sizes_.find_difference(count, child_sums_, child_count_);
+        dtype res = 0;
+        if (child_index != 0) {
+            res = child_sizes_.get(child_index - 1);
+            [[likely]] count -= res - child_sums_.get(child_index - 1);
+        }
+        if (has_leaves()) {
+            leaf_type* child =
+                reinterpret_cast<leaf_type*>(children_[child_index]);
+            [[unlikely]] return res + child->select0(count);
+        } else {
+            node* child = reinterpret_cast<node*>(children_[child_index]);
+            return res + child->select0(count);
+        }
+    }
+
     /**
      * @brief Recursively deallocates all children.
      *
@@ -315,6 +602,13 @@ class node : uncopyable {
      */
     branching* child_sizes() { return &child_sizes_; }
 
+    /**
+     * @brief Get read-only pointer to the cumulative child sizes.
+     *
+     * @returns Address of the array of cumulative child sizes.
+     */
+    const branching* child_sizes() const { return &child_sizes_; }
+
     /**
      * @brief Get pointer to the cumulative child sums.
      *
@@ -370,25 +664,74 @@ class node : uncopyable {
      */
     void* child(uint16_t i) { return children_[i]; }
 
+    /**
+     * @brief Get read-only pointer to the i<sup>th</sup> child of the node.
+     *
+     * Intended for traversal by bv::bit_vector::const_iterator.
+     *
+     * @param i Index of child to return.
+     *
+     * @return Pointer to the i<sup>th</sup> child.
+     */
+    const void* child(uint16_t i) const { return children_[i]; }
+
     /**
      * @brief Insert "value" at "index".
      *
      * Inserts into the logical bit vector while ensuring that structural
      * invariants hold. Children will be rebalanced or split as necessary.
      *
+     * @tparam with_rank If true, the number of 1-bits before `index` is added
+     *                   to `*rank` on the way down.
      * @tparam allocator Type of `alloc`.
      *
      * @param index Location for insertion.
      * @param value Boolean indicating the value for the new element.
      * @param alloc Instance of allocator to use for allocation and
      * reallocation.
+     * @param rank  Rank accumulator. Only used if `with_rank`.
+     */
+    template <bool with_rank = false, class allocator>
+    void insert(dtype index, bool value, allocator* alloc,
+                dtype* rank = nullptr) {
+        if (has_leaves()) {
+            leaf_insert<with_rank>(index, value, alloc, rank);
+        } else {
+            [[likely]] node_insert<with_rank>(index, value, alloc, rank);
+        }
+    }
+
+    /**
+     * @brief Insert a batch of elements.
+     *
+     * Insertions are applied in order, with each index referring to the
+     * logical bit vector after the preceding insertions. Thus `indexes` needs
+     * to be strictly increasing.
+     *
+     * Children are rebalanced as necessary. If this node is full and would
+     * need to grow to complete the batch, processing stops and the number of
+     * completed insertions is returned, so that the parent can make room
+     * before continuing.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param indexes Strictly increasing insertion locations.
+     * @param values  Values to insert.
+     * @param n       Number of insertions.
+     * @param offset  Value to subtract from `indexes` to get local locations.
+     * @param alloc   Instance of allocator to use for allocation and
+     * reallocation.
+     *
+     * @return Number of insertions completed.
      */
     template <class allocator>
-    void insert(dtype index, bool value, allocator* alloc) {
+    dtype insert_batch(const dtype* indexes, const bool* values, dtype n,
+                       dtype offset, allocator* alloc) {
         if (has_leaves()) {
-            leaf_insert(index, value, alloc);
+            return leaf_insert_batch(indexes, values, n, offset, alloc);
         } else {
-            [[likely]] node_insert(index, value, alloc);
+            [[likely]] return node_insert_batch(indexes, values, n, offset,
+                                                alloc);
         }
     }
 
@@ -398,20 +741,97 @@ class node : uncopyable {
      * Removes element at "index" while ensuring that structural invariants
      * hold. Children will be rebalanced and merger as necessary.
      *
+     * @tparam with_rank If true, the number of 1-bits before `index` is added
+     *                   to `*rank` on the way down.
      * @tparam allocator Type of `alloc`.
      *
      * @param index Location for removal.
      * @param alloc Allocator to use for reallocation and deallocation.
+     * @param rank  Rank accumulator. Only used if `with_rank`.
      */
-    template <class allocator>
-    bool remove(dtype index, allocator* alloc) {
+    template <bool with_rank = false, class allocator>
+    bool remove(dtype index, allocator* alloc, dtype* rank = nullptr) {
         if (has_leaves()) {
-            return leaf_remove(index, alloc);
+            return leaf_remove<with_rank>(index, alloc, rank);
         } else {
-            [[likely]] return node_remove(index, alloc);
+            [[likely]] return node_remove<with_rank>(index, alloc, rank);
         }
     }
 
+    /**
+     * @brief Remove elements in the \f$[\mathrm{begin}, \mathrm{end})\f$
+     * range.
+     *
+     * Children fully covered by the range are passed to `release`, and the
+     * at most 2 partially covered children are trimmed. Cumulative sizes and
+     * sums are then rebuilt and underfull children are merged or balanced
+     * with their siblings.
+     *
+     * The range can't cover the entire node, since the parent is responsible
+     * for releasing fully covered children.
+     *
+     * @tparam allocator  Type of `alloc`.
+     * @tparam release_fn Callable as `release(leaf_type*)` and
+     *                    `release(node*)`.
+     *
+     * @param begin   Index of the first element to remove.
+     * @param end     Index following the last element to remove.
+     * @param alloc   Allocator instance to use for reallocation and
+     *                deallocation.
+     * @param release Disposes of fully covered children, which may be shared
+     *                with other trees.
+     */
+    template <class allocator, class release_fn>
+    void remove_range(dtype begin, dtype end, allocator* alloc,
+                      release_fn release) {
+        assert(begin < end && end <= size());
+        assert(begin > 0 || end < size());
+        uint16_t first = child_sizes_.find(begin + 1);
+        uint16_t last = child_sizes_.find(end);
+        for (uint16_t i = first; i <= last; i++) {
+            dtype c_start = i != 0 ? child_sizes_.get(i - 1) : 0;
+            dtype c_end = child_sizes_.get(i);
+            dtype r_begin = (begin > c_start ? begin : c_start) - c_start;
+            dtype r_end = (end < c_end ? end : c_end) - c_start;
+            if (has_leaves()) {
+                leaf_type* child = reinterpret_cast<leaf_type*>(children_[i]);
+                if (r_begin == 0 && r_end == c_end - c_start) {
+                    release(child);
+                    children_[i] = nullptr;
+                } else {
+                    child = own_leaf(i, alloc);
+                    child->remove_range(r_begin, r_end);
+                    if constexpr (aggressive_realloc) {
+                        uint32_t cap = child->capacity();
+                        uint32_t n_cap = child->desired_capacity();
+                        if (cap > n_cap) {
+                            [[unlikely]] children_[i] =
+                                alloc->reallocate_leaf(child, cap, n_cap);
+                        }
+                    }
+                }
+            } else {
+                node* child = reinterpret_cast<node*>(children_[i]);
+                if (r_begin == 0 && r_end == c_end - c_start) {
+                    release(child);
+                    children_[i] = nullptr;
+                } else {
+                    child = own_node(i, alloc);
+                    child->remove_range(r_begin, r_end, alloc, release);
+                }
+            }
+        }
+        uint16_t w = first;
+        for (uint16_t i = first; i < child_count_; i++) {
+            if (children_[i] != nullptr) {
+                children_[w++] = children_[i];
+            }
+        }
+        child_count_ = w;
+        rebuild_cumulative();
+        repair(alloc);
+    }
+
     /**
      * @brief Remove the first "elems" elements form this node.
      *
@@ -520,57 +940,490 @@ class node : uncopyable {
     }
 
     /**
-     * @brief Size of the subtree in "allocated" bits.
+     * @brief Size of the subtree in "allocated" bits.
+     *
+     * Reports number of bits allocated for this subtree, Does not take into
+     * account any sort of memory fragmentation or similar.
+     *
+     * @return Number of allocated bits.
+     */
+    uint64_t bits_size() const {
+        uint64_t ret = sizeof(node) * 8;
+        if (has_leaves()) {
+            leaf_type* const* children =
+                reinterpret_cast<leaf_type* const*>(children_);
+            for (uint16_t i = 0; i < child_count_; i++) {
+                ret += children[i]->bits_size();
+            }
+        } else {
+            node* const* children = reinterpret_cast<node* const*>(children_);
+            for (uint16_t i = 0; i < child_count_; i++) {
+                ret += children[i]->bits_size();
+            }
+        }
+        return ret;
+    }
+
+    void flush() {
+        if (has_leaves()) {
+            leaf_type** children = reinterpret_cast<leaf_type**>(children_);
+            for (uint16_t i = 0; i < child_count_; i++) {
+                children[i]->flush();
+            }
+        } else {
+            node** children = reinterpret_cast<node**>(children_);
+            for (uint16_t i = 0; i < child_count_; i++) {
+                children[i]->flush();
+            }
+        }
+    }
+
+    uint64_t dump(uint64_t* data, uint64_t offset) const {
+        if (has_leaves()) {
+            leaf_type* const* children =
+                reinterpret_cast<leaf_type* const*>(children_);
+            for (uint16_t i = 0; i < child_count_; i++) {
+                offset = dump_leaf(children[i], data, offset, nullptr);
+            }
+        } else {
+            node* const* children = reinterpret_cast<node* const*>(children_);
+            for (uint16_t i = 0; i < child_count_; i++) {
+                offset = children[i]->dump(data, offset);
+            }
+        }
+        return offset;
+    }
+
+    /**
+     * @brief Flush all leaf buffers of the subtree using `threads` threads.
+     *
+     * Children are split into contiguous groups that are flushed in
+     * parallel. Threads not needed at this level are passed on to the
+     * children.
+     */
+    void flush(uint16_t threads) {
+        if (threads <= 1) {
+            return flush();
+        }
+        for_child_groups(threads, [&](uint16_t, uint16_t begin, uint16_t end,
+                                      uint16_t c_threads) {
+            for (uint16_t i = begin; i < end; i++) {
+                if (has_leaves()) {
+                    reinterpret_cast<leaf_type*>(children_[i])->flush();
+                } else {
+                    reinterpret_cast<node*>(children_[i])->flush(c_threads);
+                }
+            }
+        });
+    }
+
+    /**
+     * @brief Write the subtree to `data` using `threads` threads.
+     *
+     * Groups of children write disjoint ranges of `data`, except that the
+     * first word of a group may also be written by the preceding group. Each
+     * group except the first writes its first word to a separate head word,
+     * which is merged to `data` after all groups are done. The output is
+     * identical to the single threaded `dump`.
+     *
+     * @param data    Zeroed target area.
+     * @param offset  Bit position of the first bit of the subtree in `data`.
+     * @param threads Number of threads to use.
+     * @param head    If not null, bits of the word at `offset / 64` are
+     *                written to `*head` instead of `data`.
+     *
+     * @return `offset + size()`.
+     */
+    uint64_t dump(uint64_t* data, uint64_t offset, uint16_t threads,
+                  uint64_t* head = nullptr) const {
+        if (threads <= 1 && head == nullptr) {
+            return dump(data, offset);
+        }
+        std::vector<uint64_t> heads(threads < child_count_ ? threads
+                                                           : child_count_);
+        for_child_groups(threads, [&](uint16_t group, uint16_t begin,
+                                      uint16_t end, uint16_t c_threads) {
+            uint64_t o = offset + (begin > 0 ? child_sizes_.get(begin - 1) : 0);
+            for (uint16_t i = begin; i < end; i++) {
+                uint64_t* h = nullptr;
+                if (i == begin) {
+                    h = group > 0 ? &heads[group] : head;
+                }
+                if (has_leaves()) {
+                    o = dump_leaf(reinterpret_cast<leaf_type*>(children_[i]),
+                                  data, o, h);
+                } else {
+                    o = reinterpret_cast<node*>(children_[i])
+                            ->dump(data, o, c_threads, h);
+                }
+            }
+        });
+        uint16_t groups = heads.size();
+        uint16_t per_group = child_count_ / groups;
+        uint16_t extra = child_count_ % groups;
+        uint16_t begin = 0;
+        for (uint16_t g = 0; g < groups; g++) {
+            if (g > 0) {
+                data[(offset + child_sizes_.get(begin - 1)) / WORD_BITS] |=
+                    heads[g];
+            }
+            begin += per_group + (g < extra ? 1 : 0);
+        }
+        return offset + size();
+    }
+
+    /**
+     * @brief Dump a leaf, optionally redirecting its first word to `head`.
+     *
+     * The leaf is decoded at most `leaf_size` bits at a time without
+     * committing its buffer, so the leaf is not modified. Bits are ORed to
+     * the zeroed target area.
+     */
+    static uint64_t dump_leaf(const leaf_type* l, uint64_t* data,
+                              uint64_t offset, uint64_t* head) {
+        uint64_t first = offset / WORD_BITS;
+        uint32_t size = l->size();
+        for (uint32_t begin = 0; begin < size; begin += leaf_size) {
+            uint32_t len = size - begin < leaf_size ? size - begin : leaf_size;
+            l->decode(dump_scratch, begin, len);
+            uint64_t word = (offset + begin) / WORD_BITS;
+            uint16_t shift = (offset + begin) % WORD_BITS;
+            for (uint32_t i = 0; i * WORD_BITS < len; i++) {
+                uint64_t* target = data + word + i;
+                if (head != nullptr && word + i == first) {
+                    target = head;
+                }
+                *target |= dump_scratch[i] << shift;
+                // Only bits past the word boundary spill to the next word.
+                if (shift > 0 && i * WORD_BITS + WORD_BITS - shift < len) {
+                    data[word + i + 1] |=
+                        dump_scratch[i] >> (WORD_BITS - shift);
+                }
+            }
+        }
+        return offset + size;
+    }
+
+    /**
+     * @brief Pass the leaves of the subtree to `f` in logical order.
+     *
+     * @tparam F Callable as `f(const leaf_type*)`.
+     *
+     * @param f Function to call for each leaf.
+     */
+    template <class F>
+    void for_each_leaf(F&& f) const {
+        if (has_leaves()) {
+            for (uint16_t i = 0; i < child_count_; i++) {
+                f(reinterpret_cast<const leaf_type*>(children_[i]));
+            }
+        } else {
+            for (uint16_t i = 0; i < child_count_; i++) {
+                reinterpret_cast<const node*>(children_[i])->for_each_leaf(f);
+            }
+        }
+    }
+
+    /**
+     * @brief Write the subtree to `out` in binary form.
+     *
+     * Writes node metadata and child count followed by the children in
+     * order. Cumulative sizes and sums are not written since they are rebuilt
+     * from the children on load.
+     *
+     * @param out Stream to write to.
+     */
+    void serialize(std::ostream& out) const {
+        out.write(reinterpret_cast<const char*>(&meta_data_),
+                  sizeof(meta_data_));
+        out.write(reinterpret_cast<const char*>(&child_count_),
+                  sizeof(child_count_));
+        for (uint16_t i = 0; i < child_count_; i++) {
+            if (has_leaves()) {
+                reinterpret_cast<const leaf_type*>(children_[i])
+                    ->serialize(out);
+            } else {
+                reinterpret_cast<const node*>(children_[i])->serialize(out);
+            }
+        }
+    }
+
+    /**
+     * @brief Read a subtree written by `serialize` from `in`.
+     *
+     * Child counts are checked against `branches`, all children of a node
+     * must be subtrees of equal height, and the depth of the tree is limited
+     * to the bit width of `dtype`, since every level multiplies the subtree
+     * size.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param in    Stream to read from.
+     * @param alloc Allocator to use for allocating nodes and leaves.
+     *
+     * @return Pointer to the loaded subtree or `nullptr` if reading failed.
+     */
+    template <class allocator>
+    static node* load(std::istream& in, allocator* alloc) {
+        uint16_t height = 0;
+        return load(in, alloc, 0, height);
+    }
+
+    /**
+     * @brief Allocate a copy of this node referencing the same children.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param alloc Allocator to use for allocating the copy.
+     */
+    template <class allocator>
+    node* clone(allocator* alloc) const {
+        node* nd = alloc->template allocate_node<node>();
+        nd->meta_data_ = meta_data_;
+        for (uint16_t i = 0; i < child_count_; i++) {
+            if (has_leaves()) {
+                nd->append_child(reinterpret_cast<leaf_type*>(children_[i]));
+            } else {
+                nd->append_child(reinterpret_cast<node*>(children_[i]));
+            }
+        }
+        return nd;
+    }
+
+    /**
+     * @brief Number of bytes used by a node in the memory-mapped format.
+     *
+     * The record consists of an 8-byte header holding metadata and child
+     * count, the cumulative sizes and sums as stored in the node, and byte
+     * offsets of the children, padded to a multiple of `CACHE_LINE` bytes.
+     */
+    static constexpr uint64_t mapped_bytes() {
+        uint64_t bytes = MAPPED_CHILDREN + branches * sizeof(uint64_t);
+        return (bytes + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    }
+
+    /**
+     * @brief Number of bytes used by the subtree in the memory-mapped format.
+     */
+    uint64_t subtree_mapped_bytes() const {
+        uint64_t ret = mapped_bytes();
+        for (uint16_t i = 0; i < child_count_; i++) {
+            if (has_leaves()) {
+                ret += reinterpret_cast<const leaf_type*>(children_[i])
+                           ->mapped_bytes();
+            } else {
+                ret += reinterpret_cast<const node*>(children_[i])
+                           ->subtree_mapped_bytes();
+            }
+        }
+        return ret;
+    }
+
+    /**
+     * @brief Write the subtree to `out` in the memory-mapped format.
+     *
+     * Children are written before the parent, so that the byte offsets of the
+     * children are known when the parent record is written.
+     *
+     * @param out    Stream to write to.
+     * @param offset Byte offset of `out` in the mapped file. Updated to the
+     *               offset following the subtree.
+     *
+     * @return Byte offset of the record for this node.
+     */
+    uint64_t write_mapped(std::ostream& out, uint64_t& offset) const {
+        uint64_t offsets[branches] = {};
+        for (uint16_t i = 0; i < child_count_; i++) {
+            if (has_leaves()) {
+                const leaf_type* child =
+                    reinterpret_cast<const leaf_type*>(children_[i]);
+                offsets[i] = offset;
+                child->write_mapped(out);
+                offset += child->mapped_bytes();
+            } else {
+                offsets[i] = reinterpret_cast<const node*>(children_[i])
+                                 ->write_mapped(out, offset);
+            }
+        }
+        uint8_t record[mapped_bytes()] = {};
+        record[0] = meta_data_;
+        memcpy(record + 2, &child_count_, sizeof(child_count_));
+        memcpy(record + MAPPED_SIZES, static_cast<const void*>(&child_sizes_),
+               sizeof(branching));
+        memcpy(record + MAPPED_SUMS, static_cast<const void*>(&child_sums_),
+               sizeof(branching));
+        memcpy(record + MAPPED_CHILDREN, offsets, sizeof(offsets));
+        out.write(reinterpret_cast<const char*>(record), sizeof(record));
+        uint64_t ret = offset;
+        offset += sizeof(record);
+        return ret;
+    }
+
+    /**
+     * @brief Access the index<sup>th</sup> element of a memory-mapped subtree.
+     *
+     * Equivalent to `at` for a node record written by `write_mapped`.
+     *
+     * @param base   Start of the mapped file.
+     * @param record Start of the node record.
+     * @param index  Index to access.
+     */
+    static bool mapped_at(const uint8_t* base, const uint8_t* record,
+                          dtype index) {
+        const branching* sizes = mapped_sizes(record);
+        uint16_t child_index = sizes->find(index + 1);
+        index -= child_index != 0 ? sizes->get(child_index - 1) : 0;
+        const uint8_t* child = base + mapped_children(record)[child_index];
+        if (record[0] >> 7) {
+            alignas(leaf_type) uint8_t space[sizeof(leaf_type)];
+            [[unlikely]] return leaf_type::map(child, space)->at(index);
+        } else {
+            return mapped_at(base, child, index);
+        }
+    }
+
+    /**
+     * @brief Number of 1-bits before `index` in a memory-mapped subtree.
+     *
+     * Equivalent to `rank` for a node record written by `write_mapped`.
+     *
+     * @param base   Start of the mapped file.
+     * @param record Start of the node record.
+     * @param index  Number of elements to sum.
+     */
+    static dtype mapped_rank(const uint8_t* base, const uint8_t* record,
+                             dtype index) {
+        const branching* sizes = mapped_sizes(record);
+        uint16_t child_index = sizes->find(index);
+        dtype res = 0;
+        if (child_index != 0) {
+            res = mapped_sums(record)->get(child_index - 1);
+            [[likely]] index -= sizes->get(child_index - 1);
+        }
+        const uint8_t* child = base + mapped_children(record)[child_index];
+        if (record[0] >> 7) {
+            alignas(leaf_type) uint8_t space[sizeof(leaf_type)];
+            [[unlikely]] return res + leaf_type::map(child, space)->rank(index);
+        } else {
+            return res + mapped_rank(base, child, index);
+        }
+    }
+
+    /**
+     * @brief Index of the count<sup>th</sup> 1-bit in a memory-mapped
+     * subtree.
      *
-     * Reports number of bits allocated for this subtree, Does not take into
-     * account any sort of memory fragmentation or similar.
+     * Equivalent to `select` for a node record written by `write_mapped`.
      *
-     * @return Number of allocated bits.
+     * @param base   Start of the mapped file.
+     * @param record Start of the node record.
+     * @param count  Number to sum up to.
      */
-    uint64_t bits_size() const {
-        uint64_t ret = sizeof(node) * 8;
-        if (has_leaves()) {
-            leaf_type* const* children =
-                reinterpret_cast<leaf_type* const*>(children_);
-            for (uint16_t i = 0; i < child_count_; i++) {
-                ret += children[i]->bits_size();
-            }
+    static dtype mapped_select(const uint8_t* base, const uint8_t* record,
+                               dtype count) {
+        const branching* sums = mapped_sums(record);
+        uint16_t child_index = sums->find(count);
+        dtype res = 0;
+        if (child_index != 0) {
+            res = mapped_sizes(record)->get(child_index - 1);
+            [[likely]] count -= sums->get(child_index - 1);
+        }
+        const uint8_t* child = base + mapped_children(record)[child_index];
+        if (record[0] >> 7) {
+            alignas(leaf_type) uint8_t space[sizeof(leaf_type)];
+            [[unlikely]] return res +
+                                leaf_type::map(child, space)->select(count);
         } else {
-            node* const* children = reinterpret_cast<node* const*>(children_);
-            for (uint16_t i = 0; i < child_count_; i++) {
-                ret += children[i]->bits_size();
-            }
+            return res + mapped_select(base, child, count);
         }
-        return ret;
     }
 
-    void flush() {
-        if (has_leaves()) {
-            leaf_type** children = reinterpret_cast<leaf_type**>(children_);
-            for (uint16_t i = 0; i < child_count_; i++) {
-                children[i]->flush();
+    /**
+     * @brief Check that a memory-mapped subtree lies within the mapping.
+     *
+     * Intended for validating untrusted mapped data before querying it. Since
+     * `write_mapped` writes children before their parent, every child record
+     * has to end at or before the start of its parent record, which also
+     * rules out cycles. Child counts, unused branching entries and cumulative
+     * sizes and sums are checked against the children, and the depth is
+     * limited to the bit width of `dtype` as in `load`.
+     *
+     * @param base   Start of the mapped file.
+     * @param offset Byte offset of the node record.
+     * @param end    Byte offset that the subtree may not extend past.
+     * @param size   Set to the number of bits in the subtree.
+     * @param sum    Set to the number of 1-bits in the subtree.
+     * @param depth  Depth of the node record, 0 for the root.
+     *
+     * @return True if the subtree is valid.
+     */
+    static bool mapped_valid(const uint8_t* base, uint64_t offset,
+                             uint64_t end, uint64_t& size, uint64_t& sum,
+                             uint16_t depth = 0) {
+        if (offset % CACHE_LINE != 0 || offset > end ||
+            end - offset < mapped_bytes() || depth >= sizeof(dtype) * 8) {
+            [[unlikely]] return false;
+        }
+        const uint8_t* record = base + offset;
+        uint16_t count = 0;
+        memcpy(&count, record + 2, sizeof(count));
+        if (count == 0 || count > branches) {
+            [[unlikely]] return false;
+        }
+        const branching* sizes = mapped_sizes(record);
+        const branching* sums = mapped_sums(record);
+        const uint64_t* children = mapped_children(record);
+        const dtype limit = (~dtype(0)) >> 1;
+        size = 0;
+        sum = 0;
+        for (uint16_t i = 0; i < count; i++) {
+            uint64_t c_size = 0;
+            uint64_t c_sum = 0;
+            uint64_t child = children[i];
+            bool valid = child < offset && child % CACHE_LINE == 0;
+            if (valid && record[0] >> 7) {
+                valid = leaf_type::mapped_valid(base + child, offset - child,
+                                                c_size, c_sum);
+            } else if (valid) {
+                valid = mapped_valid(base, child, offset, c_size, c_sum,
+                                     depth + 1);
             }
-        } else {
-            node** children = reinterpret_cast<node**>(children_);
-            for (uint16_t i = 0; i < child_count_; i++) {
-                children[i]->flush();
+            size += c_size;
+            sum += c_sum;
+            if (!valid || size >= limit || sizes->get(i) != size ||
+                sums->get(i) != sum) {
+                [[unlikely]] return false;
+            }
+        }
+        for (uint16_t i = count; i < branches; i++) {
+            if (sizes->get(i) != limit || sums->get(i) != limit) {
+                [[unlikely]] return false;
             }
         }
+        return true;
     }
 
-    uint64_t dump(uint64_t* data, uint64_t offset) {
+    /**
+     * @brief Append the content of the subtree to a static query structure.
+     *
+     * Leaves are appended in order without modifying them.
+     *
+     * @tparam qs_type Type of query structure. Some kind of bv::query_support.
+     *
+     * @param qs Query structure to append to.
+     */
+    template <class qs_type>
+    void generate_query_structure(qs_type* qs) const {
         if (has_leaves()) {
-            leaf_type** children = reinterpret_cast<leaf_type**>(children_);
             for (uint16_t i = 0; i < child_count_; i++) {
-                offset = children[i]->dump(data, offset);
+                qs->append(reinterpret_cast<const leaf_type*>(children_[i]));
             }
         } else {
-            node** children = reinterpret_cast<node**>(children_);
             for (uint16_t i = 0; i < child_count_; i++) {
-                offset = children[i]->dump(data, offset);
+                reinterpret_cast<const node*>(children_[i])
+                    ->generate_query_structure(qs);
             }
         }
-        return offset;
     }
 
     /**
@@ -594,7 +1447,18 @@ class node : uncopyable {
      *
      * @return Number of nodes in this subtree.
      */
-    uint64_t validate() const {
+    uint64_t validate() const { return validate(1); }
+
+    /**
+     * @brief Validate the subtree using `threads` threads.
+     *
+     * Checks of this node are done on the calling thread, after which
+     * contiguous groups of children are validated in parallel. Node counts of
+     * the groups are summed in order.
+     *
+     * @return Number of nodes in this subtree.
+     */
+    uint64_t validate(uint16_t threads) const {
         uint64_t ret = 1;
         uint64_t child_s_sum = 0;
         uint64_t child_p_sum = 0;
@@ -612,7 +1476,6 @@ class node : uncopyable {
                 if constexpr (!compressed) {
                     assert(children[i]->size() <= leaf_size);
                 }
-                ret += children[i]->validate();
             }
         } else {
             node* const* children = reinterpret_cast<node* const*>(children_);
@@ -623,9 +1486,26 @@ class node : uncopyable {
                 assert(child_sizes_.get(i) == child_s_sum);
                 child_p_sum += children[i]->p_sum();
                 assert(child_sums_.get(i) == child_p_sum);
-                ret += children[i]->validate();
             }
         }
+        std::vector<uint64_t> counts(threads < child_count_ ? threads
+                                                            : child_count_);
+        for_child_groups(threads, [&](uint16_t group, uint16_t begin,
+                                      uint16_t end, uint16_t c_threads) {
+            for (uint16_t i = begin; i < end; i++) {
+                if (has_leaves()) {
+                    counts[group] +=
+                        reinterpret_cast<leaf_type*>(children_[i])->validate();
+                } else {
+                    counts[group] +=
+                        reinterpret_cast<node*>(children_[i])->validate(
+                            c_threads);
+                }
+            }
+        });
+        for (auto c : counts) {
+            ret += c;
+        }
         return ret;
     }
 
@@ -708,7 +1588,161 @@ class node : uncopyable {
         return p;
     }
 
+    /**
+     * @brief Leaf capacity and usage of the subtree using `threads` threads.
+     */
+    std::pair<uint64_t, uint64_t> leaf_usage(uint16_t threads) const {
+        if (threads <= 1) {
+            return leaf_usage();
+        }
+        std::vector<std::pair<uint64_t, uint64_t>> usage(
+            threads < child_count_ ? threads : child_count_, {0, 0});
+        for_child_groups(threads, [&](uint16_t group, uint16_t begin,
+                                      uint16_t end, uint16_t c_threads) {
+            for (uint16_t i = begin; i < end; i++) {
+                std::pair<uint64_t, uint64_t> op;
+                if (has_leaves()) {
+                    op = reinterpret_cast<leaf_type*>(children_[i])
+                             ->leaf_usage();
+                } else {
+                    op = reinterpret_cast<node*>(children_[i])
+                             ->leaf_usage(c_threads);
+                }
+                usage[group].first += op.first;
+                usage[group].second += op.second;
+            }
+        });
+        std::pair<uint64_t, uint64_t> p(0, 0);
+        for (const auto& op : usage) {
+            p.first += op.first;
+            p.second += op.second;
+        }
+        return p;
+    }
+
    private:
+    /**
+     * @brief Split children into contiguous groups processed in parallel.
+     *
+     * At most `threads` groups are formed. The last group is processed on
+     * the calling thread. If there are more threads than children, the
+     * remaining threads are divided among the groups, to be used for the next
+     * tree level.
+     *
+     * @tparam F Callable as `f(group, begin, end, child_threads)`.
+     */
+    template <class F>
+    void for_child_groups(uint16_t threads, F f) const {
+        uint16_t groups = threads < child_count_ ? threads : child_count_;
+        if (groups <= 1) {
+            return f(0, 0, child_count_, threads);
+        }
+        uint16_t per_group = child_count_ / groups;
+        uint16_t extra = child_count_ % groups;
+        std::vector<std::thread> workers;
+        workers.reserve(groups - 1);
+        uint16_t begin = 0;
+        for (uint16_t g = 0; g < groups; g++) {
+            uint16_t end = begin + per_group + (g < extra ? 1 : 0);
+            uint16_t c_threads = threads / groups + (g < threads % groups);
+            if (g + 1 < groups) {
+                workers.emplace_back(f, g, begin, end, c_threads);
+            } else {
+                f(g, begin, end, c_threads);
+            }
+            begin = end;
+        }
+        for (auto& w : workers) {
+            w.join();
+        }
+    }
+
+    /** @brief Cumulative sizes of a memory-mapped node record. */
+    static const branching* mapped_sizes(const uint8_t* record) {
+        return reinterpret_cast<const branching*>(record + MAPPED_SIZES);
+    }
+
+    /** @brief Cumulative sums of a memory-mapped node record. */
+    static const branching* mapped_sums(const uint8_t* record) {
+        return reinterpret_cast<const branching*>(record + MAPPED_SUMS);
+    }
+
+    /** @brief Child byte offsets of a memory-mapped node record. */
+    static const uint64_t* mapped_children(const uint8_t* record) {
+        return reinterpret_cast<const uint64_t*>(record + MAPPED_CHILDREN);
+    }
+
+    /**
+     * @brief Read a subtree at `depth` written by `serialize` from `in`.
+     *
+     * @param depth  Depth of the subtree root, 0 for the root of the tree.
+     * @param height Set to the height of the loaded subtree, 1 for a node
+     *               with leaf children.
+     */
+    template <class allocator>
+    static node* load(std::istream& in, allocator* alloc, uint16_t depth,
+                      uint16_t& height) {
+        uint8_t meta = 0;
+        uint16_t count = 0;
+        in.read(reinterpret_cast<char*>(&meta), sizeof(meta));
+        in.read(reinterpret_cast<char*>(&count), sizeof(count));
+        if (!in || count == 0 || count > branches ||
+            depth >= sizeof(dtype) * 8) {
+            [[unlikely]] return nullptr;
+        }
+        node* nd = alloc->template allocate_node<node>();
+        nd->meta_data_ = meta;
+        height = 1;
+        bool valid = true;
+        for (uint16_t i = 0; valid && i < count; i++) {
+            if (nd->has_leaves()) {
+                leaf_type* child = leaf_type::load(in, alloc);
+                valid = child != nullptr;
+                if (valid) {
+                    nd->append_child(child);
+                }
+            } else {
+                uint16_t c_height = 0;
+                node* child = load(in, alloc, depth + 1, c_height);
+                valid = child != nullptr;
+                if (valid) {
+                    nd->append_child(child);
+                    valid = i == 0 || c_height + 1 == height;
+                    height = c_height + 1;
+                }
+            }
+        }
+        if (!valid) {
+            nd->deallocate(alloc);
+            alloc->deallocate_node(nd);
+            [[unlikely]] return nullptr;
+        }
+        return nd;
+    }
+
+    /**
+     * @brief Get child leaf `i`, copying it first if it is shared.
+     *
+     * Children are unshared from snapshots right before they are modified,
+     * so an update only copies the objects it actually touches.
+     */
+    template <class allocator>
+    leaf_type* own_leaf(uint16_t i, allocator* alloc) {
+        leaf_type* l = unshare(reinterpret_cast<leaf_type*>(children_[i]), alloc);
+        children_[i] = l;
+        return l;
+    }
+
+    /**
+     * @brief Get child node `i`, copying it first if it is shared.
+     */
+    template <class allocator>
+    node* own_node(uint16_t i, allocator* alloc) {
+        node* n = unshare(reinterpret_cast<node*>(children_[i]), alloc);
+        children_[i] = n;
+        return n;
+    }
+
     /**
      * @brief Splits a leaf with `n > leaf_size` elements into 2 leaves with
      * part of the encoded content each.
@@ -825,8 +1859,8 @@ class node : uncopyable {
             if (index == 0) {
                 // If the full leaf is the first child, a new leaf is created
                 // between indexes 0 and 1.
-                a_child = reinterpret_cast<leaf_type*>(children_[0]);
-                b_child = reinterpret_cast<leaf_type*>(children_[1]);
+                a_child = own_leaf(0, alloc);
+                b_child = own_leaf(1, alloc);
                 dtype n_elem = (a_child->size() + (leaf_size - r_cap)) / 3;
                 n_cap = 2 + (2 * leaf_size) / (3 * WORD_BITS);
                 n_cap += n_cap % 2;
@@ -846,8 +1880,8 @@ class node : uncopyable {
                 //if (compressed && do_debug) {
                 //    std::cout << " split 2->3" << std::endl;
                 //}
-                a_child = reinterpret_cast<leaf_type*>(children_[index - 1]);
-                b_child = reinterpret_cast<leaf_type*>(children_[index]);
+                a_child = own_leaf(index - 1, alloc);
+                b_child = own_leaf(index, alloc);
                 //if (compressed && do_debug) {
                 //    a_child->print(false);
                 //    std::cout << std::endl;
@@ -915,8 +1949,7 @@ class node : uncopyable {
             // Right sibling has more space than the left sibling. Move elements
             // to right sibling
             
-            leaf_type* sibling =
-                reinterpret_cast<leaf_type*>(children_[index + 1]);
+            leaf_type* sibling = own_leaf(index + 1, alloc);
             //if (!compressed && do_debug) {
             //    std::cout << "Scooting right" << std::endl;
             //    //leaf->print(false);
@@ -964,8 +1997,7 @@ class node : uncopyable {
         } else {
             // Left sibling has more space than the right sibling. Move elements
             // to the left sibling.
-            leaf_type* sibling =
-                reinterpret_cast<leaf_type*>(children_[index - 1]);
+            leaf_type* sibling = own_leaf(index - 1, alloc);
             //if (!compressed && do_debug) {
             //    std::cout << "Scooting left" << std::endl;
             //    //sibling->print(false);
@@ -1015,52 +2047,70 @@ class node : uncopyable {
         }
     }
 
+    /**
+     * @brief Determine if a leaf that needs reallocation can simply be grown.
+     *
+     * If the desired capacity of the leaf would exceed the maximum leaf size,
+     * or a compressed leaf has grown too large, the leaf needs to be rebalanced
+     * instead.
+     *
+     * @param leaf Leaf that needs reallocation.
+     *
+     * @return True if reallocating is sufficient.
+     */
+    bool leaf_can_grow(leaf_type* leaf) {
+        if constexpr (compressed) {
+            if (leaf->is_compressed()) {
+                if (leaf->size() >= (~uint32_t(0) >> 1)) {
+                    [[unlikely]] return false;
+                }
+            }
+        }
+        return leaf->desired_capacity() * WORD_BITS <= leaf_size;
+    }
+
+    /**
+     * @brief Ensure that there is space for insertion in a child leaf.
+     *
+     * The leaf is either reallocated or rebalanced with its siblings. Since
+     * rebalancing may allocate a new leaf, the node can't be full if the
+     * leaf can't be grown.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param index Location of the leaf that needs more space.
+     * @param leaf  Leaf that needs more space.
+     * @param alloc Instance of alloctor to use for allocation and reallocation.
+     */
+    template <class allocator>
+    void make_leaf_space(uint16_t index, leaf_type* leaf, allocator* alloc) {
+        if (leaf_can_grow(leaf)) {
+            children_[index] = alloc->reallocate_leaf(
+                leaf, leaf->capacity(), leaf->desired_capacity());
+        } else {
+            [[unlikely]] rebalance_leaf(index, leaf, alloc);
+        }
+    }
+
     /**
      * @brief Insertion operation if the children are leaves.
      *
      * Reallocation and rebalancing will take place as necessary.
      *
+     * @tparam with_rank Whether to add the rank of `index` to `*rank`.
      * @tparam allocator Type of `alloc`.
      *
      * @param index Location of insertion.
      * @param value Value to insert.
      * @param alloc Instance of alloctor to use for allocation and reallocation.
+     * @param rank  Rank accumulator. Only used if `with_rank`.
      */
-    template <class allocator>
-    void leaf_insert(dtype index, bool value, allocator* alloc) {
+    template <bool with_rank, class allocator>
+    void leaf_insert(dtype index, bool value, allocator* alloc, dtype* rank) {
         uint16_t child_index = child_sizes_.find(index);
-        leaf_type* child = reinterpret_cast<leaf_type*>(children_[child_index]);
+        leaf_type* child = own_leaf(child_index, alloc);
         if (child->need_realloc()) {
-            dtype cap = child->capacity();
-            dtype n_cap = child->desired_capacity();
-            if constexpr (compressed) {
-                if (child->is_compressed()) {
-                    if ((child->size() >= (~uint32_t(0) >> 1)) ||
-                        (n_cap * WORD_BITS > leaf_size)) {
-                        rebalance_leaf(child_index, child, alloc);
-                    } else {
-                        children_[child_index] =
-                            alloc->reallocate_leaf(child, cap, n_cap);
-                        [[likely]] (void(0));
-                    }
-                } else {
-                    if (n_cap * WORD_BITS > leaf_size) {
-                        rebalance_leaf(child_index, child, alloc);
-                    } else {
-                        children_[child_index] =
-                            alloc->reallocate_leaf(child, cap, n_cap);
-                        [[likely]] (void(0));
-                    }
-                }
-            } else {
-                if (n_cap * WORD_BITS > leaf_size) {
-                    rebalance_leaf(child_index, child, alloc);
-                } else {
-                    children_[child_index] =
-                        alloc->reallocate_leaf(child, cap, n_cap);
-                    [[likely]] (void(0));
-                }
-            }
+            make_leaf_space(child_index, child, alloc);
             child_index = child_sizes_.find(index);
             child = reinterpret_cast<leaf_type*>(children_[child_index]);
             [[unlikely]] (void(0));
@@ -1068,6 +2118,10 @@ class node : uncopyable {
         if (child_index != 0) {
             [[likely]] index -= child_sizes_.get(child_index - 1);
         }
+        if constexpr (with_rank) {
+            *rank += child_index != 0 ? child_sums_.get(child_index - 1) : 0;
+            *rank += child->rank(index);
+        }
         child_sizes_.increment(child_index, child_count_, 1u);
         child_sums_.increment(child_index, child_count_, value);
         child->insert(index, value);
@@ -1111,12 +2165,12 @@ class node : uncopyable {
         if (l_cap <= 1 && r_cap <= 1) {
             // There is no room in either sibling.
             if (index == 0) {
-                a_node = reinterpret_cast<node*>(children_[0]);
-                b_node = reinterpret_cast<node*>(children_[1]);
+                a_node = own_node(0, alloc);
+                b_node = own_node(1, alloc);
                 [[unlikely]] index++;
             } else {
-                a_node = reinterpret_cast<node*>(children_[index - 1]);
-                b_node = reinterpret_cast<node*>(children_[index]);
+                a_node = own_node(index - 1, alloc);
+                b_node = own_node(index, alloc);
             }
             node* new_child = alloc->template allocate_node<node>();
             new_child->has_leaves(a_node->has_leaves());
@@ -1134,14 +2188,14 @@ class node : uncopyable {
             [[unlikely]] return;
         } else if (l_cap > r_cap) {
             // There is more room in the left sibling.
-            a_node = reinterpret_cast<node*>(children_[index - 1]);
-            b_node = reinterpret_cast<node*>(children_[index]);
+            a_node = own_node(index - 1, alloc);
+            b_node = own_node(index, alloc);
             a_node->transfer_append(b_node, l_cap / 2);
             index--;
         } else {
             // There is more room in the right sibling.
-            a_node = reinterpret_cast<node*>(children_[index]);
-            b_node = reinterpret_cast<node*>(children_[index + 1]);
+            a_node = own_node(index, alloc);
+            b_node = own_node(index + 1, alloc);
             b_node->transfer_prepend(a_node, r_cap / 2);
         }
         // Fix cumulative sums and sizes.
@@ -1161,16 +2215,18 @@ class node : uncopyable {
      *
      * Reallocation and rebalancing will take place as necessary.
      *
+     * @tparam with_rank Whether to add the rank of `index` to `*rank`.
      * @tparam allocator Type of `alloc`.
      *
      * @param index Location of insertion.
      * @param value Value to insert.
      * @param alloc Allocator instance to use for allocation and reallocation.
+     * @param rank  Rank accumulator. Only used if `with_rank`.
      */
-    template <class allocator>
-    void node_insert(dtype index, bool value, allocator* alloc) {
+    template <bool with_rank, class allocator>
+    void node_insert(dtype index, bool value, allocator* alloc, dtype* rank) {
         uint16_t child_index = child_sizes_.find(index);
-        node* child = reinterpret_cast<node*>(children_[child_index]);
+        node* child = own_node(child_index, alloc);
 #ifdef DEBUG
         if (child_index >= child_count_) {
             std::cout << int(child_index) << " >= " << int(child_count_)
@@ -1187,9 +2243,290 @@ class node : uncopyable {
         if (child_index != 0) {
             [[likely]] index -= child_sizes_.get(child_index - 1);
         }
+        if constexpr (with_rank) {
+            *rank += child_index != 0 ? child_sums_.get(child_index - 1) : 0;
+        }
         child_sizes_.increment(child_index, child_count_, 1u);
         child_sums_.increment(child_index, child_count_, value);
-        child->insert(index, value, alloc);
+        child->template insert<with_rank>(index, value, alloc, rank);
+    }
+
+    /**
+     * @brief Batch insertion operation if the children are leaves.
+     *
+     * Consecutive insertions targeting the same leaf are applied directly to
+     * the leaf, with a single update of the cumulative sizes and sums per
+     * group.
+     *
+     * Leaves are reallocated or rebalanced as necessary. If a leaf would need
+     * to be rebalanced but the node is full, processing stops so that the
+     * parent can make room.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param indexes Strictly increasing insertion locations.
+     * @param values  Values to insert.
+     * @param n       Number of insertions.
+     * @param offset  Value to subtract from `indexes` to get local locations.
+     * @param alloc   Instance of alloctor to use for allocation and
+     * reallocation.
+     *
+     * @return Number of insertions completed.
+     */
+    template <class allocator>
+    dtype leaf_insert_batch(const dtype* indexes, const bool* values, dtype n,
+                            dtype offset, allocator* alloc) {
+        dtype i = 0;
+        while (i < n) {
+            uint16_t child_index = child_sizes_.find(indexes[i] - offset);
+            leaf_type* child = own_leaf(child_index, alloc);
+            dtype start = child_index != 0 ? child_sizes_.get(child_index - 1)
+                                           : 0;
+            dtype end = child_sizes_.get(child_index);
+            uint32_t count = 0;
+            uint32_t sum = 0;
+            for (; i < n && indexes[i] - offset <= end + count; i++) {
+                if (child->need_realloc()) {
+                    if (!leaf_can_grow(child) && child_count_ == branches) {
+                        [[unlikely]] break;
+                    }
+                    if (count > 0) {
+                        // Element ranges of leaves may change.
+                        [[unlikely]] break;
+                    }
+                    make_leaf_space(child_index, child, alloc);
+                    child_index = child_sizes_.find(indexes[i] - offset);
+                    child =
+                        reinterpret_cast<leaf_type*>(children_[child_index]);
+                    start = child_index != 0
+                                ? child_sizes_.get(child_index - 1)
+                                : 0;
+                    end = child_sizes_.get(child_index);
+                    [[unlikely]] (void(0));
+                }
+                child->insert(indexes[i] - offset - start, values[i]);
+                count++;
+                sum += values[i];
+            }
+            child_sizes_.increment(child_index, child_count_, count);
+            child_sums_.increment(child_index, child_count_, sum);
+            if (count == 0) {
+                // A full node can't make room for the next insertion.
+                [[unlikely]] break;
+            }
+        }
+        return i;
+    }
+
+    /**
+     * @brief Batch insertion operation if the children are internal nodes.
+     *
+     * Insertions are passed to children in groups, with a single update of
+     * the cumulative sizes and sums per group. If a child is full, it is
+     * rebalanced, unless this node is also full, in which case processing
+     * stops so that the parent can make room.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param indexes Strictly increasing insertion locations.
+     * @param values  Values to insert.
+     * @param n       Number of insertions.
+     * @param offset  Value to subtract from `indexes` to get local locations.
+     * @param alloc   Allocator instance to use for allocation and reallocation.
+     *
+     * @return Number of insertions completed.
+     */
+    template <class allocator>
+    dtype node_insert_batch(const dtype* indexes, const bool* values, dtype n,
+                            dtype offset, allocator* alloc) {
+        dtype i = 0;
+        while (i < n) {
+            uint16_t child_index = child_sizes_.find(indexes[i] - offset);
+            node* child = own_node(child_index, alloc);
+            if (child->child_count() == branches) {
+                if (child_count_ == branches) {
+                    [[unlikely]] break;
+                }
+                rebalance_node(child_index, alloc);
+                child_index = child_sizes_.find(indexes[i] - offset);
+                [[unlikely]] child =
+                    reinterpret_cast<node*>(children_[child_index]);
+            }
+            dtype start =
+                child_index != 0 ? child_sizes_.get(child_index - 1) : 0;
+            dtype end = child_sizes_.get(child_index);
+            // Each insertion into the child moves the end of the child by one.
+            dtype count = 1;
+            while (i + count < n && indexes[i + count] - offset <= end + count) {
+                count++;
+            }
+            count = child->insert_batch(indexes + i, values + i, count,
+                                        offset + start, alloc);
+            dtype sum = 0;
+            for (dtype j = i; j < i + count; j++) {
+                sum += values[j];
+            }
+            child_sizes_.increment(child_index, child_count_, count);
+            child_sums_.increment(child_index, child_count_, sum);
+            i += count;
+        }
+        return i;
+    }
+
+    /**
+     * @brief Recalculate cumulative sizes and sums from the children.
+     */
+    void rebuild_cumulative() {
+        dtype size = 0;
+        dtype sum = 0;
+        for (uint16_t i = 0; i < child_count_; i++) {
+            if (has_leaves()) {
+                leaf_type* child = reinterpret_cast<leaf_type*>(children_[i]);
+                size += child->size();
+                sum += child->p_sum();
+            } else {
+                node* child = reinterpret_cast<node*>(children_[i]);
+                size += child->size();
+                sum += child->p_sum();
+            }
+            child_sizes_.set(i, size);
+            child_sums_.set(i, sum);
+        }
+        for (uint16_t i = child_count_; i < branches; i++) {
+            child_sizes_.set(i, (~dtype(0)) >> 1);
+            child_sums_.set(i, (~dtype(0)) >> 1);
+        }
+    }
+
+    /**
+     * @brief Merge or balance underfull children with their siblings.
+     *
+     * Used after range removal, where any number of elements may have been
+     * removed from the children bordering the range. Leaves with fewer than
+     * `leaf_size / 3` elements and nodes with fewer than `branches / 3`
+     * children are considered underfull.
+     *
+     * Does not change the size or sum of this node.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param alloc Allocator instance to use for reallocation and deallocation.
+     */
+    template <class allocator>
+    void repair(allocator* alloc) {
+        uint16_t i = 0;
+        while (i < child_count_ && child_count_ > 1) {
+            bool underfull;
+            if (has_leaves()) {
+                underfull = reinterpret_cast<leaf_type*>(children_[i])->size() <
+                            leaf_size / 3;
+            } else {
+                underfull = reinterpret_cast<node*>(children_[i])->child_count() <
+                            branches / 3;
+            }
+            if (!underfull) {
+                [[likely]] i++;
+                continue;
+            }
+            i = i + 1 < child_count_ ? i : i - 1;
+            if (has_leaves()) {
+                balance_leaves(i, alloc);
+            } else {
+                balance_nodes(i, alloc);
+            }
+        }
+    }
+
+    /**
+     * @brief Merge or evenly balance two adjacent leaves.
+     *
+     * Leaves are merged if there are too few elements for both leaves to
+     * reach `leaf_size / 3` elements.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param idx   Index of the "left" leaf.
+     * @param alloc Allocator instance to use for reallocation and deallocation.
+     */
+    template <class allocator>
+    void balance_leaves(uint16_t idx, allocator* alloc) {
+        leaf_type* a = own_leaf(idx, alloc);
+        leaf_type* b = own_leaf(idx + 1, alloc);
+        dtype total = a->size() + b->size();
+        if (total < 2 * (leaf_size / 3)) {
+            merge_leaves(a, b, idx, alloc);
+            return;
+        }
+        if (a->size() < b->size()) {
+            dtype addition = b->size() - total / 2;
+            dtype a_cap = a->capacity();
+            if (a_cap * WORD_BITS < a->size() + addition) {
+                dtype n_cap = 2 + (a->size() + addition) / WORD_BITS;
+                n_cap += n_cap % 2;
+                n_cap = n_cap * WORD_BITS <= leaf_size ? n_cap
+                                                       : leaf_size / WORD_BITS;
+                a = alloc->reallocate_leaf(a, a_cap, n_cap);
+                children_[idx] = a;
+            }
+            a->transfer_append(b, addition);
+        } else {
+            dtype addition = a->size() - total / 2;
+            dtype b_cap = b->capacity();
+            if (b_cap * WORD_BITS < b->size() + addition) {
+                dtype n_cap = 2 + (b->size() + addition) / WORD_BITS;
+                n_cap += n_cap % 2;
+                n_cap = n_cap * WORD_BITS <= leaf_size ? n_cap
+                                                       : leaf_size / WORD_BITS;
+                b = alloc->reallocate_leaf(b, b_cap, n_cap);
+                children_[idx + 1] = b;
+            }
+            b->transfer_prepend(a, addition);
+        }
+        if (idx == 0) {
+            child_sizes_.set(0, a->size());
+            [[unlikely]] child_sums_.set(0, a->p_sum());
+        } else {
+            child_sizes_.set(idx, child_sizes_.get(idx - 1) + a->size());
+            child_sums_.set(idx, child_sums_.get(idx - 1) + a->p_sum());
+        }
+    }
+
+    /**
+     * @brief Merge or evenly balance two adjacent nodes.
+     *
+     * Nodes are merged if there are too few children for both nodes to reach
+     * `branches / 3` children. Since the children bordering the transferred
+     * range may be underfull, the resulting nodes are repaired recursively.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param idx   Index of the "left" node.
+     * @param alloc Allocator instance to use for deallocation.
+     */
+    template <class allocator>
+    void balance_nodes(uint16_t idx, allocator* alloc) {
+        node* a = own_node(idx, alloc);
+        node* b = own_node(idx + 1, alloc);
+        uint16_t total = a->child_count() + b->child_count();
+        if (total < 2 * (branches / 3)) {
+            merge_nodes(a, b, idx, alloc);
+            a->repair(alloc);
+            return;
+        }
+        if (a->child_count() < b->child_count()) {
+            a->transfer_append(b, b->child_count() - total / 2);
+        } else {
+            b->transfer_prepend(a, a->child_count() - total / 2);
+        }
+        a->repair(alloc);
+        b->repair(alloc);
+        if (idx == 0) {
+            child_sizes_.set(0, a->size());
+            [[unlikely]] child_sums_.set(0, a->p_sum());
+        } else {
+            child_sizes_.set(idx, child_sizes_.get(idx - 1) + a->size());
+            child_sums_.set(idx, child_sums_.get(idx - 1) + a->p_sum());
+        }
     }
 
     /**
@@ -1324,20 +2661,22 @@ class node : uncopyable {
      * Will maintain structural invariants by reallocating and rebalancing as
      * necessary.
      *
+     * @tparam with_rank Whether to add the rank of `index` to `*rank`.
      * @tparam Allocator Type of `alloc`.
      *
      * @param index Index of element to remove.
      * @param alloc Allocator instance to use for reallocation and deallocation.
+     * @param rank  Rank accumulator. Only used if `with_rank`.
      *
      * @return Value of removed element.
      */
-    template <class allocator>
-    bool leaf_remove(dtype index, allocator* alloc) {
+    template <bool with_rank, class allocator>
+    bool leaf_remove(dtype index, allocator* alloc, dtype* rank) {
         uint16_t child_index = child_sizes_.find(index + 1);
-        leaf_type* child = reinterpret_cast<leaf_type*>(children_[child_index]);
+        leaf_type* child = own_leaf(child_index, alloc);
         if (child->size() <= leaf_size / 3) {
             if (child_index == 0) {
-                leaf_type* sibling = reinterpret_cast<leaf_type*>(children_[1]);
+                leaf_type* sibling = own_leaf(1, alloc);
                 if (sibling->size() > leaf_size * 5 / 9) {
                     rebalance_leaves_right(child, sibling, alloc);
                 } else {
@@ -1345,8 +2684,7 @@ class node : uncopyable {
                 }
                 [[unlikely]] ((void)0);
             } else {
-                leaf_type* sibling =
-                    reinterpret_cast<leaf_type*>(children_[child_index - 1]);
+                leaf_type* sibling = own_leaf(child_index - 1, alloc);
                 if (sibling->size() > leaf_size * 5 / 9) {
                     rebalance_leaves_left(sibling, child, child_index - 1,
                                           alloc);
@@ -1361,6 +2699,10 @@ class node : uncopyable {
         if (child_index != 0) {
             [[likely]] index -= child_sizes_.get(child_index - 1);
         }
+        if constexpr (with_rank) {
+            *rank += child_index != 0 ? child_sums_.get(child_index - 1) : 0;
+            *rank += child->rank(index);
+        }
         bool value = child->remove(index);
         if constexpr (aggressive_realloc) {
             uint64_t cap = child->capacity();
@@ -1456,19 +2798,21 @@ class node : uncopyable {
      * Maintains structural invariants by rebalancing and merging nodes as
      * necessary.
      *
+     * @tparam with_rank Whether to add the rank of `index` to `*rank`.
      * @tparam allocator Type of `alloc`.
      *
      * @param index Index of element to be removed.
      * @param alloc Allocator instanve for eallocation and deallocatioin
+     * @param rank  Rank accumulator. Only used if `with_rank`.
      * @return Value of removed element.
      */
-    template <class allocator>
-    bool node_remove(dtype index, allocator* alloc) {
+    template <bool with_rank, class allocator>
+    bool node_remove(dtype index, allocator* alloc, dtype* rank) {
         uint16_t child_index = child_sizes_.find(index + 1);
-        node* child = reinterpret_cast<node*>(children_[child_index]);
+        node* child = own_node(child_index, alloc);
         if (child->child_count_ <= branches / 3) {
             if (child_index == 0) {
-                node* sibling = reinterpret_cast<node*>(children_[1]);
+                node* sibling = own_node(1, alloc);
                 if (sibling->child_count_ > branches * 5 / 9) {
                     rebalance_nodes_right(child, sibling, 0);
                 } else {
@@ -1476,8 +2820,7 @@ class node : uncopyable {
                 }
                 [[unlikely]] ((void)0);
             } else {
-                node* sibling =
-                    reinterpret_cast<node*>(children_[child_index - 1]);
+                node* sibling = own_node(child_index - 1, alloc);
                 if (sibling->child_count_ > branches * 5 / 9) {
                     rebalance_nodes_left(sibling, child, child_index - 1);
                 } else {
@@ -1491,7 +2834,10 @@ class node : uncopyable {
         if (child_index != 0) {
             [[likely]] index -= child_sizes_.get(child_index - 1);
         }
-        bool value = child->remove(index, alloc);
+        if constexpr (with_rank) {
+            *rank += child_index != 0 ? child_sums_.get(child_index - 1) : 0;
+        }
+        bool value = child->template remove<with_rank>(index, alloc, rank);
         child_sizes_.increment(child_index, child_count_, -1);
         child_sums_.increment(child_index, child_count_, -int(value));
         return value;
@@ -0,0 +1,265 @@
+#ifndef BV_QUERY_SUPPORT_HPP
+#define BV_QUERY_SUPPORT_HPP
+
+#include <immintrin.h>
+
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "uncopyable.hpp"
+
+namespace bv {
+
+/**
+ * @brief Static read-only snapshot of a dynamic bit vector.
+ *
+ * Stores the bits of a bit vector in a flat word array, with supporting
+ * structures for constant time rank and near constant time select, along the
+ * lines of `rank_support_v` and `select_support_mcl` in sdsl.
+ *
+ * Rank support consists of absolute 1-bit counts for every `block_size` bits
+ * (super blocks) and 16-bit counts relative to the super block for every 512
+ * bits (blocks). Rank is then answered with at most 7 full word population
+ * counts.
+ *
+ * Select support stores the position of every `block_size`<sup>th</sup> 1-bit.
+ * The super block containing the target is found by binary search between
+ * consecutive samples, after which blocks and words are scanned linearly.
+ *
+ * Usage is to `append` the leaves of a bit vector in order and then call
+ * `finalize` before querying. Typically the snapshot is generated with
+ * `bv::bit_vector::generate_query_structure`. The snapshot is not updated when
+ * the bit vector is modified.
+ *
+ * @tparam dtype      Integer type to use for indexing (uint32_t or uint64_t).
+ * @tparam leaf_type  Leaf type of the source bit vector. Some kind of bv::leaf.
+ * @tparam block_size Number of bits per super block and number of 1-bits
+ *                    between select samples.
+ */
+template <class dtype, class leaf_type, uint32_t block_size = 2048>
+class query_support : uncopyable {
+   private:
+    /** @brief Number of bits in a computer word. */
+    static const constexpr uint64_t WORD_BITS = 64;
+    /** @brief Number of bits per block. */
+    static const constexpr uint64_t BLOCK_BITS = 512;
+    /** @brief Number of words per block. */
+    static const constexpr uint64_t BLOCK_WORDS = BLOCK_BITS / WORD_BITS;
+    /** @brief Number of blocks per super block. */
+    static const constexpr uint64_t BLOCKS = block_size / BLOCK_BITS;
+
+    static_assert(block_size % BLOCK_BITS == 0,
+                  "block size needs to be divisible by 512");
+    static_assert(block_size <= (uint32_t(1) << 16),
+                  "relative block counts need to fit in 16 bits");
+
+    std::vector<uint64_t> data_;    ///< Bit data.
+    std::vector<dtype> supers_;     ///< 1-bits before each super block.
+    std::vector<uint16_t> blocks_;  ///< 1-bits from super block to block.
+    std::vector<dtype> samples_;    ///< Locations of sampled 1-bits.
+    std::vector<uint64_t> scratch_;  ///< Space for decoding leaves.
+    dtype size_;                    ///< Number of bits stored.
+    dtype sum_;                     ///< Number of 1-bits stored.
+
+   public:
+    /**
+     * @brief Create an empty query support structure.
+     *
+     * @param size_hint Expected number of bits for preallocation.
+     */
+    query_support(dtype size_hint = 0)
+        : data_(),
+          supers_(),
+          blocks_(),
+          samples_(),
+          scratch_(),
+          size_(0),
+          sum_(0) {
+        data_.reserve(size_hint / WORD_BITS + 1);
+    }
+
+    /**
+     * @brief Append the content of a leaf to the end of the structure.
+     *
+     * Buffered operations and run-length encoded content are decoded without
+     * modifying the leaf.
+     *
+     * @param leaf Leaf to append.
+     */
+    void append(const leaf_type* leaf) {
+        dtype n = leaf->size();
+        if (n == 0) {
+            [[unlikely]] return;
+        }
+        dtype words = (n + WORD_BITS - 1) / WORD_BITS;
+        data_.resize((size_ + n) / WORD_BITS + 1, 0);
+        uint16_t offset = size_ % WORD_BITS;
+        if (offset == 0) {
+            leaf->decode(data_.data() + size_ / WORD_BITS);
+        } else {
+            scratch_.resize(words);
+            leaf->decode(scratch_.data());
+            dtype w = size_ / WORD_BITS;
+            for (dtype i = 0; i < words; i++) {
+                data_[w++] |= scratch_[i] << offset;
+                if (w < data_.size()) {
+                    data_[w] |= scratch_[i] >> (WORD_BITS - offset);
+                }
+            }
+        }
+        size_ += n;
+    }
+
+    /**
+     * @brief Build rank and select support for the appended data.
+     *
+     * Needs to be called after the last `append` and before querying.
+     */
+    void finalize() {
+        dtype n_blocks = size_ / BLOCK_BITS + 1;
+        data_.resize(n_blocks * BLOCK_WORDS, 0);
+        scratch_.clear();
+        scratch_.shrink_to_fit();
+        supers_.resize(size_ / block_size + 1);
+        blocks_.resize(n_blocks);
+        samples_.clear();
+        dtype count = 0;
+        dtype next_sample = 1;
+        for (dtype b = 0; b < n_blocks; b++) {
+            if (b % BLOCKS == 0) {
+                supers_[b / BLOCKS] = count;
+            }
+            blocks_[b] = count - supers_[b / BLOCKS];
+            for (dtype w = b * BLOCK_WORDS; w < (b + 1) * BLOCK_WORDS; w++) {
+                uint64_t pop = __builtin_popcountll(data_[w]);
+                while (next_sample <= count + pop) {
+                    uint64_t loc = uint64_t(1) << (next_sample - count - 1);
+                    samples_.push_back(
+                        w * WORD_BITS +
+                        __builtin_ctzll(_pdep_u64(loc, data_[w])));
+                    next_sample += block_size;
+                }
+                count += pop;
+            }
+        }
+        sum_ = count;
+        data_.shrink_to_fit();
+    }
+
+    /**
+     * @brief Value of the i<sup>th</sup> bit.
+     */
+    bool at(dtype i) const {
+        return (data_[i / WORD_BITS] >> (i % WORD_BITS)) & uint64_t(1);
+    }
+
+    /**
+     * @brief Number of 1-bits before position `i`.
+     *
+     * @param i Position in \f$[0, \mathrm{size}]\f$.
+     *
+     * @return \f$\sum_{j = 0}^{i - 1} \mathrm{bv}[j]\f$.
+     */
+    dtype rank(dtype i) const {
+        dtype ret = supers_[i / block_size] + blocks_[i / BLOCK_BITS];
+        dtype target_word = i / WORD_BITS;
+        for (dtype w = (i / BLOCK_BITS) * BLOCK_WORDS; w < target_word; w++) {
+            ret += __builtin_popcountll(data_[w]);
+        }
+        if (i % WORD_BITS) {
+            ret += __builtin_popcountll(
+                data_[target_word] & ((uint64_t(1) << (i % WORD_BITS)) - 1));
+        }
+        return ret;
+    }
+
+    /**
+     * @brief Position of the x<sup>th</sup> 1-bit.
+     *
+     * @param x Selection target in \f$[1, \mathrm{sum}]\f$.
+     *
+     * @return \f$\underset{i \in [0..n)}{\mathrm{arg min}}\left(\sum_{j = 0}^i
+     * \mathrm{bv}[j]\right) = x\f$.
+     */
+    dtype select(dtype x) const {
+        assert(x > 0 && x <= sum_);
+        dtype s = (x - 1) / block_size;
+        dtype lo = samples_[s] / block_size;
+        dtype hi = s + 1 < samples_.size() ? samples_[s + 1] / block_size + 1
+                                           : supers_.size();
+        while (hi - lo > 1) {
+            dtype mid = (lo + hi) / 2;
+            if (supers_[mid] < x) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        x -= supers_[lo];
+        dtype b = lo * BLOCKS;
+        dtype b_end = b + BLOCKS < blocks_.size() ? b + BLOCKS : blocks_.size();
+        while (b + 1 < b_end && blocks_[b + 1] < x) {
+            b++;
+        }
+        x -= blocks_[b];
+        dtype w = b * BLOCK_WORDS;
+        uint64_t pop = __builtin_popcountll(data_[w]);
+        while (pop < x) {
+            x -= pop;
+            pop = __builtin_popcountll(data_[++w]);
+        }
+        uint64_t loc = uint64_t(1) << (x - 1);
+        return w * WORD_BITS + __builtin_ctzll(_pdep_u64(loc, data_[w]));
+    }
+
+    /** @brief Number of bits stored. */
+    dtype size() const { return size_; }
+
+    /** @brief Number of 1-bits stored. */
+    dtype sum() const { return sum_; }
+
+    /**
+     * @brief Size of the structure in bits.
+     */
+    uint64_t bits_size() const {
+        uint64_t ret = sizeof(query_support) * 8;
+        ret += data_.capacity() * sizeof(uint64_t) * 8;
+        ret += supers_.capacity() * sizeof(dtype) * 8;
+        ret += blocks_.capacity() * sizeof(uint16_t) * 8;
+        ret += samples_.capacity() * sizeof(dtype) * 8;
+        return ret;
+    }
+
+    /**
+     * @brief Output summary information about the structure.
+     *
+     * @param internal_only If false, the select samples are also output.
+     * @param out           Stream to output to.
+     */
+    std::ostream& print(bool internal_only = true,
+                        std::ostream& out = std::cout) const {
+        out << "{\n"
+            << "\"type\": \"query_support\",\n"
+            << "\"size\": " << size_ << ",\n"
+            << "\"sum\": " << sum_ << ",\n"
+            << "\"block_size\": " << block_size << ",\n"
+            << "\"super_blocks\": " << supers_.size() << ",\n"
+            << "\"blocks\": " << blocks_.size() << ",\n"
+            << "\"bits_size\": " << bits_size();
+        if (!internal_only) {
+            out << ",\n\"samples\": [";
+            for (dtype i = 0; i < samples_.size(); i++) {
+                out << samples_[i] << (i + 1 < samples_.size() ? ", " : "");
+            }
+            out << "]";
+        }
+        out << "}" << std::endl;
+        return out;
+    }
+};
+
+}  // namespace bv
+
+#endif
@@ -0,0 +1,474 @@
+#ifndef BV_SHARDED_BIT_VECTOR_HPP
+#define BV_SHARDED_BIT_VECTOR_HPP
+
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#include "uncopyable.hpp"
+
+#ifndef CACHE_LINE
+// Apparently the most common cache line size is 64.
+#define CACHE_LINE 64
+#endif
+
+namespace bv {
+
+/**
+ * @brief Bit vector split into independently locked shards.
+ *
+ * The logical sequence is the concatenation of `shard_count` bit vectors,
+ * each with its own lock and (owned) allocator. A small routing index holds
+ * the size and number of 1-bits of each shard. Operations lock the routing
+ * index only for locating the shard, updating the index and taking a ticket
+ * for the shard. The routing index is released before the shard is entered,
+ * so no thread waits for a shard while holding it. Shards serve tickets in
+ * order, so operations on the same shard are applied in the order they were
+ * routed, while updates to different shards proceed in parallel.
+ *
+ * Removal and `set` change the number of 1-bits by an amount only known once
+ * the shard has been updated, using the value returned by the shard. Until
+ * the index is corrected the shard is pending, and `rank`, `select` and
+ * `sum` wait for pending shards they depend on, without holding any lock.
+ *
+ * When an insertion makes a shard larger than twice the average shard size,
+ * all shards are rebuilt with equal sizes. Small shards never trigger this.
+ * Rebuilding takes a ticket for every shard and holds new operations at the
+ * routing index until it is done, and temporarily uses one bit of additional
+ * memory per stored bit.
+ *
+ * Usage:
+ *
+ * ```
+ * bv::sharded_bit_vector<bv::bv> sbv(16);
+ * // From any thread.
+ * sbv.insert(0, true);
+ * uint64_t ones = sbv.rank(sbv.size());
+ * ```
+ *
+ * @tparam bit_vector_type Underlying bit vector. Some kind of bv::bit_vector.
+ */
+template <class bit_vector_type>
+class sharded_bit_vector : uncopyable {
+   private:
+    /** @brief Number of bits in a computer word. */
+    static const constexpr uint64_t WORD_BITS = 64;
+    /** @brief Shards smaller than this do not trigger rebalancing. */
+    static const constexpr uint64_t MIN_REBALANCE_SIZE = 1 << 16;
+
+    /** @brief Independently locked part of the sequence. */
+    struct alignas(CACHE_LINE) shard {
+        std::mutex lock;               ///< Guards `serving` and `bv`.
+        std::condition_variable turn;  ///< Notified when `serving` changes.
+        uint64_t tickets = 0;  ///< Next ticket. Guarded by `router_lock_`.
+        uint64_t serving = 0;  ///< Ticket allowed to access `bv`.
+        bit_vector_type* bv;
+    };
+
+    std::vector<shard> shards_;    ///< Shards in logical order.
+    std::mutex router_lock_;       ///< Guards the routing index, tickets
+                                   ///< and `rebuilding_`.
+    std::condition_variable settled_;  ///< Notified when pending shards are
+                                       ///< settled or a rebuild completes.
+    std::vector<uint64_t> sizes_;  ///< Number of bits in each shard.
+    std::vector<uint64_t> sums_;   ///< Number of 1-bits in each shard.
+    std::vector<uint32_t> pending_;  ///< Unsettled changes of each shard
+                                     ///< to `sums_`.
+    uint64_t size_;                ///< Total number of bits.
+    uint64_t sum_;                 ///< Total number of 1-bits.
+    bool rebuilding_;              ///< True while shards are rebuilt.
+
+    /**
+     * @brief Locate the shard containing position `index`.
+     *
+     * Requires `router_lock_` to be held. If `insert` is true, `index` may be
+     * equal to the size of the structure.
+     *
+     * @param index  Global position. Replaced by the position in the shard.
+     * @param prefix If not null, set to the number of 1-bits in preceding
+     *               shards.
+     *
+     * @return Index of the shard.
+     */
+    uint32_t route(uint64_t& index, bool insert, uint64_t* prefix) const {
+        uint64_t ones = 0;
+        uint32_t s = 0;
+        uint32_t last = shards_.size() - 1;
+        while (s < last &&
+               (index > sizes_[s] || (index == sizes_[s] && !insert))) {
+            index -= sizes_[s];
+            ones += sums_[s++];
+        }
+        if (prefix != nullptr) *prefix = ones;
+        return s;
+    }
+
+    /**
+     * @brief Check that the first `n` shards have no pending changes to
+     * `sums_`. Requires `router_lock_` to be held.
+     */
+    bool settled(uint32_t n) const {
+        for (uint32_t i = 0; i < n; i++) {
+            if (pending_[i] > 0) return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Lock the routing index once no rebuild is in progress.
+     */
+    std::unique_lock<std::mutex> lock_router() {
+        std::unique_lock<std::mutex> router(router_lock_);
+        settled_.wait(router, [&]() { return !rebuilding_; });
+        return router;
+    }
+
+    /**
+     * @brief Wait until shard `s` serves `ticket`.
+     *
+     * Must not be called with `router_lock_` held.
+     *
+     * @return Lock of the shard, to be passed to `leave`.
+     */
+    std::unique_lock<std::mutex> enter(uint32_t s, uint64_t ticket) {
+        std::unique_lock<std::mutex> guard(shards_[s].lock);
+        shards_[s].turn.wait(guard,
+                             [&]() { return shards_[s].serving == ticket; });
+        return guard;
+    }
+
+    /**
+     * @brief Pass shard `s` on to the next ticket.
+     */
+    void leave(uint32_t s, std::unique_lock<std::mutex>& guard) {
+        shards_[s].serving++;
+        guard.unlock();
+        shards_[s].turn.notify_all();
+    }
+
+    /**
+     * @brief Apply the change of a pending operation to the number of
+     * 1-bits in shard `s`.
+     */
+    void settle(uint32_t s, int64_t change) {
+        {
+            std::lock_guard<std::mutex> router(router_lock_);
+            sums_[s] += change;
+            sum_ += change;
+            pending_[s]--;
+        }
+        settled_.notify_all();
+    }
+
+    /**
+     * @brief Check whether shard `s` has grown out of balance.
+     *
+     * Requires `router_lock_` to be held.
+     */
+    bool unbalanced(uint32_t s) const {
+        uint64_t avg = size_ / shards_.size();
+        return sizes_[s] > MIN_REBALANCE_SIZE && sizes_[s] > 2 * avg;
+    }
+
+    /**
+     * @brief Append the `n` first bits of `src` at bit `offset` of `dst`.
+     */
+    static void append_bits(uint64_t* dst, uint64_t offset,
+                            const uint64_t* src, uint64_t n) {
+        uint64_t word = offset / WORD_BITS;
+        uint16_t shift = offset % WORD_BITS;
+        for (uint64_t i = 0; i * WORD_BITS < n; i++) {
+            uint64_t w = src[i];
+            if (n - i * WORD_BITS < WORD_BITS) {
+                w &= (uint64_t(1) << (n - i * WORD_BITS)) - 1;
+            }
+            dst[word + i] |= w << shift;
+            if (shift) {
+                dst[word + i + 1] |= w >> (WORD_BITS - shift);
+            }
+        }
+    }
+
+    /**
+     * @brief Rebuild all shards with equal sizes. Requires all locks held.
+     */
+    void rebuild() {
+        std::vector<uint64_t> data(size_ / WORD_BITS + 2, 0);
+        uint64_t offset = 0;
+        for (uint32_t i = 0; i < shards_.size(); i++) {
+            std::vector<uint64_t> part(sizes_[i] / WORD_BITS + 1, 0);
+            shards_[i].bv->dump(part.data());
+            append_bits(data.data(), offset, part.data(), sizes_[i]);
+            offset += sizes_[i];
+        }
+        uint64_t per_shard = size_ / shards_.size() / WORD_BITS * WORD_BITS;
+        offset = 0;
+        for (uint32_t i = 0; i < shards_.size(); i++) {
+            uint64_t n = i + 1 < shards_.size() ? per_shard : size_ - offset;
+            shards_[i].bv->assign(data.data() + offset / WORD_BITS, n);
+            sizes_[i] = n;
+            sums_[i] = shards_[i].bv->sum();
+            offset += n;
+        }
+    }
+
+    /**
+     * @brief Enter every shard and rebuild if any shard is unbalanced.
+     *
+     * If `force` is false, the structure is only rebuilt if some shard is
+     * unbalanced once no other rebuild is in progress, since another thread
+     * may have rebalanced in the meantime.
+     *
+     * A ticket is taken for every shard and new operations are held at the
+     * routing index, after which operations routed before are allowed to
+     * finish before the shards are rebuilt.
+     */
+    void lock_and_rebuild(bool force) {
+        std::unique_lock<std::mutex> router = lock_router();
+        bool needed = force;
+        for (uint32_t i = 0; !needed && i < shards_.size(); i++) {
+            needed = unbalanced(i);
+        }
+        if (!needed) return;
+        rebuilding_ = true;
+        std::vector<uint64_t> tickets(shards_.size());
+        for (uint32_t i = 0; i < shards_.size(); i++) {
+            tickets[i] = shards_[i].tickets++;
+        }
+        router.unlock();
+        std::vector<std::unique_lock<std::mutex>> guards;
+        guards.reserve(shards_.size());
+        for (uint32_t i = 0; i < shards_.size(); i++) {
+            guards.push_back(enter(i, tickets[i]));
+        }
+        router.lock();
+        rebuild();
+        rebuilding_ = false;
+        router.unlock();
+        settled_.notify_all();
+        for (uint32_t i = 0; i < shards_.size(); i++) {
+            leave(i, guards[i]);
+        }
+    }
+
+    void rebalance_if_needed() { lock_and_rebuild(false); }
+
+   public:
+    /**
+     * @brief Create an empty structure with `shard_count` shards.
+     */
+    sharded_bit_vector(uint32_t shard_count = 16)
+        : shards_(shard_count > 0 ? shard_count : 1),
+          router_lock_(),
+          settled_(),
+          sizes_(shards_.size(), 0),
+          sums_(shards_.size(), 0),
+          pending_(shards_.size(), 0),
+          size_(0),
+          sum_(0),
+          rebuilding_(false) {
+        for (auto& s : shards_) {
+            s.bv = new bit_vector_type();
+        }
+    }
+
+    ~sharded_bit_vector() {
+        for (auto& s : shards_) {
+            delete s.bv;
+        }
+    }
+
+    /** @brief Insert `value` at position `index`. */
+    void insert(uint64_t index, bool value) {
+        std::unique_lock<std::mutex> router = lock_router();
+#ifdef DEBUG
+        if (index > size_) {
+            std::cerr << "Invalid insertion to index " << index << " for "
+                      << size_ << " element bit vector." << std::endl;
+            assert(index <= size_);
+        }
+#endif
+        uint32_t s = route(index, true, nullptr);
+        sizes_[s]++;
+        sums_[s] += value;
+        size_++;
+        sum_ += value;
+        bool drifted = unbalanced(s);
+        uint64_t ticket = shards_[s].tickets++;
+        router.unlock();
+        std::unique_lock<std::mutex> guard = enter(s, ticket);
+        shards_[s].bv->insert(index, value);
+        leave(s, guard);
+        if (drifted) {
+            [[unlikely]] rebalance_if_needed();
+        }
+    }
+
+    /**
+     * @brief Remove the bit at position `index`.
+     *
+     * @return Value of the removed bit.
+     */
+    bool remove(uint64_t index) {
+        std::unique_lock<std::mutex> router = lock_router();
+        assert(index < size_);
+        uint32_t s = route(index, false, nullptr);
+        sizes_[s]--;
+        size_--;
+        pending_[s]++;
+        uint64_t ticket = shards_[s].tickets++;
+        router.unlock();
+        std::unique_lock<std::mutex> guard = enter(s, ticket);
+        bool value = shards_[s].bv->remove(index);
+        settle(s, -int64_t(value));
+        leave(s, guard);
+        return value;
+    }
+
+    /** @brief Set the bit at position `index` to `value`. */
+    void set(uint64_t index, bool value) {
+        std::unique_lock<std::mutex> router = lock_router();
+        assert(index < size_);
+        uint32_t s = route(index, false, nullptr);
+        pending_[s]++;
+        uint64_t ticket = shards_[s].tickets++;
+        router.unlock();
+        std::unique_lock<std::mutex> guard = enter(s, ticket);
+        bool old = shards_[s].bv->at(index);
+        if (old != value) {
+            shards_[s].bv->set(index, value);
+        }
+        settle(s, int64_t(value) - int64_t(old));
+        leave(s, guard);
+    }
+
+    /** @brief Value of the bit at position `index`. */
+    bool at(uint64_t index) {
+        std::unique_lock<std::mutex> router = lock_router();
+        assert(index < size_);
+        uint32_t s = route(index, false, nullptr);
+        uint64_t ticket = shards_[s].tickets++;
+        router.unlock();
+        std::unique_lock<std::mutex> guard = enter(s, ticket);
+        bool ret = shards_[s].bv->at(index);
+        leave(s, guard);
+        return ret;
+    }
+
+    /** @brief Number of 1-bits before position `index`. */
+    uint64_t rank(uint64_t index) {
+        std::unique_lock<std::mutex> router(router_lock_);
+        uint64_t local = 0;
+        uint64_t prefix = 0;
+        uint32_t s = 0;
+        settled_.wait(router, [&]() {
+            if (rebuilding_) return false;
+            if (index >= size_) return settled(shards_.size());
+            local = index;
+            s = route(local, false, &prefix);
+            return settled(s);
+        });
+        if (index >= size_) {
+            return sum_;
+        }
+        uint64_t ticket = shards_[s].tickets++;
+        router.unlock();
+        std::unique_lock<std::mutex> guard = enter(s, ticket);
+        uint64_t ret = prefix + shards_[s].bv->rank(local);
+        leave(s, guard);
+        return ret;
+    }
+
+    /** @brief Position of the `count`<sup>th</sup> 1-bit. */
+    uint64_t select(uint64_t count) {
+        std::unique_lock<std::mutex> router(router_lock_);
+        uint64_t local = 0;
+        uint64_t offset = 0;
+        uint32_t s = 0;
+        settled_.wait(router, [&]() {
+            if (rebuilding_) return false;
+            local = count;
+            offset = 0;
+            s = 0;
+            while (s + 1 < shards_.size() && local > sums_[s] &&
+                   pending_[s] == 0) {
+                local -= sums_[s];
+                offset += sizes_[s++];
+            }
+            return pending_[s] == 0;
+        });
+        assert(count > 0 && count <= sum_);
+        uint64_t ticket = shards_[s].tickets++;
+        router.unlock();
+        std::unique_lock<std::mutex> guard = enter(s, ticket);
+        uint64_t ret = offset + shards_[s].bv->select(local);
+        leave(s, guard);
+        return ret;
+    }
+
+    /** @brief Number of bits stored. */
+    uint64_t size() {
+        std::lock_guard<std::mutex> router(router_lock_);
+        return size_;
+    }
+
+    /** @brief Number of 1-bits stored. */
+    uint64_t sum() {
+        std::unique_lock<std::mutex> router(router_lock_);
+        settled_.wait(router, [&]() { return settled(shards_.size()); });
+        return sum_;
+    }
+
+    /** @brief Number of shards. */
+    uint32_t shard_count() const { return shards_.size(); }
+
+    /**
+     * @brief Rebuild all shards with equal sizes.
+     *
+     * Shard contents are concatenated into a temporary word array, from which
+     * the shards are rebuilt with bulk construction. Shard boundaries are
+     * placed at word boundaries.
+     */
+    void rebalance() { lock_and_rebuild(true); }
+
+    /**
+     * @brief Total size of the data structure in bits.
+     *
+     * Requires that no other thread is using the structure.
+     */
+    uint64_t bit_size() const {
+        uint64_t ret = 8 * sizeof(sharded_bit_vector);
+        ret += 8 * shards_.size() *
+               (sizeof(shard) + 2 * sizeof(uint64_t) + sizeof(uint32_t));
+        for (const auto& s : shards_) {
+            ret += s.bv->bit_size();
+        }
+        return ret;
+    }
+
+    /**
+     * @brief Check that shards are valid and match the routing index.
+     *
+     * Requires that no other thread is using the structure.
+     */
+    void validate() const {
+        uint64_t size = 0;
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < shards_.size(); i++) {
+            shards_[i].bv->validate();
+            assert(sizes_[i] == shards_[i].bv->size());
+            assert(sums_[i] == shards_[i].bv->sum());
+            size += sizes_[i];
+            sum += sums_[i];
+        }
+        assert(size == size_);
+        assert(sum == sum_);
+    }
+};
+
+}  // namespace bv
+
+#endif
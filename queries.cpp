@@ -162,11 +162,11 @@ void test(uint64_t size, uint64_t steps, uint64_t seed) {
 }
 
 typedef bv::malloc_alloc alloc;
-typedef bv::leaf<8> leaf;
+typedef bv::leaf<8, 16384> leaf;
 typedef bv::node<leaf, uint64_t, 16384, 64> node;
 typedef bv::query_support<uint64_t, leaf, 2048> qs;
 
-int main(int argc, char const* argv[]) {
+int main([[maybe_unused]] int argc, [[maybe_unused]] char const* argv[]) {
     uint64_t size = 16384;
     alloc* a = new alloc();
     node* n = a->template allocate_node<node>();
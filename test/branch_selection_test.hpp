@@ -152,6 +152,25 @@ void branch_append_elem_test() {
     }
 }
 
+template<class branch, uint8_t n_branches>
+void branch_find_difference_test() {
+    branch sizes = branch();
+    branch sums = branch();
+    for (uint32_t i = 1; i <= n_branches / 2; i++) {
+        sizes.append(i - 1, 10u);
+        sums.append(i - 1, i % 3);
+    }
+    uint32_t zeros = 0;
+    for (uint32_t i = 0; i < n_branches / 2; i++) {
+        uint32_t prev = zeros;
+        zeros += 10 - (i + 1) % 3;
+        for (uint32_t q = prev + 1; q <= zeros; q++) {
+            ASSERT_EQ(sizes.find_difference(q, sums, n_branches / 2), i)
+                << "q = " << q;
+        }
+    }
+}
+
 TEST(SimpleBranch, Access) { branching_set_access_test<branch, BRANCH>(); }
 
 TEST(SimpleBranch, Increment) { branching_increment_test<branch, BRANCH>(); }
@@ -178,4 +197,8 @@ TEST(SimpleBranch, Remove) { branch_remove_test<branch, BRANCH>(); }
 
 TEST(SimpleBranch, AppendElem) { branch_append_elem_test<branch, BRANCH>(); }
 
+TEST(SimpleBranch, FindDifference) {
+    branch_find_difference_test<branch, BRANCH>();
+}
+
 #endif
\ No newline at end of file
@@ -1,10 +1,29 @@
 #ifndef TEST_BV_HPP
 #define TEST_BV_HPP
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 #include "../deps/googletest/googletest/include/gtest/gtest.h"
 
+template <class bit_vector, class generator>
+void bv_random_fill(bit_vector& bv, uint64_t size, bool removals,
+                    generator& gen) {
+    for (uint64_t i = 0; i < size; i++) {
+        uint64_t pos = i % 7 < 3 ? bv.size() : gen() % (bv.size() + 1);
+        bool val = i % 7 < 3 ? (i / 100) % 2 : gen() % 3 == 0;
+        bv.insert(pos, val);
+        if (removals && i % 5 == 4) {
+            bv.remove(gen() % bv.size());
+        }
+    }
+}
+
 template <class alloc, class bit_vector>
 void bv_instantiation_with_allocator_test() {
     alloc* a = new alloc();
@@ -467,6 +486,1064 @@ void bv_select_0_test(uint64_t size) {
     delete(cbv);
 }
 
+template <class bit_vector>
+void bv_select0_node_test(uint64_t initial, uint64_t size,
+                          uint64_t removals) {
+    bit_vector bv(initial, false);
+    std::mt19937 gen(size);
+    for (uint64_t i = 0; i < size; i++) {
+        bv.insert(gen() % (bv.size() + 1), gen() % 5 == 0);
+    }
+    for (uint64_t i = 0; i < removals; i++) {
+        bv.remove(gen() % bv.size());
+    }
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < bv.size(); i++) {
+        if (!bv.at(i)) {
+            count++;
+            ASSERT_EQ(bv.select0(count), i) << "Select0(" << count << ")";
+        }
+    }
+    ASSERT_EQ(count, bv.size() - bv.sum());
+}
+
+template <class bit_vector>
+void bv_insert_batch_test(uint64_t batches, uint64_t batch_size) {
+    bit_vector bv;
+    std::vector<bool> ref;
+    std::mt19937 gen(batch_size);
+    uint64_t* positions = new uint64_t[batch_size];
+    bool* values = new bool[batch_size];
+    for (uint64_t b = 0; b < batches; b++) {
+        std::vector<std::pair<uint64_t, bool>> sorted;
+        for (uint64_t i = 0; i < batch_size; i++) {
+            positions[i] = gen() % (ref.size() + 1);
+            values[i] = gen() % 3 == 0;
+            sorted.push_back({positions[i], values[i]});
+        }
+        std::stable_sort(sorted.begin(), sorted.end(),
+                         [](auto x, auto y) { return x.first < y.first; });
+        std::vector<bool> merged;
+        uint64_t j = 0;
+        for (uint64_t i = 0; i <= ref.size(); i++) {
+            for (; j < batch_size && sorted[j].first == i; j++) {
+                merged.push_back(sorted[j].second);
+            }
+            if (i < ref.size()) {
+                merged.push_back(ref[i]);
+            }
+        }
+        ref.swap(merged);
+        bv.insert_batch(positions, values, batch_size);
+        ASSERT_EQ(ref.size(), bv.size());
+#ifdef DEBUG
+        bv.validate();
+#endif
+    }
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < ref.size(); i++) {
+        ASSERT_EQ(ref[i], bv.at(i)) << "i = " << i;
+        count += ref[i];
+    }
+    ASSERT_EQ(count, bv.sum());
+    delete[] positions;
+    delete[] values;
+}
+
+template <class bit_vector>
+void bv_remove_range_test(uint64_t size, uint64_t ranges) {
+    std::mt19937_64 gen(size + ranges);
+    uint64_t words = size / 64 + 1;
+    uint64_t* data = new uint64_t[words];
+    for (uint64_t i = 0; i < words; i++) {
+        data[i] = gen();
+    }
+    std::vector<bool> ref;
+    bit_vector bv;
+    for (uint64_t i = 0; i < size; i++) {
+        bool val = (data[i / 64] >> (i % 64)) & 1;
+        ref.push_back(val);
+        bv.insert(i, val);
+    }
+    for (uint64_t r = 0; r < ranges && ref.size() > 0; r++) {
+        uint64_t len = gen() % (ref.size() / (r % 3 == 0 ? 2 : 50) + 1);
+        uint64_t begin = gen() % (ref.size() - len + 1);
+        bv.remove_range(begin, begin + len);
+        ref.erase(ref.begin() + begin, ref.begin() + begin + len);
+        ASSERT_EQ(ref.size(), bv.size());
+#ifdef DEBUG
+        bv.validate();
+#endif
+    }
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < ref.size(); i++) {
+        ASSERT_EQ(ref[i], bv.at(i)) << "i = " << i;
+        ASSERT_EQ(count, bv.rank(i)) << "i = " << i;
+        count += ref[i];
+    }
+    ASSERT_EQ(count, bv.sum());
+    bv.remove_range(0, bv.size());
+    ASSERT_EQ(0u, bv.size());
+    ASSERT_EQ(0u, bv.sum());
+    for (uint64_t i = 0; i < 1000; i++) {
+        bv.insert(i, i % 2);
+    }
+    ASSERT_EQ(500u, bv.sum());
+    delete[] data;
+}
+
+template <class bit_vector>
+void bv_assign_test(uint64_t size, double fill, uint16_t threads = 1) {
+    std::mt19937_64 gen(size);
+    uint64_t words = size / 64 + 1;
+    uint64_t* data = new uint64_t[words];
+    for (uint64_t i = 0; i < words; i++) {
+        data[i] = gen();
+    }
+    bit_vector* bv = new bit_vector(data, size, fill, threads);
+    ASSERT_EQ(size, bv->size());
+#ifdef DEBUG
+    bv->validate();
+#endif
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < size; i++) {
+        bool val = (data[i / 64] >> (i % 64)) & 1;
+        ASSERT_EQ(val, bv->at(i)) << "i = " << i;
+        ASSERT_EQ(count, bv->rank(i)) << "i = " << i;
+        count += val;
+        if (val) {
+            ASSERT_EQ(i, bv->select(count)) << "i = " << i;
+        }
+    }
+    ASSERT_EQ(count, bv->sum());
+
+    bv->assign(data + 1, size / 2, fill, threads);
+    ASSERT_EQ(size / 2, bv->size());
+#ifdef DEBUG
+    bv->validate();
+#endif
+    for (uint64_t i = 0; i < size / 2; i++) {
+        bool val = (data[1 + i / 64] >> (i % 64)) & 1;
+        ASSERT_EQ(val, bv->at(i)) << "i = " << i;
+    }
+    for (uint64_t i = 0; i < size / 4; i++) {
+        bv->insert(i * 2, i % 2);
+    }
+#ifdef DEBUG
+    bv->validate();
+#endif
+    delete bv;
+    delete[] data;
+}
+
+template <class bit_vector>
+void bv_rank_batch_test(uint64_t size, uint64_t queries, bool removals) {
+    std::mt19937_64 gen(size + queries);
+    bit_vector bv;
+    for (uint64_t i = 0; i < size; i++) {
+        bv.insert(gen() % (bv.size() + 1), gen() % 3 == 0);
+        if (removals && i % 5 == 4) {
+            bv.remove(gen() % bv.size());
+        }
+    }
+    uint64_t n = bv.size();
+    uint64_t* positions = new uint64_t[queries];
+    uint64_t* res = new uint64_t[queries];
+    for (uint64_t i = 0; i < queries; i++) {
+        positions[i] = gen() % (n + 1);
+    }
+    positions[0] = 0;
+    positions[queries - 1] = n;
+    if (queries > 2) {
+        positions[1] = positions[2];
+    }
+    std::sort(positions, positions + queries);
+    bv.rank_batch(positions, queries, res);
+    for (uint64_t i = 0; i < queries; i++) {
+        ASSERT_EQ(bv.rank(positions[i]), res[i])
+            << "i = " << i << ", position = " << positions[i];
+    }
+    for (uint64_t i = 0; i < queries; i++) {
+        positions[i] = i;
+    }
+    bv.rank_batch(positions, queries < n ? queries : n, res);
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < queries && i < n; i++) {
+        ASSERT_EQ(count, res[i]) << "i = " << i;
+        count += bv.at(i);
+    }
+    delete[] positions;
+    delete[] res;
+}
+
+template <class bit_vector>
+void bv_select_batch_test(uint64_t size, uint64_t queries, bool removals) {
+    std::mt19937_64 gen(size + queries);
+    bit_vector bv;
+    for (uint64_t i = 0; i < size; i++) {
+        bv.insert(gen() % (bv.size() + 1), gen() % 3 == 0);
+        if (removals && i % 5 == 4) {
+            bv.remove(gen() % bv.size());
+        }
+    }
+    uint64_t n = bv.sum();
+    uint64_t* counts = new uint64_t[queries];
+    uint64_t* res = new uint64_t[queries];
+    for (uint64_t i = 0; i < queries; i++) {
+        counts[i] = 1 + gen() % n;
+    }
+    counts[0] = 1;
+    counts[queries - 1] = n;
+    if (queries > 2) {
+        counts[1] = counts[2];
+    }
+    std::sort(counts, counts + queries);
+    bv.select_batch(counts, queries, res);
+    for (uint64_t i = 0; i < queries; i++) {
+        ASSERT_EQ(bv.select(counts[i]), res[i])
+            << "i = " << i << ", count = " << counts[i];
+    }
+    for (uint64_t i = 0; i < queries; i++) {
+        counts[i] = i + 1;
+    }
+    bv.select_batch(counts, queries < n ? queries : n, res);
+    uint64_t count = 0;
+    for (uint64_t i = 0; count < queries && count < n; i++) {
+        if (bv.at(i)) {
+            ASSERT_EQ(i, res[count]) << "count = " << count;
+            count++;
+        }
+    }
+    delete[] counts;
+    delete[] res;
+}
+
+template <class bit_vector>
+void bv_iterator_test(uint64_t size, bool removals) {
+    std::mt19937_64 gen(size);
+    bit_vector bv;
+    std::vector<bool> ref;
+    for (uint64_t i = 0; i < size; i++) {
+        uint64_t pos = gen() % (ref.size() + 1);
+        bool val = gen() % 3 == 0;
+        if (i % 7 < 3) {
+            pos = ref.size();
+            val = ref.size() > 0 ? ref.back() : val;
+        }
+        bv.insert(pos, val);
+        ref.insert(ref.begin() + pos, val);
+        if (removals && i % 5 == 4) {
+            pos = gen() % ref.size();
+            bv.remove(pos);
+            ref.erase(ref.begin() + pos);
+        }
+    }
+    uint64_t i = 0;
+    for (auto it = bv.begin(); it != bv.end(); ++it) {
+        ASSERT_EQ(ref[i], *it) << "i = " << i;
+        i++;
+    }
+    ASSERT_EQ(ref.size(), i);
+    for (uint16_t bits : {64, 1, 17, 63}) {
+        auto it = bv.iterator_at(bits);
+        for (i = bits; i + bits <= ref.size(); i += bits) {
+            uint64_t expected = 0;
+            for (uint64_t j = 0; j < bits; j++) {
+                expected |= uint64_t(ref[i + j]) << j;
+            }
+            ASSERT_EQ(expected, it.read(bits)) << "i = " << i;
+            ASSERT_EQ(i + bits, it.index());
+        }
+    }
+    auto it = bv.iterator_at(ref.size() / 2);
+    for (i = ref.size() / 2; i < ref.size(); i++) {
+        ASSERT_EQ(ref[i], *(it++)) << "i = " << i;
+    }
+    ASSERT_TRUE(it == bv.end());
+}
+
+template <class bit_vector>
+void bv_get_bits_test(uint64_t size, bool removals) {
+    std::mt19937_64 gen(size);
+    bit_vector bv;
+    bv_random_fill(bv, size, removals, gen);
+    std::vector<bool> ref;
+    for (auto it = bv.begin(); it != bv.end(); ++it) {
+        ref.push_back(*it);
+    }
+    for (uint64_t q = 0; q < 10000; q++) {
+        uint16_t width = 1 + gen() % 64;
+        uint64_t index = gen() % (ref.size() - width + 1);
+        uint64_t expected = 0;
+        for (uint64_t j = 0; j < width; j++) {
+            expected |= uint64_t(ref[index + j]) << j;
+        }
+        ASSERT_EQ(expected, bv.get_bits(index, width))
+            << "index = " << index << ", width = " << width;
+    }
+    for (uint64_t index = 0; index + 64 <= ref.size(); index += 64) {
+        uint64_t expected = 0;
+        for (uint64_t j = 0; j < 64; j++) {
+            expected |= uint64_t(bv.at(index + j)) << j;
+        }
+        ASSERT_EQ(expected, bv.get_bits(index, 64)) << "index = " << index;
+    }
+}
+
+template <class bit_vector>
+void bv_access_rank_test(uint64_t size, bool removals) {
+    std::mt19937_64 gen(size);
+    bit_vector bv;
+    bv_random_fill(bv, size, removals, gen);
+    for (uint64_t i = 0; i < bv.size(); i++) {
+        auto res = bv.access_rank(i);
+        ASSERT_EQ(bv.at(i), res.first) << "i = " << i;
+        ASSERT_EQ(bv.rank(res.first, i), res.second) << "i = " << i;
+    }
+}
+
+template <class bit_vector>
+void bv_update_and_rank_test(uint64_t size, bool removals) {
+    std::mt19937_64 gen(size);
+    bit_vector bv;
+    bit_vector ref;
+    for (uint64_t i = 0; i < size; i++) {
+        uint64_t pos = gen() % (bv.size() + 1);
+        bool val = gen() % 3 == 0;
+        ref.insert(pos, val);
+        ASSERT_EQ(ref.rank(pos), bv.insert_and_rank(pos, val)) << "i = " << i;
+        if (i % 5 == 4) {
+            pos = gen() % bv.size();
+            val = gen() % 2;
+            ref.set(pos, val);
+            ASSERT_EQ(ref.rank(pos), bv.set_and_rank(pos, val)) << "i = " << i;
+        }
+        if (removals && i % 5 == 2) {
+            pos = gen() % bv.size();
+            uint64_t r = ref.rank(pos);
+            bool v = ref.remove(pos);
+            auto res = bv.remove_and_rank(pos);
+            ASSERT_EQ(v, res.first) << "i = " << i;
+            ASSERT_EQ(r, res.second) << "i = " << i;
+        }
+    }
+#ifdef DEBUG
+    bv.validate();
+#endif
+    ASSERT_EQ(ref.size(), bv.size());
+    ASSERT_EQ(ref.sum(), bv.sum());
+    for (uint64_t i = 0; i < ref.size(); i++) {
+        ASSERT_EQ(ref.at(i), bv.at(i)) << "i = " << i;
+    }
+    if (removals) {
+        while (bv.size() > 0) {
+            uint64_t pos = gen() % bv.size();
+            uint64_t r = ref.rank(pos);
+            bool v = ref.remove(pos);
+            auto res = bv.remove_and_rank(pos);
+            ASSERT_EQ(v, res.first);
+            ASSERT_EQ(r, res.second);
+        }
+    }
+}
+
+template <class bit_vector>
+void bv_serialize_test(uint64_t size, bool removals) {
+    std::mt19937_64 gen(size);
+    bit_vector bv;
+    bv_random_fill(bv, size, removals, gen);
+    std::stringstream ss;
+    bv.serialize(ss);
+    bit_vector loaded;
+    loaded.insert(0, true);
+    ASSERT_TRUE(loaded.load(ss));
+#ifdef DEBUG
+    loaded.validate();
+#endif
+    ASSERT_EQ(bv.size(), loaded.size());
+    ASSERT_EQ(bv.sum(), loaded.sum());
+    ASSERT_EQ(bv.bit_size(), loaded.bit_size());
+    for (uint64_t i = 0; i < bv.size(); i++) {
+        ASSERT_EQ(bv.at(i), loaded.at(i)) << "i = " << i;
+        ASSERT_EQ(bv.rank(i), loaded.rank(i)) << "i = " << i;
+    }
+    for (uint64_t i = 0; i < size / 10; i++) {
+        uint64_t pos = gen() % (bv.size() + 1);
+        bool val = gen() % 2;
+        bv.insert(pos, val);
+        loaded.insert(pos, val);
+    }
+    ASSERT_EQ(bv.sum(), loaded.sum());
+    for (uint64_t i = 0; i < bv.size(); i++) {
+        ASSERT_EQ(bv.at(i), loaded.at(i)) << "i = " << i;
+    }
+}
+
+template <class bit_vector>
+void bv_load_invalid_test(uint64_t size) {
+    std::mt19937_64 gen(size);
+    bit_vector bv;
+    bv_random_fill(bv, size, true, gen);
+    std::stringstream ss;
+    bv.serialize(ss);
+    std::string str = ss.str();
+    bit_vector loaded;
+    loaded.insert(0, true);
+    loaded.insert(1, false);
+    for (uint64_t len = 0; len < str.size(); len += 1 + gen() % 64) {
+        std::stringstream truncated(str.substr(0, len));
+        ASSERT_FALSE(loaded.load(truncated)) << "len = " << len;
+    }
+    std::string header = str;
+    header[0] ^= 1;
+    std::stringstream bad_header(header);
+    ASSERT_FALSE(loaded.load(bad_header));
+    std::string bounds = str;
+    uint64_t root = sizeof(uint32_t) * 7;
+    uint16_t too_large = ~uint16_t(0);
+    memcpy(&bounds[root + (bounds[root] ? 1 : 2)], &too_large,
+           sizeof(too_large));
+    std::stringstream bad_bounds(bounds);
+    ASSERT_FALSE(loaded.load(bad_bounds));
+    ASSERT_EQ(2u, loaded.size());
+    ASSERT_EQ(1u, loaded.sum());
+    ASSERT_TRUE(loaded.at(0));
+    ASSERT_FALSE(loaded.at(1));
+}
+
+template <class bit_vector>
+void bv_mapped_test(uint64_t size, bool removals) {
+    std::mt19937_64 gen(size);
+    bit_vector bv;
+    bv_random_fill(bv, size, removals, gen);
+    std::stringstream ss;
+    bv.write_mapped(ss);
+    std::string str = ss.str();
+    ASSERT_EQ(0u, str.size() % 4096);
+    std::vector<uint64_t> data(str.size() / sizeof(uint64_t));
+    memcpy(data.data(), str.data(), str.size());
+    typename bit_vector::mapped_type mapped;
+    ASSERT_TRUE(mapped.init(data.data(), str.size()));
+    ASSERT_EQ(bv.size(), mapped.size());
+    ASSERT_EQ(bv.sum(), mapped.sum());
+    for (uint64_t i = 0; i < bv.size(); i++) {
+        ASSERT_EQ(bv.at(i), mapped.at(i)) << "i = " << i;
+        ASSERT_EQ(bv.rank(i), mapped.rank(i)) << "i = " << i;
+    }
+    ASSERT_EQ(bv.rank(bv.size()), mapped.rank(bv.size()));
+    for (uint64_t i = 1; i <= bv.sum(); i++) {
+        ASSERT_EQ(bv.select(i), mapped.select(i)) << "i = " << i;
+    }
+}
+
+template <class bit_vector>
+void bv_mapped_invalid_test(uint64_t size) {
+    std::mt19937_64 gen(size);
+    bit_vector bv;
+    bv_random_fill(bv, size, true, gen);
+    std::stringstream ss;
+    bv.write_mapped(ss);
+    std::string str = ss.str();
+    std::vector<uint64_t> data(str.size() / sizeof(uint64_t));
+    memcpy(data.data(), str.data(), str.size());
+    typename bit_vector::mapped_type mapped;
+    ASSERT_FALSE(mapped.init("/nonexistent/bit_vector.map"));
+    ASSERT_FALSE(mapped.init(data.data(), str.size() - 4096));
+    ASSERT_EQ(0u, mapped.size());
+    uint64_t root = data[5] / sizeof(uint64_t);
+    std::vector<uint64_t> corrupt = data;
+    if (data[4]) {
+        corrupt[root] = ~uint64_t(0);
+        ASSERT_FALSE(mapped.init(corrupt.data(), str.size()));
+    } else {
+        uint64_t children = root + 1 + 2 * BRANCH;
+        corrupt[children] = str.size();
+        ASSERT_FALSE(mapped.init(corrupt.data(), str.size()));
+        corrupt[children] = data[5];
+        ASSERT_FALSE(mapped.init(corrupt.data(), str.size()));
+        corrupt = data;
+        corrupt[root + 1]++;
+        ASSERT_FALSE(mapped.init(corrupt.data(), str.size()));
+    }
+    ASSERT_TRUE(mapped.init(data.data(), str.size()));
+    ASSERT_EQ(bv.size(), mapped.size());
+    ASSERT_EQ(bv.sum(), mapped.sum());
+}
+
+template <class bit_vector>
+void bv_dump_chunks_test(uint64_t size, uint64_t chunk_words, bool removals) {
+    std::mt19937_64 gen(size);
+    bit_vector bv;
+    bv_random_fill(bv, size, removals, gen);
+    std::vector<uint64_t> words;
+    uint64_t chunks = 0;
+    bv.dump_chunks(
+        [&](const uint64_t* data, uint64_t n) {
+            ASSERT_LE(n, chunk_words);
+            words.insert(words.end(), data, data + n);
+            chunks++;
+        },
+        chunk_words);
+    ASSERT_EQ((bv.size() + 63) / 64, words.size());
+    ASSERT_EQ((words.size() + chunk_words - 1) / chunk_words, chunks);
+    for (uint64_t i = 0; i < bv.size(); i++) {
+        ASSERT_EQ(bv.at(i), bool((words[i / 64] >> (i % 64)) & 1))
+            << "i = " << i;
+    }
+    if (bv.size() % 64) {
+        ASSERT_EQ(0u, words.back() >> (bv.size() % 64));
+    }
+}
+
+template <class bit_vector, bool dump>
+void bv_parallel_traversal_test(uint64_t size, uint16_t threads,
+                                bool removals) {
+    std::mt19937_64 gen(size);
+    std::vector<uint64_t> data(size / 64 + 1);
+    for (auto& w : data) {
+        w = gen();
+    }
+    bit_vector a(data.data(), size);
+    bit_vector b(data.data(), size);
+    for (uint64_t i = 0; i < size / 64; i++) {
+        uint64_t pos = gen() % (a.size() + 1);
+        bool val = gen() % 2;
+        a.insert(pos, val);
+        b.insert(pos, val);
+        if (removals && i % 3 == 2) {
+            pos = gen() % a.size();
+            a.remove(pos);
+            b.remove(pos);
+        }
+    }
+#ifdef DEBUG
+    b.validate(threads);
+#endif
+    ASSERT_EQ(a.leaf_usage(), b.leaf_usage(threads));
+    if constexpr (dump) {
+        std::vector<uint64_t> serial(a.size() / 64 + 1, 0);
+        std::vector<uint64_t> parallel(b.size() / 64 + 1, 0);
+        a.dump(serial.data());
+        b.dump(parallel.data(), threads);
+        ASSERT_EQ(serial, parallel);
+    }
+    b.flush(threads);
+    for (uint64_t i = 0; i < b.size(); i++) {
+        ASSERT_EQ(a.at(i), b.at(i)) << "i = " << i;
+    }
+#ifdef DEBUG
+    b.validate(threads);
+#endif
+}
+
+template <class bit_vector>
+void bv_snapshot_check(bit_vector* bv, const std::vector<uint8_t>& expected) {
+#ifdef DEBUG
+    bv->validate();
+#endif
+    ASSERT_EQ(expected.size(), bv->size());
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < expected.size(); i++) {
+        ASSERT_EQ(bool(expected[i]), bv->at(i)) << "i = " << i;
+        ASSERT_EQ(count, bv->rank(i)) << "i = " << i;
+        count += expected[i];
+    }
+    ASSERT_EQ(count, bv->sum());
+}
+
+template <class bit_vector>
+void bv_snapshot_update(bit_vector* bv, std::vector<uint8_t>& expected,
+                        std::mt19937_64& gen, uint64_t n, bool removals) {
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t pos = gen() % (expected.size() + 1);
+        bool val = gen() % 3 == 0;
+        bv->insert(pos, val);
+        expected.insert(expected.begin() + pos, val);
+        if (removals && i % 4 == 3) {
+            pos = gen() % expected.size();
+            ASSERT_EQ(bool(expected[pos]), bv->remove(pos));
+            expected.erase(expected.begin() + pos);
+        }
+        if (i % 5 == 4) {
+            pos = gen() % expected.size();
+            val = gen() % 2;
+            bv->set(pos, val);
+            expected[pos] = val;
+        }
+    }
+}
+
+template <class bit_vector>
+void bv_snapshot_fill(bit_vector* bv, std::vector<uint8_t>& expected,
+                      std::mt19937_64& gen, uint64_t size) {
+    std::vector<uint64_t> words(size / 64 + 1);
+    for (auto& w : words) {
+        w = gen();
+    }
+    bv->assign(words.data(), size);
+    expected.resize(size);
+    for (uint64_t i = 0; i < size; i++) {
+        expected[i] = (words[i / 64] >> (i % 64)) & 1;
+    }
+}
+
+template <class bit_vector>
+void bv_snapshot_test(uint64_t size, uint64_t updates, bool removals) {
+    std::mt19937_64 gen(size);
+    std::vector<uint8_t> expected;
+    bit_vector* bv = new bit_vector();
+    bv_snapshot_fill(bv, expected, gen, size);
+    std::vector<bit_vector*> snaps;
+    std::vector<std::vector<uint8_t>> snap_expected;
+    for (uint16_t s = 0; s < 3; s++) {
+        snaps.push_back(bv->snapshot());
+        snap_expected.push_back(expected);
+        bv_snapshot_update(bv, expected, gen, updates, removals);
+    }
+    // Snapshots can be updated and snapshotted as well.
+    bv_snapshot_update(snaps[1], snap_expected[1], gen, updates, removals);
+    snaps.push_back(snaps[1]->snapshot());
+    snap_expected.push_back(snap_expected[1]);
+    bv_snapshot_update(snaps[1], snap_expected[1], gen, updates, removals);
+
+    bv_snapshot_check(bv, expected);
+    for (uint16_t s = 0; s < snaps.size(); s++) {
+        bv_snapshot_check(snaps[s], snap_expected[s]);
+    }
+    delete bv;
+    delete snaps[1];
+    bv_snapshot_update(snaps[3], snap_expected[3], gen, updates, removals);
+    for (uint16_t s : {0, 2, 3}) {
+        bv_snapshot_check(snaps[s], snap_expected[s]);
+    }
+    delete snaps[0];
+    delete snaps[3];
+    bv_snapshot_check(snaps[2], snap_expected[2]);
+    delete snaps[2];
+}
+
+template <class alloc_type, class bit_vector>
+void bv_snapshot_alloc_test(uint64_t size, uint64_t updates) {
+    std::mt19937_64 gen(size);
+    std::vector<uint8_t> expected;
+    alloc_type alloc;
+    bit_vector* bv = new bit_vector(&alloc);
+    bv_snapshot_fill(bv, expected, gen, size);
+    bit_vector* snap = bv->snapshot();
+    std::vector<uint8_t> snap_expected = expected;
+    bv_snapshot_update(bv, expected, gen, updates, true);
+    bv->flush();
+    bv_snapshot_check(snap, snap_expected);
+    bv_snapshot_check(bv, expected);
+    delete snap;
+    delete bv;
+    ASSERT_EQ(0u, alloc.live_allocations());
+}
+
+template <class alloc_type>
+uint64_t bv_live_leaves(const alloc_type& alloc) {
+    alloc_stats st = alloc.stats();
+    uint64_t leaves = 0;
+    for (uint16_t i = 0; i < alloc_stats::CAPACITY_BINS; i++) {
+        leaves += st.leaf_capacities[i];
+    }
+    return leaves;
+}
+
+template <class alloc_type, class bit_vector>
+void bv_snapshot_path_test(uint64_t size, uint64_t updates) {
+    std::mt19937_64 gen(size);
+    std::vector<uint8_t> expected;
+    alloc_type alloc;
+    bit_vector* bv = new bit_vector(&alloc);
+    bv_snapshot_fill(bv, expected, gen, size);
+    uint64_t path = 0;
+    for (uint64_t i = 0; i < updates; i++) {
+        bit_vector* snap = bv->snapshot();
+        uint64_t live = alloc.live_allocations();
+        uint64_t leaves = bv_live_leaves(alloc);
+        uint64_t pos = gen() % size;
+        expected[pos] = !expected[pos];
+        bv->set(pos, expected[pos]);
+        // All leaves are at the same depth, so only the path is copied.
+        ASSERT_EQ(leaves + 1, bv_live_leaves(alloc));
+        if (path == 0) {
+            path = alloc.live_allocations() - live;
+        }
+        ASSERT_EQ(live + path, alloc.live_allocations());
+        bv->set(pos, expected[pos]);
+        ASSERT_EQ(live + path, alloc.live_allocations());
+        delete snap;
+        ASSERT_EQ(live, alloc.live_allocations());
+    }
+    ASSERT_LT(1u, path);
+    bv_snapshot_check(bv, expected);
+    delete bv;
+    ASSERT_EQ(0u, alloc.live_allocations());
+}
+
+template <class alloc_type, class bit_vector>
+void bv_snapshot_bulk_test(uint64_t size, uint64_t batch) {
+    std::mt19937_64 gen(size);
+    std::vector<uint8_t> expected;
+    alloc_type alloc;
+    bit_vector* bv = new bit_vector(&alloc);
+    bv_snapshot_fill(bv, expected, gen, size);
+    bv_snapshot_update(bv, expected, gen, batch, false);
+    bit_vector* snap = bv->snapshot();
+    std::vector<uint8_t> snap_expected = expected;
+    uint64_t shared = alloc.live_allocations();
+
+    std::vector<uint64_t> data(bv->size() / 64 + 1, 0);
+    bv->dump(data.data());
+    for (uint64_t i = 0; i < expected.size(); i++) {
+        ASSERT_EQ(bool(expected[i]), bool((data[i / 64] >> (i % 64)) & 1))
+            << "i = " << i;
+    }
+    ASSERT_EQ(shared, alloc.live_allocations());
+
+    uint64_t base = size / 2;
+    std::vector<uint64_t> positions(batch);
+    std::unique_ptr<bool[]> values(new bool[batch]);
+    for (uint64_t i = 0; i < batch; i++) {
+        positions[i] = base + gen() % 100;
+        values[i] = gen() % 2;
+    }
+    bv->insert_batch(positions.data(), values.get(), batch);
+    std::vector<uint64_t> order(batch);
+    for (uint64_t i = 0; i < batch; i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint64_t a, uint64_t b) {
+        return positions[a] < positions[b];
+    });
+    for (uint64_t i = 0; i < batch; i++) {
+        expected.insert(expected.begin() + positions[order[i]] + i,
+                        values[order[i]]);
+    }
+    bv->remove_range(size / 4, size / 4 + size / 8);
+    expected.erase(expected.begin() + size / 4,
+                   expected.begin() + size / 4 + size / 8);
+    // Only the touched paths are copied, not the entire tree.
+    ASSERT_LT(alloc.live_allocations(), shared + shared / 4);
+
+    bv_snapshot_check(bv, expected);
+    bv_snapshot_check(snap, snap_expected);
+    delete bv;
+    bv_snapshot_check(snap, snap_expected);
+    delete snap;
+    ASSERT_EQ(0u, alloc.live_allocations());
+}
+
+template <class node_type>
+void bv_pool_reuse_test(uint64_t count) {
+    pool_alloc a;
+    std::vector<node_type*> nodes;
+    for (uint64_t i = 0; i < count; i++) {
+        nodes.push_back(a.template allocate_node<node_type>());
+        ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(nodes.back()) % CACHE_LINE);
+        ASSERT_EQ(0u, nodes.back()->size());
+    }
+    ASSERT_EQ(count, a.live_allocations());
+    uint64_t reserved = a.slab_bytes();
+    ASSERT_LE(count * sizeof(node_type), reserved);
+    for (uint64_t i = 0; i < count; i += 2) {
+        a.deallocate_node(nodes[i]);
+    }
+    ASSERT_EQ(count / 2, a.live_allocations());
+    for (uint64_t i = 0; i < count; i += 2) {
+        node_type* n = a.template allocate_node<node_type>();
+        ASSERT_EQ(0u, n->size());
+        nodes[i] = n;
+    }
+    ASSERT_EQ(reserved, a.slab_bytes());
+    std::sort(nodes.begin(), nodes.end());
+    for (uint64_t i = 1; i < count; i++) {
+        ASSERT_LE(reinterpret_cast<uintptr_t>(nodes[i - 1]) + sizeof(node_type),
+                  reinterpret_cast<uintptr_t>(nodes[i]));
+    }
+    for (auto n : nodes) {
+        a.deallocate_node(n);
+    }
+    ASSERT_EQ(0u, a.live_allocations());
+}
+
+template <class leaf_type>
+void bv_arena_growth_test(uint64_t max_cap) {
+    arena_alloc a;
+    leaf_type* l = a.template allocate_leaf<leaf_type>(2);
+    leaf_type* other = a.template allocate_leaf<leaf_type>(2);
+    ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(l) % CACHE_LINE);
+    ASSERT_NE(l, other);
+    a.deallocate_leaf(other);
+    uint64_t reserved = a.chunk_bytes();
+    for (uint64_t i = 0; i < max_cap * 64 - 128; i++) {
+        if (l->need_realloc()) {
+            uint64_t cap = l->capacity();
+            leaf_type* n_l = a.reallocate_leaf(l, cap, cap + 2);
+            ASSERT_EQ(l, n_l) << "cap = " << cap;
+            l = n_l;
+        }
+        l->insert(i, i % 3 == 0);
+    }
+    ASSERT_EQ(reserved, a.chunk_bytes());
+    for (uint64_t i = 0; i < l->size(); i++) {
+        ASSERT_EQ(i % 3 == 0, l->at(i)) << "i = " << i;
+    }
+    l = a.reallocate_leaf(l, l->capacity(), l->desired_capacity());
+    other = a.template allocate_leaf<leaf_type>(max_cap);
+    ASSERT_NE(l, other);
+    for (uint64_t i = 0; i < l->size(); i++) {
+        ASSERT_EQ(i % 3 == 0, l->at(i)) << "i = " << i;
+    }
+    a.deallocate_leaf(other);
+    a.deallocate_leaf(l);
+    ASSERT_EQ(0u, a.live_allocations());
+    ASSERT_EQ(reserved, a.chunk_bytes());
+}
+
+template <class memory>
+void bv_memory_test() {
+    memory m;
+    std::vector<uint8_t*> blocks;
+    for (uint64_t i = 0; i < 100; i++) {
+        uint64_t align = uint64_t(64) << (i % 15);
+        uint8_t* b = reinterpret_cast<uint8_t*>(m.allocate(align * 2, align));
+        ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(b) % align);
+        memset(b, int(i), align * 2);
+        blocks.push_back(b);
+    }
+    for (uint64_t i = 0; i < 100; i++) {
+        uint64_t align = uint64_t(64) << (i % 15);
+        for (uint64_t j = 0; j < align * 2; j += 61) {
+            ASSERT_EQ(uint8_t(i), blocks[i][j]);
+        }
+        m.deallocate(blocks[i], align * 2);
+    }
+    for (uint64_t i = 0; i < 100; i++) {
+        uint64_t align = uint64_t(64) << (i % 15);
+        uint8_t* b = reinterpret_cast<uint8_t*>(m.allocate(align * 2, align));
+        ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(b) % align);
+        m.deallocate(b, align * 2);
+    }
+}
+
+class counting_memory : uncopyable {
+   private:
+    heap_memory memory_;
+    uint64_t blocks_ = 0;
+
+   public:
+    void* allocate(uint64_t bytes, uint64_t align) {
+        blocks_++;
+        return memory_.allocate(bytes, align);
+    }
+
+    void deallocate(void* mem, uint64_t bytes) {
+        blocks_--;
+        memory_.deallocate(mem, bytes);
+    }
+
+    uint64_t blocks() const { return blocks_; }
+};
+
+template <class alloc, class bit_vector>
+void bv_alloc_stats_test(uint64_t size) {
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    std::mt19937_64 gen(size);
+    uint64_t peak = 0;
+    for (uint64_t i = 0; i < size; i++) {
+        bv->insert(gen() % (i + 1), gen() % 2);
+        if (i % 1000 == 0) {
+            alloc_stats st = a->stats();
+            peak = std::max(peak, st.reserved_bytes);
+            ASSERT_LE(st.requested_bytes, st.reserved_bytes);
+        }
+    }
+    for (uint64_t i = 0; i < size / 2; i++) {
+        bv->remove(gen() % bv->size());
+    }
+    alloc_stats st = bv->allocator_stats();
+    ASSERT_EQ(a->stats().requested_bytes, st.requested_bytes);
+    ASSERT_LE(st.requested_bytes, st.reserved_bytes);
+    ASSERT_LE(peak, st.peak_reserved_bytes);
+    ASSERT_LE(st.reserved_bytes, st.peak_reserved_bytes);
+    ASSERT_LT(0u, st.reallocations);
+    ASSERT_LE(0.0, st.fragmentation());
+    ASSERT_GT(1.0, st.fragmentation());
+    uint64_t leaves = 0;
+    for (uint16_t i = 0; i < alloc_stats::CAPACITY_BINS; i++) {
+        leaves += st.leaf_capacities[i];
+    }
+    ASSERT_LT(size / 16384, leaves);
+    ASSERT_GT(a->live_allocations(), leaves);
+    std::stringstream out;
+    st.print(out);
+    ASSERT_NE(std::string::npos, out.str().find("reallocations"));
+    delete bv;
+    st = a->stats();
+    ASSERT_EQ(0u, st.requested_bytes);
+    for (uint16_t i = 0; i < alloc_stats::CAPACITY_BINS; i++) {
+        ASSERT_EQ(0u, st.leaf_capacities[i]);
+    }
+    delete a;
+}
+
+template <class alloc, class bit_vector>
+void bv_compact_test(uint64_t size, uint64_t step, bool snapshot,
+                     bool repack) {
+    std::mt19937_64 gen(size);
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    std::vector<uint64_t> words(size / 64 + 1);
+    for (auto& w : words) {
+        w = gen();
+    }
+    bv->assign(words.data(), size, 0.5);
+    std::vector<uint8_t> expected(size);
+    for (uint64_t i = 0; i < size; i++) {
+        expected[i] = (words[i / 64] >> (i % 64)) & 1;
+    }
+    bit_vector* snap = snapshot ? bv->snapshot() : nullptr;
+    std::vector<uint8_t> snap_expected = expected;
+    double usage = bv->leaf_usage();
+    uint64_t allocations = a->live_allocations();
+    uint64_t steps = 1;
+    while (!bv->compact(step, 0.9)) {
+        steps++;
+        bv_snapshot_update(bv, expected, gen, 10, false);
+    }
+    ASSERT_LE(size / (step * 16384), steps);
+    bv_snapshot_check(bv, expected);
+    if (repack) {
+        ASSERT_LT(usage, bv->leaf_usage());
+        if (!snapshot) {
+            ASSERT_GT(allocations, a->live_allocations());
+        }
+    }
+    if (snap != nullptr) {
+        bv_snapshot_check(snap, snap_expected);
+        ASSERT_TRUE(snap->compact());
+        bv_snapshot_check(snap, snap_expected);
+        delete snap;
+    }
+    ASSERT_TRUE(bv->compact());
+    bv_snapshot_check(bv, expected);
+    delete bv;
+    ASSERT_EQ(0u, a->live_allocations());
+    delete a;
+}
+
+template <class alloc, class bit_vector>
+void bv_compact_restart_test(uint64_t size) {
+    std::mt19937_64 gen(size);
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    std::vector<uint64_t> words(size / 64 + 1);
+    for (auto& w : words) {
+        w = gen();
+    }
+    bit_vector* small = new bit_vector(a);
+    small->assign(words.data(), size / 5, 0.5);
+    std::stringstream ss;
+    small->serialize(ss);
+    delete small;
+    // Compaction progress past the end of a replaced tree would end the next
+    // pass immediately.
+    bv->assign(words.data(), size, 0.5);
+    for (uint16_t i = 0; i < 5; i++) {
+        ASSERT_FALSE(bv->compact(16));
+    }
+    bv->assign(words.data(), size / 5, 0.5);
+    ASSERT_FALSE(bv->compact(1));
+    bv->assign(words.data(), size, 0.5);
+    for (uint16_t i = 0; i < 5; i++) {
+        ASSERT_FALSE(bv->compact(16));
+    }
+    ASSERT_TRUE(bv->load(ss));
+    ASSERT_FALSE(bv->compact(1));
+    ASSERT_TRUE(bv->compact());
+    for (uint64_t i = 0; i < size / 5; i++) {
+        ASSERT_EQ(bool((words[i / 64] >> (i % 64)) & 1), bv->at(i));
+    }
+    delete bv;
+    ASSERT_EQ(0u, a->live_allocations());
+    delete a;
+}
+
+template <class alloc, class bit_vector>
+void bv_compact_order_test(uint64_t size) {
+    std::mt19937_64 gen(size);
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    std::vector<uint64_t> words(size / 64 + 1);
+    for (auto& w : words) {
+        w = gen();
+    }
+    bv->assign(words.data(), size, 0.5);
+    std::vector<uint8_t> expected(size);
+    for (uint64_t i = 0; i < size; i++) {
+        expected[i] = (words[i / 64] >> (i % 64)) & 1;
+    }
+    bv_snapshot_update(bv, expected, gen, 2000, true);
+    uint64_t chunk_bytes = a->chunk_bytes();
+    ASSERT_TRUE(bv->compact());
+    bv_snapshot_check(bv, expected);
+    std::vector<uintptr_t> chunks;
+    uintptr_t prev = 0;
+    bv->for_each_leaf([&](const auto* l) {
+        uintptr_t addr = reinterpret_cast<uintptr_t>(l);
+        uintptr_t chunk = addr >> 20;
+        if (chunks.empty() || chunks.back() != chunk) {
+            ASSERT_EQ(chunks.end(),
+                      std::find(chunks.begin(), chunks.end(), chunk));
+            chunks.push_back(chunk);
+        } else {
+            ASSERT_LT(prev, addr);
+        }
+        prev = addr;
+    });
+    ASSERT_EQ(chunks.size() << 20, a->chunk_bytes());
+    ASSERT_GE(chunk_bytes, a->chunk_bytes());
+    delete bv;
+    ASSERT_EQ(0u, a->live_allocations());
+    delete a;
+}
+
+template <class bit_vector>
+std::vector<uint64_t> bv_concurrent_build(uint64_t size, uint64_t seed,
+                                          bool removals) {
+    std::mt19937_64 gen(seed);
+    bit_vector bv;
+    bv_random_fill(bv, size, removals, gen);
+    std::vector<uint64_t> ret;
+    bv.dump_chunks(
+        [&](const uint64_t* data, uint64_t n) {
+            ret.insert(ret.end(), data, data + n);
+        });
+    return ret;
+}
+
+template <class bit_vector>
+void bv_concurrent_test(uint64_t size, uint16_t threads, bool removals) {
+    std::vector<std::vector<uint64_t>> results(threads);
+    std::vector<std::thread> workers;
+    for (uint16_t t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            results[t] = bv_concurrent_build<bit_vector>(size, t, removals);
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    for (uint16_t t = 0; t < threads; t++) {
+        ASSERT_EQ(bv_concurrent_build<bit_vector>(size, t, removals),
+                  results[t])
+            << "t = " << t;
+    }
+}
+
 TEST(SimpleBV, InstantiateWithAlloc) {
     bv_instantiation_with_allocator_test<ma, test_bv>();
 }
@@ -507,4 +1584,327 @@ TEST(SimpleBV, Select0) {
     bv_select_0_test<test_bv, dyn::suc_bv>(10000);
 }
 
-#endif
\ No newline at end of file
+TEST(SimpleBV, Select0Node) {
+    bv_select0_node_test<test_bv>(0, SIZE * 20, SIZE * 2);
+}
+
+TEST(SimpleBV, Select0RLE) {
+    bv_select0_node_test<rle_bv>(SIZE * 40, SIZE * 5, 0);
+}
+
+TEST(SimpleBV, InsertBatch) { bv_insert_batch_test<test_bv>(20, SIZE); }
+
+TEST(SimpleBV, InsertBatchSmall) { bv_insert_batch_test<test_bv>(500, 100); }
+
+TEST(SimpleBV, InsertBatchRLE) { bv_insert_batch_test<rle_bv>(10, SIZE); }
+
+TEST(SimpleBV, RemoveRange) { bv_remove_range_test<test_bv>(SIZE * 100, 30); }
+
+TEST(SimpleBV, RemoveRangeLeaf) { bv_remove_range_test<test_bv>(SIZE / 2, 30); }
+
+TEST(SimpleBV, RankBatchLeaf) {
+    bv_rank_batch_test<test_bv>(SIZE / 2, 1000, true);
+}
+
+TEST(SimpleBV, RankBatchNode) {
+    bv_rank_batch_test<test_bv>(SIZE * 30, 10000, true);
+}
+
+TEST(SimpleBV, RankBatchRLE) {
+    bv_rank_batch_test<rle_bv>(SIZE * 10, 10000, false);
+}
+
+TEST(SimpleBV, SelectBatchLeaf) {
+    bv_select_batch_test<test_bv>(SIZE / 2, 1000, true);
+}
+
+TEST(SimpleBV, SelectBatchNode) {
+    bv_select_batch_test<test_bv>(SIZE * 30, 10000, true);
+}
+
+TEST(SimpleBV, SelectBatchRLE) {
+    bv_select_batch_test<rle_bv>(SIZE * 10, 10000, false);
+}
+
+TEST(SimpleBV, IteratorLeaf) { bv_iterator_test<test_bv>(SIZE / 2, true); }
+
+TEST(SimpleBV, IteratorNode) { bv_iterator_test<test_bv>(SIZE * 4, true); }
+
+TEST(SimpleBV, IteratorRLE) { bv_iterator_test<rle_bv>(SIZE * 4, false); }
+
+TEST(SimpleBV, GetBitsLeaf) { bv_get_bits_test<test_bv>(SIZE / 2, true); }
+
+TEST(SimpleBV, GetBitsNode) { bv_get_bits_test<test_bv>(SIZE * 20, true); }
+
+TEST(SimpleBV, GetBitsRLE) { bv_get_bits_test<rle_bv>(SIZE * 20, false); }
+
+TEST(SimpleBV, AccessRankLeaf) { bv_access_rank_test<test_bv>(SIZE / 2, true); }
+
+TEST(SimpleBV, AccessRankNode) { bv_access_rank_test<test_bv>(SIZE * 20, true); }
+
+TEST(SimpleBV, AccessRankRLE) { bv_access_rank_test<rle_bv>(SIZE * 20, false); }
+
+TEST(SimpleBV, UpdateAndRankLeaf) {
+    bv_update_and_rank_test<test_bv>(SIZE / 2, true);
+}
+
+TEST(SimpleBV, UpdateAndRankNode) {
+    bv_update_and_rank_test<test_bv>(SIZE * 20, true);
+}
+
+TEST(SimpleBV, UpdateAndRankRLE) {
+    bv_update_and_rank_test<rle_bv>(SIZE * 20, false);
+}
+
+TEST(SimpleBV, AssignLeaf) { bv_assign_test<test_bv>(SIZE - 37, 0.75); }
+
+TEST(SimpleBV, AssignNode) { bv_assign_test<test_bv>(SIZE * 50 + 13, 0.75); }
+
+TEST(SimpleBV, AssignNodeNode) {
+    bv_assign_test<test_bv>(SIZE * BRANCH * 3 + 101, 1);
+}
+
+TEST(SimpleBV, AssignRLE) { bv_assign_test<rle_bv>(SIZE * 40 + 7, 0.5); }
+
+TEST(SimpleBV, AssignParallel) {
+    bv_assign_test<test_bv>(SIZE * BRANCH * 3 + 101, 0.75, 4);
+}
+
+TEST(SimpleBV, AssignParallelRLE) {
+    bv_assign_test<rle_bv>(SIZE * 40 + 7, 0.5, 3);
+}
+
+TEST(SimpleBV, SerializeLeaf) { bv_serialize_test<test_bv>(SIZE / 2, true); }
+
+TEST(SimpleBV, SerializeNode) { bv_serialize_test<test_bv>(SIZE * 20, true); }
+
+TEST(SimpleBV, SerializeRLE) { bv_serialize_test<rle_bv>(SIZE * 20, false); }
+
+TEST(SimpleBV, LoadInvalidLeaf) { bv_load_invalid_test<test_bv>(SIZE / 2); }
+
+TEST(SimpleBV, LoadInvalidNode) { bv_load_invalid_test<test_bv>(SIZE * 20); }
+
+TEST(SimpleBV, MappedLeaf) { bv_mapped_test<test_bv>(SIZE / 2, true); }
+
+TEST(SimpleBV, MappedNode) { bv_mapped_test<test_bv>(SIZE * 20, true); }
+
+TEST(SimpleBV, MappedRLE) { bv_mapped_test<rle_bv>(SIZE * 20, false); }
+
+TEST(SimpleBV, MappedInvalidLeaf) {
+    bv_mapped_invalid_test<test_bv>(SIZE / 2);
+}
+
+TEST(SimpleBV, MappedInvalidNode) {
+    bv_mapped_invalid_test<test_bv>(SIZE * 20);
+}
+
+TEST(SimpleBV, DumpChunksLeaf) {
+    bv_dump_chunks_test<test_bv>(SIZE / 2, 3, true);
+}
+
+TEST(SimpleBV, DumpChunksNode) {
+    bv_dump_chunks_test<test_bv>(SIZE * 20, 1000, true);
+}
+
+TEST(SimpleBV, DumpChunksSmall) {
+    bv_dump_chunks_test<test_bv>(SIZE * 20, 1, true);
+}
+
+TEST(SimpleBV, DumpChunksRLE) {
+    bv_dump_chunks_test<rle_bv>(SIZE * 20, 7, false);
+}
+
+TEST(SimpleBV, ParallelTraversalNode) {
+    bv_parallel_traversal_test<test_bv, true>(SIZE * 20 + 11, 3, true);
+}
+
+TEST(SimpleBV, ParallelTraversalNodeNode) {
+    bv_parallel_traversal_test<test_bv, true>(SIZE * BRANCH * 3 + 101, 40,
+                                              true);
+}
+
+TEST(SimpleBV, ParallelTraversalRLE) {
+    bv_parallel_traversal_test<rle_bv, false>(SIZE * 40 + 7, 5, false);
+}
+
+TEST(SimpleBV, SnapshotLeaf) {
+    bv_snapshot_test<test_bv>(SIZE / 4, SIZE / 8, true);
+}
+
+TEST(SimpleBV, SnapshotNode) {
+    bv_snapshot_test<test_bv>(SIZE * 40, SIZE / 2, true);
+}
+
+TEST(SimpleBV, SnapshotRLE) {
+    bv_snapshot_test<rle_bv>(SIZE * 40, SIZE / 2, false);
+}
+
+TEST(SimpleBV, SnapshotAllocations) {
+    bv_snapshot_alloc_test<ma, test_bv>(SIZE * 40, SIZE / 2);
+}
+
+TEST(SimpleBV, SnapshotPath) {
+    bv_snapshot_path_test<ma, test_bv>(SIZE * 40, 100);
+}
+
+TEST(SimpleBV, SnapshotBulk) {
+    bv_snapshot_bulk_test<ma, test_bv>(SIZE * 40, 50);
+}
+
+TEST(SimpleBV, ConcurrentInstances) {
+    bv_concurrent_test<test_bv>(SIZE * 10, 4, true);
+}
+
+TEST(SimpleBV, ConcurrentInstancesRLE) {
+    bv_concurrent_test<rle_bv>(SIZE * 10, 4, false);
+}
+
+TEST(PoolAllocBV, NodeReuse) { bv_pool_reuse_test<nd>(200); }
+
+TEST(PoolAllocBV, InstantiateWithAlloc) {
+    bv_instantiation_with_allocator_test<pa, pool_bv>();
+}
+
+TEST(PoolAllocBV, InstantiateWithoutAlloc) {
+    bv_instantiation_without_allocator_test<pool_bv>();
+}
+
+TEST(PoolAllocBV, InsertSplitDeallocA) {
+    bv_insert_split_dealloc_a_test<pa, pool_bv>(SIZE);
+}
+
+TEST(PoolAllocBV, InsertSplitDeallocB) {
+    bv_insert_split_dealloc_b_test<pa, pool_bv>(SIZE);
+}
+
+TEST(PoolAllocBV, RemoveNodeNode) {
+    bv_remove_node_node_test<pa, pool_bv>(SIZE);
+}
+
+TEST(PoolAllocBV, SetNode) { bv_set_node_test<pa, pool_bv>(SIZE); }
+
+TEST(PoolAllocBV, SnapshotAllocations) {
+    bv_snapshot_alloc_test<pa, pool_bv>(SIZE * 40, SIZE / 2);
+}
+
+TEST(ArenaAllocBV, LeafGrowth) { bv_arena_growth_test<sl>(SIZE / 64); }
+
+TEST(ArenaAllocBV, InstantiateWithAlloc) {
+    bv_instantiation_with_allocator_test<aa, arena_bv>();
+}
+
+TEST(ArenaAllocBV, InsertSplitDeallocA) {
+    bv_insert_split_dealloc_a_test<aa, arena_bv>(SIZE);
+}
+
+TEST(ArenaAllocBV, InsertSplitDeallocB) {
+    bv_insert_split_dealloc_b_test<aa, arena_bv>(SIZE);
+}
+
+TEST(ArenaAllocBV, RemoveNodeNode) {
+    bv_remove_node_node_test<aa, arena_bv>(SIZE);
+}
+
+TEST(ArenaAllocBV, SetNode) { bv_set_node_test<aa, arena_bv>(SIZE); }
+
+TEST(ArenaAllocBV, RemoveRange) {
+    bv_remove_range_test<arena_bv>(SIZE * 100, 30);
+}
+
+TEST(ArenaAllocBV, SnapshotAllocations) {
+    bv_snapshot_alloc_test<aa, arena_bv>(SIZE * 40, SIZE / 2);
+}
+
+TEST(HugePageBV, HeapMemory) { bv_memory_test<heap_memory>(); }
+
+TEST(HugePageBV, HugePageMemory) { bv_memory_test<huge_page_memory>(); }
+
+TEST(HugePageBV, MergeFreeRanges) {
+    huge_page_memory m;
+    const uint64_t block = uint64_t(1) << 20;
+    std::vector<uint8_t*> blocks;
+    for (uint64_t i = 0; i < 32; i++) {
+        blocks.push_back(reinterpret_cast<uint8_t*>(m.allocate(block, 64)));
+    }
+    uint64_t mapped = m.mapped_bytes();
+    for (uint64_t i = 0; i < 32; i += 2) {
+        m.deallocate(blocks[i], block);
+    }
+    for (uint64_t i = 1; i < 32; i += 2) {
+        m.deallocate(blocks[i], block);
+    }
+    // The freed blocks are merged into one range that fits a larger block.
+    uint8_t* b = reinterpret_cast<uint8_t*>(m.allocate(block * 32, 64));
+    ASSERT_EQ(blocks[0], b);
+    ASSERT_EQ(mapped, m.mapped_bytes());
+    m.deallocate(b, block * 32);
+}
+
+TEST(HugePageBV, SharedMemory) {
+    basic_arena_alloc<counting_memory> a;
+    nd* n = a.allocate_node<nd>();
+    sl* l = a.allocate_leaf<sl>();
+    ASSERT_EQ(2u, a.chunk_memory().blocks());
+    a.deallocate_leaf(l);
+    a.deallocate_node(n);
+}
+
+TEST(HugePageBV, InsertSplitDeallocB) {
+    bv_insert_split_dealloc_b_test<ha, huge_bv>(SIZE);
+}
+
+TEST(HugePageBV, RemoveNodeNode) {
+    bv_remove_node_node_test<ha, huge_bv>(SIZE);
+}
+
+TEST(HugePageBV, SnapshotAllocations) {
+    bv_snapshot_alloc_test<ha, huge_bv>(SIZE * 40, SIZE / 2);
+}
+
+TEST(AllocStats, CapacityBins) {
+    ASSERT_EQ(0u, alloc_stats::capacity_bin(1));
+    ASSERT_EQ(1u, alloc_stats::capacity_bin(2));
+    ASSERT_EQ(1u, alloc_stats::capacity_bin(3));
+    ASSERT_EQ(8u, alloc_stats::capacity_bin(258));
+    ASSERT_EQ(alloc_stats::CAPACITY_BINS - 1,
+              alloc_stats::capacity_bin(uint64_t(1) << 40));
+}
+
+TEST(AllocStats, Malloc) { bv_alloc_stats_test<ma, test_bv>(SIZE * 20); }
+
+TEST(AllocStats, Pool) { bv_alloc_stats_test<pa, pool_bv>(SIZE * 20); }
+
+TEST(AllocStats, Arena) { bv_alloc_stats_test<aa, arena_bv>(SIZE * 20); }
+
+TEST(AllocStats, ArenaNodePeak) {
+    aa a;
+    nd* n = a.allocate_node<nd>();
+    alloc_stats st = a.stats();
+    ASSERT_LT(0u, st.reserved_bytes);
+    ASSERT_EQ(st.reserved_bytes, st.peak_reserved_bytes);
+    a.deallocate_node(n);
+}
+
+TEST(Compact, Leaf) { bv_compact_test<ma, test_bv>(SIZE / 2, 1, false, false); }
+
+TEST(Compact, Node) { bv_compact_test<ma, test_bv>(SIZE * 100, 16, false, true); }
+
+TEST(Compact, Restart) { bv_compact_restart_test<ma, test_bv>(SIZE * 100); }
+
+TEST(Compact, Arena) {
+    bv_compact_test<aa, arena_bv>(SIZE * 100, 16, false, true);
+}
+
+TEST(Compact, ArenaOrder) { bv_compact_order_test<aa, arena_bv>(SIZE * 200); }
+
+TEST(Compact, HugePageOrder) {
+    bv_compact_order_test<ha, huge_bv>(SIZE * 200);
+}
+
+TEST(Compact, Snapshot) {
+    bv_compact_test<ma, test_bv>(SIZE * 100, 16, true, true);
+}
+
+TEST(Compact, RLE) { bv_compact_test<ma, rle_bv>(SIZE * 100, 64, false, false); }
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef TEST_CONCURRENT_BIT_VECTOR_HPP
+#define TEST_CONCURRENT_BIT_VECTOR_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../deps/googletest/googletest/include/gtest/gtest.h"
+
+template <class cbv, class bit_vector>
+void cbv_single_thread_test(uint64_t size, bool removals) {
+    std::mt19937_64 gen(size);
+    cbv c;
+    bit_vector ref;
+    auto r = c.reader();
+    for (uint64_t i = 0; i < size; i++) {
+        uint64_t pos = gen() % (ref.size() + 1);
+        bool val = gen() % 3 == 0;
+        c.insert(pos, val);
+        ref.insert(pos, val);
+        if (removals && i % 5 == 4) {
+            pos = gen() % ref.size();
+            ASSERT_EQ(ref.remove(pos), c.remove(pos));
+        }
+    }
+#ifdef DEBUG
+    c.validate();
+#endif
+    ASSERT_EQ(ref.size(), r.size());
+    ASSERT_EQ(ref.sum(), r.sum());
+    for (uint64_t i = 0; i < ref.size(); i++) {
+        ASSERT_EQ(ref.at(i), r.at(i)) << "i = " << i;
+        ASSERT_EQ(ref.rank(i), r.rank(i)) << "i = " << i;
+    }
+    for (uint64_t i = 1; i <= ref.sum(); i++) {
+        ASSERT_EQ(ref.select(i), r.select(i)) << "i = " << i;
+    }
+    ASSERT_EQ(0u, c.retired());
+}
+
+template <class cbv>
+void cbv_reader_slots_test(uint16_t slots) {
+    cbv c;
+    std::vector<typename cbv::reader_handle> handles;
+    for (uint16_t i = 0; i < slots; i++) {
+        handles.push_back(c.reader());
+        ASSERT_TRUE(bool(handles.back()));
+    }
+    auto full = c.reader();
+    ASSERT_FALSE(bool(full));
+    c.insert(0, true);
+    handles.pop_back();
+    auto r = c.reader();
+    ASSERT_TRUE(bool(r));
+    ASSERT_EQ(1u, r.sum());
+}
+
+template <class cbv>
+void cbv_reclaim_test(uint64_t size) {
+    cbv c;
+    auto r = c.reader();
+    uint64_t before = 0;
+    uint64_t retired = 0;
+    r.read([&](const auto& b) {
+        before = b.size();
+        for (uint64_t i = 0; i < size; i++) {
+            c.insert(i, i % 2);
+        }
+        retired = c.retired();
+        return b.size();
+    });
+    ASSERT_EQ(0u, before);
+    ASSERT_EQ(size, retired);
+    ASSERT_EQ(size, r.size());
+    c.set(0, true);
+    ASSERT_EQ(0u, c.retired());
+    ASSERT_EQ(size / 2 + 1, r.sum());
+}
+
+template <class cbv, class bit_vector>
+void cbv_concurrent_test(uint64_t updates, uint16_t readers, bool removals) {
+    cbv c;
+    std::atomic<bool> done(false);
+    std::atomic<uint64_t> failures(0);
+    std::atomic<uint64_t> reads(0);
+    std::vector<std::thread> threads;
+    for (uint16_t t = 0; t < readers; t++) {
+        threads.emplace_back([&]() {
+            auto r = c.reader();
+            while (!done.load()) {
+                bool ok = r.read([](const bit_vector& b) {
+                    // Every published version holds equally many 0- and
+                    // 1-bits.
+                    uint64_t n = b.size();
+                    uint64_t s = b.sum();
+                    if (n != 2 * s || b.rank(n) != s) return false;
+                    return s == 0 || b.select(s) < n;
+                });
+                failures += !ok;
+                reads++;
+            }
+        });
+    }
+    std::mt19937_64 gen(updates);
+    for (uint64_t i = 0; i < updates; i++) {
+        uint64_t a = gen();
+        uint64_t b = gen();
+        if (removals && i % 4 == 3) {
+            c.update([&](bit_vector& bv) {
+                uint64_t one = bv.select(1 + a % bv.sum());
+                bv.remove(one);
+                bv.remove(bv.select(false, 1 + b % (bv.size() - bv.sum())));
+            });
+        } else {
+            c.update([&](bit_vector& bv) {
+                bv.insert(a % (bv.size() + 1), true);
+                bv.insert(b % (bv.size() + 1), false);
+            });
+        }
+    }
+    done = true;
+    for (auto& t : threads) {
+        t.join();
+    }
+    c.update([](bit_vector&) {});
+    ASSERT_EQ(0u, c.retired());
+#ifdef DEBUG
+    c.validate();
+#endif
+    ASSERT_EQ(0u, failures.load());
+    ASSERT_LT(0u, reads.load());
+    uint64_t expected = removals ? updates : 2 * updates;
+    ASSERT_EQ(expected, c.current().size());
+}
+
+TEST(ConcurrentBV, SingleThread) {
+    cbv_single_thread_test<concurrent_bit_vector<test_bv>, test_bv>(SIZE * 4,
+                                                                    true);
+}
+
+TEST(ConcurrentBV, SingleThreadRLE) {
+    cbv_single_thread_test<concurrent_bit_vector<rle_bv>, rle_bv>(SIZE * 4,
+                                                                  false);
+}
+
+TEST(ConcurrentBV, ReaderSlots) {
+    cbv_reader_slots_test<concurrent_bit_vector<test_bv, 4>>(4);
+}
+
+TEST(ConcurrentBV, Reclaim) {
+    cbv_reclaim_test<concurrent_bit_vector<test_bv>>(SIZE * 2);
+}
+
+TEST(ConcurrentBV, Readers) {
+    cbv_concurrent_test<concurrent_bit_vector<test_bv>, test_bv>(SIZE * 2, 4,
+                                                                 true);
+}
+
+TEST(ConcurrentBV, ReadersUnsortedBuffers) {
+    cbv_concurrent_test<concurrent_bit_vector<uns_bv>, uns_bv>(SIZE * 2, 4,
+                                                               true);
+}
+
+TEST(ConcurrentBV, ReadersRLE) {
+    cbv_concurrent_test<concurrent_bit_vector<rle_bv>, rle_bv>(SIZE * 2, 4,
+                                                               false);
+}
+
+#endif
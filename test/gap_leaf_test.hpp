@@ -415,6 +415,29 @@ void gap_leaf_select_test(uint64_t n) {
     delete allocator;
 }
 
+template <class leaf, class alloc>
+void gap_leaf_select0_test(uint64_t n) {
+    alloc* allocator = new alloc();
+    leaf* l = allocator->template allocate_leaf<leaf>(8);
+    for (uint64_t i = 0; i < n; i++) {
+        if (l->need_realloc()) {
+            l = allocator->template reallocate_leaf<leaf>(l, l->capacity(), l->desired_capacity());
+        }
+        l->insert(i / 2, bool(i % 3));
+    }
+
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        if (!l->at(i)) {
+            count++;
+            ASSERT_EQ(l->select0(count), i) << "Select0(" << count << ") should be " << i;
+        }
+    }
+
+    allocator->template deallocate_leaf<leaf>(l);
+    delete allocator;
+}
+
 /*template <class leaf, class alloc>
 void gap_leaf_rank_offset_test(uint64_t n) {
 }
@@ -511,6 +534,10 @@ TEST(GapLeaf, Select) {
     gap_leaf_select_test<g_leaf, ma>(8750);
 }
 
+TEST(GapLeaf, Select0) {
+    gap_leaf_select0_test<g_leaf, ma>(8750);
+}
+
 TEST(GapLeaf, BlockJump) {
     ma* allocator = new ma();
     auto* l = allocator->template allocate_leaf<gap_leaf<SIZE, 32, 7>>();
@@ -2,6 +2,7 @@
 #define TEST_LEAF_HPP
 
 #include <cstdint>
+#include <random>
 #include <iostream>
 
 #include "../deps/googletest/googletest/include/gtest/gtest.h"
@@ -185,6 +186,34 @@ void leaf_select_test(uint64_t n) {
     delete allocator;
 }
 
+template <class leaf, class alloc>
+void leaf_select0_test(uint64_t n) {
+    alloc* allocator = new alloc();
+    leaf* l = allocator->template allocate_leaf<leaf>(8);
+    std::mt19937 gen(n);
+    for (uint64_t i = 0; i < n; i++) {
+        l->insert(gen() % (l->size() + 1), gen() % 2);
+        if (l->need_realloc()) {
+            uint64_t cap = l->capacity();
+            l = allocator->template reallocate_leaf<leaf>(l, cap, 2 * cap);
+        }
+    }
+    for (uint64_t i = 0; i < n / 10; i++) {
+        l->remove(gen() % l->size());
+    }
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < l->size(); i++) {
+        if (!l->at(i)) {
+            count++;
+            ASSERT_EQ(l->select0(count), i) << "Select0(" << count << ")";
+        }
+    }
+    ASSERT_EQ(count, l->size() - l->p_sum());
+
+    allocator->template deallocate_leaf<leaf>(l);
+    delete allocator;
+}
+
 template <class leaf, class alloc>
 void leaf_set_test(uint64_t n) {
     alloc* allocator = new alloc();
@@ -655,6 +684,10 @@ TEST(SimpleLeaf, Select) { leaf_select_test<sl, ma>(10000); }
 
 TEST(SimpleUnsLeaf, Select) { leaf_select_test<uns_buf_leaf, ma>(10000); }
 
+TEST(SimpleLeaf, Select0) { leaf_select0_test<sl, ma>(10000); }
+
+TEST(SimpleUnsLeaf, Select0) { leaf_select0_test<uns_buf_leaf, ma>(10000); }
+
 TEST(SimpleLeaf, Set) { leaf_set_test<sl, ma>(10000); }
 
 TEST(SimpleUnsLeaf, Set) { leaf_set_test<uns_buf_leaf, ma>(10000); }
@@ -726,6 +759,8 @@ TEST(SimpleLeafUnb, Select) { leaf_select_test<ubl, ma>(10000); }
 
 TEST(SimpleLeafUnb, SelectOffset) { leaf_select_test<ubl, ma>(11); }
 
+TEST(SimpleLeafUnb, Select0) { leaf_select0_test<ubl, ma>(10000); }
+
 TEST(SimpleLeafUnb, Set) { leaf_set_test<ubl, ma>(10000); }
 
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <cstdint>
 #include <iostream>
+#include <random>
 
 #include "../deps/googletest/googletest/include/gtest/gtest.h"
 
@@ -185,13 +186,32 @@ void qs_sparse_bv_select_test(uint64_t size, uint64_t ones) {
         val = i == 0 ? false : val;
         bv.insert(0, val);
     }
-    auto* qs = bv.generate_query_structure();
+    auto* q = bv.generate_query_structure();
     ones = bv.sum();
     for (uint64_t i = 1; i <= ones; i++) {
-        ASSERT_EQ(bv.select(i), qs->select(i));
+        ASSERT_EQ(bv.select(i), q->select(i));
     }
 
-    delete qs;
+    delete q;
+}
+
+template <class bit_vector>
+void qs_bv_test(uint64_t size) {
+    std::mt19937_64 gen(size);
+    bit_vector bv;
+    bv_random_fill(bv, size, false, gen);
+    auto* q = bv.generate_query_structure();
+    ASSERT_EQ(bv.size(), q->size());
+    ASSERT_EQ(bv.sum(), q->sum());
+    for (uint64_t i = 0; i < bv.size(); i++) {
+        ASSERT_EQ(bv.at(i), q->at(i)) << "i = " << i;
+        ASSERT_EQ(bv.rank(i), q->rank(i)) << "i = " << i;
+    }
+    ASSERT_EQ(bv.sum(), q->rank(bv.size()));
+    for (uint64_t i = 1; i <= bv.sum(); i++) {
+        ASSERT_EQ(bv.select(i), q->select(i)) << "i = " << i;
+    }
+    delete q;
 }
 
 TEST(QuerySupport, SingleAccess) { qs_access_single_leaf<qs, sl, ma>(SIZE); }
@@ -214,4 +234,8 @@ TEST(QuerySupport, SparseSelect) {
     qs_sparse_bv_select_test<bv::bv>(100000, 34);
 }
 
+TEST(QuerySupport, BitVector) { qs_bv_test<test_bv>(SIZE * 20); }
+
+TEST(QuerySupport, BitVectorRLE) { qs_bv_test<rle_bv>(SIZE * 20); }
+
 #endif
\ No newline at end of file
@@ -121,6 +121,28 @@ void rle_leaf_insert_end_test(uint32_t size, uint32_t i_count) {
     delete a;
 }
 
+template<class rl_l, class alloc>
+void rle_leaf_select0_test(uint32_t size, uint32_t i_count) {
+    alloc* a = new alloc();
+    rl_l* l = a->template allocate_leaf<rl_l>(32, size, false);
+    ASSERT_TRUE(l->is_compressed());
+    for (size_t i = 0; i < i_count; i++) {
+        l->insert((size >> 1) + 3 * i, i % 3);
+    }
+    ASSERT_TRUE(l->is_compressed());
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < l->size(); i++) {
+        if (!l->at(i)) {
+            count++;
+            ASSERT_EQ(l->select0(count), i) << "Select0(" << count << ")";
+        }
+    }
+    ASSERT_EQ(count, l->size() - l->p_sum());
+
+    a->deallocate_leaf(l);
+    delete a;
+}
+
 template<class rl_l, class alloc>
 void rle_leaf_remove_test(uint32_t size, uint32_t i_count) {
     alloc* a = new alloc();
@@ -510,6 +532,12 @@ TEST(RleLeaf, InsertMiddle) {
 
 TEST(RleLeaf, InsertEnd) { rle_leaf_insert_end_test<rll, ma>(10000, 100); }
 
+TEST(RleLeaf, Select0) { rle_leaf_select0_test<rll, ma>(10000, 10); }
+
+TEST(RleLeaf, Select0Committed) {
+    rle_leaf_select0_test<rll, ma>(10000, 100);
+}
+
 TEST(RleLeaf, Remove) { rle_leaf_remove_test<rll, ma>(200, 100); }
 
 TEST(RleLeaf, Set) { rle_leaf_set_test<rll, ma>(200, 100); }
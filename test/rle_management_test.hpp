@@ -28,8 +28,8 @@ void node_split_rle_test() {
     }
     EXPECT_EQ(n->select(1), 300u);
 
-    //n->deallocate(a);
-    a->deallocate_leaf(n);
+    n->deallocate(a);
+    a->deallocate_node(n);
     delete a;
 }
 
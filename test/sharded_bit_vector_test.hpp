@@ -0,0 +1,102 @@
+#ifndef TEST_SHARDED_BIT_VECTOR_HPP
+#define TEST_SHARDED_BIT_VECTOR_HPP
+
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../deps/googletest/googletest/include/gtest/gtest.h"
+
+template <class sbv, class bit_vector>
+void sbv_single_thread_test(uint64_t size, uint32_t shards, bool appends) {
+    std::mt19937_64 gen(size);
+    sbv s(shards);
+    bit_vector ref;
+    for (uint64_t i = 0; i < size; i++) {
+        uint64_t pos = appends ? ref.size() : gen() % (ref.size() + 1);
+        bool val = gen() % 3 == 0;
+        s.insert(pos, val);
+        ref.insert(pos, val);
+        if (i % 5 == 4) {
+            pos = gen() % ref.size();
+            ASSERT_EQ(ref.remove(pos), s.remove(pos));
+        }
+        if (i % 7 == 6) {
+            pos = gen() % ref.size();
+            val = gen() % 2;
+            s.set(pos, val);
+            ref.set(pos, val);
+        }
+    }
+#ifdef DEBUG
+    s.validate();
+#endif
+    ASSERT_EQ(ref.size(), s.size());
+    ASSERT_EQ(ref.sum(), s.sum());
+    for (uint64_t i = 0; i < ref.size(); i++) {
+        ASSERT_EQ(ref.at(i), s.at(i)) << "i = " << i;
+        ASSERT_EQ(ref.rank(i), s.rank(i)) << "i = " << i;
+    }
+    for (uint64_t i = 1; i <= ref.sum(); i++) {
+        ASSERT_EQ(ref.select(i), s.select(i)) << "i = " << i;
+    }
+    s.rebalance();
+#ifdef DEBUG
+    s.validate();
+#endif
+    for (uint64_t i = 0; i < ref.size(); i++) {
+        ASSERT_EQ(ref.at(i), s.at(i)) << "i = " << i;
+    }
+}
+
+template <class sbv>
+void sbv_concurrent_test(uint64_t updates, uint16_t threads) {
+    sbv s(8);
+    std::vector<std::thread> workers;
+    for (uint16_t t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            std::mt19937_64 gen(t);
+            // Other threads never remove more than they have inserted, so
+            // the structure holds at least as many bits as this thread has
+            // added.
+            uint64_t own = 0;
+            for (uint64_t i = 0; i < updates; i++) {
+                s.insert(gen() % (own + 1), t % 2);
+                own++;
+                if (i % 4 == 3) {
+                    s.remove(gen() % own);
+                    own--;
+                }
+                if (i % 8 == 5) {
+                    s.set(gen() % own, t % 2);
+                }
+                s.rank(gen() % own);
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+#ifdef DEBUG
+    s.validate();
+#endif
+    ASSERT_EQ(threads * (updates - updates / 4), s.size());
+    ASSERT_EQ(s.sum(), s.rank(s.size()));
+}
+
+TEST(ShardedBV, SingleThread) {
+    sbv_single_thread_test<sharded_bit_vector<test_bv>, test_bv>(SIZE * 4, 4,
+                                                                 false);
+}
+
+TEST(ShardedBV, Rebalance) {
+    sbv_single_thread_test<sharded_bit_vector<test_bv>, test_bv>(SIZE * 16, 4,
+                                                                 true);
+}
+
+TEST(ShardedBV, Concurrent) {
+    sbv_concurrent_test<sharded_bit_vector<test_bv>>(SIZE, 4);
+}
+
+#endif
@@ -4,8 +4,11 @@
 #include "../bit_vector/internal/bit_vector.hpp"
 #include "../bit_vector/internal/branch_selection.hpp"
 #include "../bit_vector/internal/circular_buffer.hpp"
+#include "../bit_vector/internal/concurrent_bit_vector.hpp"
 #include "../bit_vector/internal/leaf.hpp"
 #include "../bit_vector/internal/node.hpp"
+#include "../bit_vector/internal/query_support.hpp"
+#include "../bit_vector/internal/sharded_bit_vector.hpp"
 
 #include "../bit_vector/internal/gcc_pragmas.hpp"
 #include "../deps/DYNAMIC/include/dynamic/dynamic.hpp"
@@ -26,9 +29,18 @@ typedef leaf<0, SIZE> ubl;
 typedef node<sl, uint64_t, SIZE, BRANCH> nd;
 typedef branchless_scan<uint64_t, BRANCH> branch;
 typedef bit_vector<sl, nd, ma, SIZE, BRANCH, uint64_t> test_bv;
+typedef pool_alloc pa;
+typedef bit_vector<sl, nd, pa, SIZE, BRANCH, uint64_t> pool_bv;
+typedef arena_alloc aa;
+typedef bit_vector<sl, nd, aa, SIZE, BRANCH, uint64_t> arena_bv;
+typedef huge_page_alloc ha;
+typedef bit_vector<sl, nd, ha, SIZE, BRANCH, uint64_t> huge_bv;
+typedef node<uns_buf_leaf, uint64_t, SIZE, BRANCH> uns_nd;
+typedef bit_vector<uns_buf_leaf, uns_nd, ma, SIZE, BRANCH, uint64_t> uns_bv;
 typedef leaf<16, SIZE, true, true> rll;
 typedef node<rll, uint64_t, SIZE, 64, true, true> rl_node;
 typedef simple_bv<16, SIZE, 64, true, true, true> rle_bv;
+typedef query_support<uint64_t, sl, 2048> qs;
 
 // Tests for the buffer implementation
 #include "buffer_tests.hpp"
@@ -57,5 +69,14 @@ typedef simple_bv<16, SIZE, 64, true, true, true> rle_bv;
 // Packed array tests
 #include "packed_array_test.hpp"
 
+// Static query support tests
+#include "query_support_test.hpp"
+
+// Concurrent reader tests
+#include "concurrent_bit_vector_test.hpp"
+
+// Sharded bit vector tests
+#include "sharded_bit_vector_test.hpp"
+
 // Run tests
 #include "run_tests.hpp"
\ No newline at end of file